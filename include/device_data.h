@@ -2,9 +2,65 @@
 #define GCP_DEVICE_DATA__H
 
 #include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
 
+/* keys kept in RAM between commits, a set that doesn't fit is written through */
+#ifndef GCP_NVS_CACHE_KEYS
+#define GCP_NVS_CACHE_KEYS 8
+#endif
+#define GCP_NVS_CACHE_MAX_DATA_SIZE 256
+#define GCP_NVS_DEFAULT_FLUSH_DELAY_MS 60000
+
+typedef struct
+{
+    uint32_t sets;       /* gcp_nvs_set_data and gcp_nvs_delete_data calls */
+    uint32_t writes;     /* blobs written or erased in flash */
+    uint32_t commits;    /* nvs_commit calls */
+    uint32_t cache_hits; /* gets served from RAM */
+    uint32_t dirty_keys; /* waiting for the next flush */
+} gcp_nvs_stats_t;
+
+/* converts a blob stored with from_version, 0 for blobs from gcp_nvs_set_data, to the schema. Anything but ESP_OK erases the key */
+typedef esp_err_t (*gcp_nvs_migrate_t)(uint8_t from_version, const void *old_data, size_t old_size, void *new_data, size_t new_size);
+
+typedef struct
+{
+    const char *name;
+    uint8_t version;          /* bumped whenever the struct layout changes */
+    size_t size;              /* sizeof the struct */
+    gcp_nvs_migrate_t migrate; /* NULL erases blobs of other versions */
+} gcp_nvs_schema_t;
+
+/*
+ * Brings the blobs of the schemas to their current version, only on the first boot of a new firmware.
+ * Later boots compare the stored firmware hash and return without reading the keys.
+ */
+esp_err_t gcp_nvs_init(const gcp_nvs_schema_t *schemas, size_t count);
+
+/*
+ * Typed values carry their type and version, a get leaves the value untouched and returns an error when the key is
+ * missing, has another type or another version, so preload it with the default. Misses are not written back.
+ */
+esp_err_t gcp_nvs_get_i32(const char *name, int32_t *value);
+esp_err_t gcp_nvs_set_i32(const char *name, int32_t value);
+/* ESP_ERR_NVS_INVALID_LENGTH when the string and its terminator don't fit in size */
+esp_err_t gcp_nvs_get_str(const char *name, char *value, size_t size);
+esp_err_t gcp_nvs_set_str(const char *name, const char *value);
+esp_err_t gcp_nvs_get_blob(const char *name, uint8_t version, void *data, size_t size);
+esp_err_t gcp_nvs_set_blob(const char *name, uint8_t version, const void *data, size_t size);
+
+/* untyped blobs, a miss writes default_data */
 void *gcp_nvs_get_data(char *name, void *default_data, size_t size);
 esp_err_t gcp_nvs_set_data(char *name, void *data, size_t size);
 esp_err_t gcp_nvs_delete_data(char *name, size_t size);
 
-#endif
\ No newline at end of file
+/* writes the dirty keys with a single commit, also done before esp_restart and deep sleep in duty cycle mode */
+esp_err_t gcp_nvs_flush(void);
+
+/* a set is committed at most delay_ms later, sets in between are coalesced. 0 commits every set */
+void gcp_nvs_set_flush_delay(uint32_t delay_ms);
+
+void gcp_nvs_get_stats(gcp_nvs_stats_t *stats);
+
+#endif
@@ -6,6 +6,7 @@ extern "C"
 {
 #endif
 #include "gcp_client.h"
+#include "gcp_ota.h"
 #include "stdint.h"
 #include "stdbool.h"
 #include "esp_err.h"
@@ -22,10 +23,78 @@ extern "C"
     typedef void (*gcp_app_state_callback_t)(gcp_app_handle_t client,gcp_app_state_handle_t state, void *user_context);
     typedef void (*gcp_app_connected_callback_t)(gcp_app_handle_t client, void *user_context);
     typedef void (*gcp_app_disconnected_callback_t)(gcp_app_handle_t client, void *user_context);
+    typedef void (*gcp_app_job_callback_t)(gcp_app_handle_t client, void *job_context);
+    typedef void (*gcp_app_sleep_callback_t)(gcp_app_handle_t client, void *user_context);
+
+    /* index in the job table, negative when scheduling failed */
+    typedef int gcp_app_job_t;
 
     #define APP_CONFIG_DEFAULT_STATE_PERIOD_MS 2000
     #define APP_CONFIG_DEFAULT_PULSE_PERIOD_MS 5*60*1000
 
+    #define GCP_APP_TASK_PRIORITY 2
+    /* default stack of the app task, it is also the stack reserved in static storage so the largest stack_size static mode accepts */
+    #ifndef GCP_APP_TASK_STACK_SIZE
+    #define GCP_APP_TASK_STACK_SIZE 4096
+    #endif
+    /* jobs run on the app task, state and pulse use two of them */
+    #ifndef GCP_APP_MAX_JOBS
+    #define GCP_APP_MAX_JOBS 8
+    #endif
+    #define GCP_APP_JOB_NAME_SIZE 16
+    /* period that keeps a job idle, -1 in device_config */
+    #define GCP_APP_JOB_IDLE UINT32_MAX
+    /* the job is paused while MQTT is disconnected and restarts a full period after connecting */
+    #define GCP_APP_JOB_WHEN_CONNECTED (1 << 0)
+    /* the job publishes, it can run up to tx_align_slack_ms early to share a radio wake with another publishing job */
+    #define GCP_APP_JOB_TX (1 << 1)
+    /* publishes closer than this share a radio wake in the radio_wakes count */
+    #ifndef GCP_APP_RADIO_IDLE_MS
+    #define GCP_APP_RADIO_IDLE_MS 100
+    #endif
+
+    #ifndef GCP_APP_STATIC_HANDLE_SIZE
+    #define GCP_APP_STATIC_HANDLE_SIZE (1024 + GCP_APP_MAX_JOBS * 64)
+    #endif
+    /* size of the storage block gcp_app_init_static needs: app handle, client handle and the app task stack */
+    #define GCP_APP_STATIC_STORAGE_SIZE (GCP_APP_STATIC_HANDLE_SIZE + GCP_CLIENT_STATIC_STORAGE_SIZE + GCP_APP_TASK_STACK_SIZE)
+
+    typedef struct
+    {
+        uint64_t opaque[GCP_APP_STATIC_STORAGE_SIZE / sizeof(uint64_t)];
+    } gcp_app_static_storage_t;
+
+    /* state and telemetry are encoded on the app task and published from a network task on the other core */
+    typedef struct
+    {
+        bool enabled;
+        uint32_t queue_length;      /* messages waiting for the network task, default is 8 */
+        uint32_t slot_size;         /* largest topic + message or state in bytes, default is 512 */
+        gcp_task_config_t net_task; /* default is 4096 bytes, priority 2, pinned to the core the app task is not pinned to */
+    } gcp_app_pipeline_config_t;
+
+    /* sampled on their own job, device_state only changes when a value moves past its deadband. Zero values keep the defaults */
+    typedef struct
+    {
+        uint32_t sample_period_ms; /* default is 30 seconds. Assign GCP_APP_JOB_IDLE to turn it off */
+        uint8_t rssi_deadband;     /* dBm, default is 5 */
+        uint32_t rtt_deadband_ms;  /* default is 100 ms */
+    } gcp_app_link_config_t;
+
+    /*
+     * The framework owns the connect, publish, sleep cycle: after every wake it connects, runs every job once
+     * (state and pulse included), waits for PUBACKs and the cloud config, then goes to deep sleep.
+     */
+    typedef struct
+    {
+        bool enabled;
+        uint32_t sleep_period_ms;    /* wake to wake, default is 15 minutes */
+        uint32_t connect_timeout_ms; /* sleep anyway when MQTT isn't connected in time, default is 20 seconds */
+        uint32_t ack_timeout_ms;     /* default is 5 seconds */
+        uint32_t config_wait_ms;     /* wait after connecting for the config the bridge sends on subscribe, default is 2 seconds */
+        gcp_app_sleep_callback_t sleep_callback; /* called on the app task right before deep sleep */
+    } gcp_app_duty_cycle_config_t;
+
     typedef struct
     {
         gcp_device_identifiers_t *device_identifiers;
@@ -33,22 +102,52 @@ extern "C"
         gcp_app_config_callback_t config_callback;
         gcp_app_command_callback_t cmd_callback;
         gcp_app_state_callback_t state_callback;
-        uint32_t state_update_period_ms; /* default is 2 seconds. Assign -1 to turn it off. Lowest GCP allows is 1 second */
+        uint32_t state_update_period_ms; /* default is 2 seconds. Assign GCP_APP_JOB_IDLE to turn it off. Lowest GCP allows is 1 second */
         gcp_app_connected_callback_t connected_callback;
         gcp_app_disconnected_callback_t disconnected_callback;
         char *topic_path_log;
         char *topic_path_pulse;
-        uint32_t pulse_update_period_ms; /* default is 5 minutes. Assign -1 to turn it off. Lowest GCP allows is 1 second */
+        uint32_t pulse_update_period_ms; /* default is 5 minutes. Assign GCP_APP_JOB_IDLE to turn it off. Lowest GCP allows is 1 second */
         void *user_context;
-        const char * ota_server_cert_pem; /* use_global_ca_store is not supported at the moment */
+        const char * ota_server_cert_pem; /* NULL verifies the firmware server with the global CA store */
+        gcp_client_backoff_config_t mqtt_backoff; /* zero values fall back to gcp_client defaults */
+        gcp_client_endpoint_t mqtt_endpoint; /* default is mqtt.googleapis.com */
+        gcp_task_config_t app_task;  /* default is GCP_APP_TASK_STACK_SIZE bytes, priority 2, no core affinity */
+        gcp_task_config_t mqtt_task; /* default is esp-mqtt's CONFIG_MQTT_TASK_STACK_SIZE and CONFIG_MQTT_TASK_PRIORITY */
+        gcp_task_config_t ota_task;  /* default is GCP_OTA_TASK_STACK_SIZE bytes, priority 2, no core affinity. Only exists during an update */
+        gcp_ota_transfer_config_t ota_transfer; /* buffer sizes and timeout of the firmware download */
+        uint32_t ota_health_timeout_ms; /* a new firmware rolls back unless it connects, gets its config and publishes state within it, default 5 minutes */
+        gcp_app_pipeline_config_t pipeline;
+        gcp_app_link_config_t link_quality; /* RSSI, channel, PHY mode and PUBACK round trip in device_state */
+        bool heap_stats; /* report heap used by each framework module in device_state */
+        bool jwt_rtc_cache; /* reuse the JWT after deep sleep, it is always reused across reconnects until it is about to expire */
+        uint32_t tx_align_slack_ms; /* publishing jobs due within this window run together, 0 turns alignment off */
+        bool pulse_metrics; /* pulse carries the radio, NVS and duty cycle counters as JSON instead of the plain "pulse" payload */
+        gcp_app_duty_cycle_config_t duty_cycle;
     } gcp_app_config_t;
 
     gcp_app_handle_t gcp_app_init(gcp_app_config_t *app_config);
 
+    /* 
+     * Everything the framework keeps for the lifetime of the app is placed in storage and FreeRTOS objects are created statically.
+     * cJSON state objects, esp-mqtt and gcp_app_logf still use the heap. The pipeline is turned off, its queue and task would be allocated.
+     */
+    gcp_app_handle_t gcp_app_init_static(gcp_app_config_t *app_config, gcp_app_static_storage_t *storage);
+
     esp_err_t gcp_app_start(gcp_app_handle_t gcp_app);
 
     esp_err_t gcp_app_send_telemetry(gcp_app_handle_t gcp_app, const char *topic, const char *msg);
 
+    /*
+     * Runs callback on the app task every period_ms, delayed by a random 0..jitter_ms so devices don't publish in lockstep.
+     * The name is used for cloud period overrides in device_config "jobs", a period of GCP_APP_JOB_IDLE, -1 in the cloud config, keeps the job idle.
+     */
+    gcp_app_job_t gcp_app_schedule(gcp_app_handle_t gcp_app, const char *name, uint32_t period_ms, uint32_t jitter_ms, uint32_t flags, gcp_app_job_callback_t callback, void *job_context);
+
+    esp_err_t gcp_app_unschedule(gcp_app_handle_t gcp_app, gcp_app_job_t job);
+
+    esp_err_t gcp_app_set_job_period(gcp_app_handle_t gcp_app, const char *name, uint32_t period_ms);
+
     esp_err_t gcp_app_destroy(gcp_app_handle_t gcp_app);
 
     esp_err_t gcp_app_logf(gcp_app_handle_t client, char *format, ...);
@@ -3,25 +3,101 @@
 
 #include "gcp_app.h"
 #include <freertos/FreeRTOS.h>
-#include <freertos/timers.h>
 #include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+#include "gcp_queue.h"
 
-#define GCP_EVENT_DEVICE_PULSE_BIT BIT2
-#define GCP_EVENT_STATE_UPDATE_BIT BIT1
+#define GCP_EVENT_SCHEDULE_CHANGED_BIT BIT1
 #define GCP_EVENT_APP_TASK_END_BIT BIT3
+#define GCP_EVENT_CONNECTED_BIT BIT4
+#define GCP_EVENT_CONFIG_RECEIVED_BIT BIT5
+#define GCP_EVENT_APP_TASK_ENDED_BIT BIT6
+#define GCP_EVENT_NET_TASK_ENDED_BIT BIT7
+
+/* framework jobs, they are not reported or overridden through device_config "jobs" */
+#define GCP_JOB_INTERNAL (1 << 16)
+
+typedef struct
+{
+    char name[GCP_APP_JOB_NAME_SIZE];
+    gcp_app_job_callback_t callback; /* NULL for a free slot */
+    void *job_context;
+    uint32_t period_ms;
+    uint32_t jitter_ms;
+    uint32_t flags;
+    bool paused;
+    int64_t base_us; /* deadline without jitter, periods are added to it so jitter doesn't accumulate */
+    int64_t next_run_us;
+} gcp_job_t;
+
+typedef struct
+{
+    bool associated;
+    int8_t rssi;
+    uint8_t channel;
+    const char *phy;
+    uint32_t rtt_ms;
+} gcp_link_sample_t;
 
 struct gcp_app_client_t
 {
     gcp_client_handle_t gcp_client;
     gcp_app_config_t *app_config;
-    xTimerHandle state_update_timer;
-    xTimerHandle device_pulse_timer;
+    gcp_app_config_t app_config_storage;
+    gcp_device_identifiers_t device_identifiers_storage;
+    bool static_storage;
+    gcp_job_t jobs[GCP_APP_MAX_JOBS];
+    SemaphoreHandle_t jobs_lock;
+    StaticSemaphore_t jobs_lock_buffer;
     EventGroupHandle_t app_event_group;
+    StaticEventGroup_t app_event_group_buffer;
+    TaskHandle_t app_task;
+    StackType_t *app_task_stack; /* only set in static mode, the task is created with xTaskCreate otherwise */
+    StaticTask_t app_task_buffer;
+    char *state_buffer; /* reused for every state update, grows when the state doesn't fit */
+    size_t state_buffer_size;
+    gcp_queue_t pipeline_queue;
+    SemaphoreHandle_t pipeline_lock;
+    StaticSemaphore_t pipeline_lock_buffer;
+    TaskHandle_t net_task;
+    volatile bool net_task_stop;
+    volatile bool state_resend; /* the network task couldn't publish the last state it took from the queue */
+    uint32_t pipeline_dropped;
+    uint32_t pipeline_failed; /* publishes the network task got an error for */
+    uint32_t radio_wakes;
+    uint32_t tx_aligned; /* publishing jobs that ran early to share a radio wake */
+    int64_t last_tx_us;
+    gcp_link_sample_t link; /* last reported sample, device_state reads it without calling into the Wi-Fi driver */
 };
 
 void gcp_app_connected_callback(gcp_client_handle_t client, void *user_context);
 void gcp_app_config_callback(gcp_client_handle_t client, gcp_client_config_handle_t config, void *user_context);
 void gcp_app_command_callback(gcp_client_handle_t client, char *topic, char *command, void *user_context);
 void gcp_app_disconnected_callback(gcp_client_handle_t client, void *user_context);
+void gcp_app_device_config_received(gcp_app_handle_t app_handle, cJSON *device_config);
+
+void gcp_scheduler_init(gcp_app_handle_t app);
+gcp_app_job_t gcp_scheduler_add(gcp_app_handle_t app, const char *name, uint32_t period_ms, uint32_t jitter_ms, uint32_t flags, gcp_app_job_callback_t callback, void *job_context);
+esp_err_t gcp_scheduler_remove(gcp_app_handle_t app, gcp_app_job_t job);
+esp_err_t gcp_scheduler_set_period(gcp_app_handle_t app, const char *name, uint32_t period_ms);
+void gcp_scheduler_set_connected(gcp_app_handle_t app, bool connected);
+TickType_t gcp_scheduler_run(gcp_app_handle_t app);
+void gcp_scheduler_run_all(gcp_app_handle_t app);
+void gcp_app_count_radio_tx(gcp_app_handle_t app);
+cJSON *gcp_scheduler_get_periods(gcp_app_handle_t app);
+
+void gcp_duty_cycle_init(gcp_app_handle_t app);
+void gcp_duty_cycle_config_received(gcp_app_handle_t app, cJSON *device_config);
+int gcp_duty_cycle_print(gcp_app_handle_t app, char *buffer, size_t size);
+void gcp_duty_cycle_run(gcp_app_handle_t app);
+
+void gcp_link_init(gcp_app_handle_t app);
+bool gcp_link_apply_deadband(gcp_link_sample_t *reported, const gcp_link_sample_t *sample, const gcp_app_link_config_t *config);
+
+esp_err_t gcp_pipeline_init(gcp_app_handle_t app);
+esp_err_t gcp_pipeline_start(gcp_app_handle_t app);
+void gcp_pipeline_stop(gcp_app_handle_t app);
+esp_err_t gcp_pipeline_send_state(gcp_app_handle_t app, cJSON *state);
+esp_err_t gcp_pipeline_send_telemetry(gcp_app_handle_t app, const char *topic, const char *message);
 
 #endif
\ No newline at end of file
@@ -12,6 +12,14 @@ extern "C"
 
     #define JWT_TOKEN_BUFFER_SIZE 581
 
+    /* incoming config and command messages bigger than this are dropped */
+    #ifndef GCP_CLIENT_RX_BUFFER_SIZE
+    #define GCP_CLIENT_RX_BUFFER_SIZE 2048
+    #endif
+
+    /* size of the storage block gcp_client_init_static needs, checked against the handle at compile time */
+    #define GCP_CLIENT_STATIC_STORAGE_SIZE (GCP_CLIENT_RX_BUFFER_SIZE + 2048)
+
     struct gcp_client_t;
     typedef struct gcp_client_t *gcp_client_handle_t;
 
@@ -33,6 +41,53 @@ extern "C"
         char device_id[50];
     } gcp_device_identifiers_t;
 
+    typedef enum
+    {
+        GCP_CLIENT_STATE_STOPPED = 0,
+        GCP_CLIENT_STATE_CONNECTING,
+        GCP_CLIENT_STATE_CONNECTED,
+        GCP_CLIENT_STATE_BACKOFF,
+    } gcp_client_state_t;
+
+    typedef enum
+    {
+        GCP_CLIENT_ENDPOINT_DEFAULT = 0, /* mqtt.googleapis.com, verified with the full Google roots bundle */
+        GCP_CLIENT_ENDPOINT_LTS,         /* mqtt.2030.ltsapis.goog, verified with the minimal primary/backup root set */
+    } gcp_client_endpoint_t;
+
+    /* reconnect window grows exponentially from initial_delay_ms up to max_delay_ms, actual delay is picked randomly inside the window (full jitter) */
+    typedef struct
+    {
+        uint32_t initial_delay_ms;     /* default is 1 second */
+        uint32_t max_delay_ms;         /* default is 60 seconds */
+        uint32_t fast_retry_delay_ms;  /* window for the first retry after a stable connection drops, default is 500 ms */
+        uint32_t stable_connection_ms; /* connections that lived longer than this are considered transient drops, default is 60 seconds */
+    } gcp_client_backoff_config_t;
+
+    /* zero values keep the defaults of the task */
+    typedef struct
+    {
+        uint32_t stack_size; /* bytes */
+        uint32_t priority;
+        bool pin_to_core;
+        int core_id;
+    } gcp_task_config_t;
+
+    typedef struct
+    {
+        gcp_client_state_t state;
+        uint32_t time_in_state_ms;
+        uint32_t reconnect_count;
+        uint32_t failed_attempts;         /* consecutive failed connection attempts */
+        uint32_t next_retry_delay_ms;
+        uint32_t last_connect_latency_ms; /* from connection attempt start to MQTT CONNACK */
+        uint32_t last_offline_ms;         /* time spent disconnected before the current connection */
+        uint32_t last_jwt_ms;             /* time spent in jwt_callback for the last connection, 0 if the cached token was reused */
+        uint32_t mqtt_stack_free;         /* high water mark of the esp-mqtt task stack in bytes, 0 until connected */
+        uint32_t unacked_publishes;       /* QoS 1 publishes still waiting for PUBACK */
+        uint32_t last_rtt_ms;             /* publish to PUBACK of the last timed publish, 0 until one was acknowledged */
+    } gcp_client_stats_t;
+
     typedef struct
     {
         gcp_device_identifiers_t *device_identifiers;
@@ -42,10 +97,22 @@ extern "C"
         gcp_client_connected_callback_t connected_callback;
         gcp_client_disconnected_callback_t disconnected_callback;
         void *user_context;
+        gcp_client_backoff_config_t backoff;
+        bool jwt_rtc_cache; /* keep the JWT in RTC memory so it is reused after deep sleep */
+        gcp_task_config_t mqtt_task; /* stack_size and priority are passed to esp-mqtt, its core is set with CONFIG_MQTT_USE_CORE_x */
+        gcp_client_endpoint_t endpoint; /* LTS endpoint verifies the server with the global CA store, load it with wifi_helper_set_global_ca_store_der */
     } gcp_client_config_t;
 
+    typedef struct
+    {
+        uint64_t opaque[GCP_CLIENT_STATIC_STORAGE_SIZE / sizeof(uint64_t)];
+    } gcp_client_static_storage_t;
+
     gcp_client_handle_t gcp_client_init(gcp_client_config_t *client_config);
 
+    /* handle, config copy and topic strings are placed in storage, nothing is allocated by gcp_client itself */
+    gcp_client_handle_t gcp_client_init_static(gcp_client_config_t *client_config, gcp_client_static_storage_t *storage);
+
     esp_err_t gcp_client_start(gcp_client_handle_t client);
 
     esp_err_t gcp_send_state(gcp_client_handle_t client, const char *state);
@@ -54,6 +121,8 @@ extern "C"
 
     esp_err_t gcp_client_destroy(gcp_client_handle_t client);
 
+    esp_err_t gcp_client_get_stats(gcp_client_handle_t client, gcp_client_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
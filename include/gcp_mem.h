@@ -0,0 +1,52 @@
+#ifndef GCP_MEM__H
+#define GCP_MEM__H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <stdarg.h>
+#include "stdint.h"
+
+    typedef enum
+    {
+        GCP_MEM_APP = 0,
+        GCP_MEM_CLIENT,
+        GCP_MEM_JWT,
+        GCP_MEM_OTA,
+        GCP_MEM_NVS,
+        GCP_MEM_JSON, /* only used after gcp_mem_track_cjson */
+        GCP_MEM_MODULE_MAX
+    } gcp_mem_module_t;
+
+    typedef struct
+    {
+        size_t current_bytes;
+        size_t peak_bytes;
+        uint32_t live_allocs;  /* allocations not freed yet */
+        uint32_t total_allocs; /* allocations since boot */
+    } gcp_mem_stats_t;
+
+    /* every block carries a small header with its size and module, release them with gcp_mem_free only */
+    void *gcp_mem_malloc(gcp_mem_module_t module, size_t size);
+    void *gcp_mem_calloc(gcp_mem_module_t module, size_t count, size_t size);
+    int gcp_mem_asprintf(gcp_mem_module_t module, char **str, const char *format, ...);
+    int gcp_mem_vasprintf(gcp_mem_module_t module, char **str, const char *format, va_list argptr);
+    void gcp_mem_free(void *ptr);
+
+    void gcp_mem_get_stats(gcp_mem_module_t module, gcp_mem_stats_t *stats);
+    const char *gcp_mem_module_name(gcp_mem_module_t module);
+
+    /* 
+     * Routes every cJSON allocation through the accounting layer under GCP_MEM_JSON. cJSON hooks are process wide,
+     * call it before any cJSON object is created, strings returned by cJSON_Print* must be released with cJSON_free afterwards.
+     */
+    void gcp_mem_track_cjson(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,7 +1,158 @@
 #ifndef __GCP_OTA_H__
 #define __GCP_OTA_H__
 
+#include "gcp_client.h"
+#include "esp_err.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/* TLS handshake and the download run on the OTA task, so it needs more stack than the app task */
+#ifndef GCP_OTA_TASK_STACK_SIZE
+#define GCP_OTA_TASK_STACK_SIZE 8192
+#endif
+#define GCP_OTA_TASK_PRIORITY 2
+
+#define GCP_OTA_DEFAULT_RX_BUFFER_SIZE 1024
+#define GCP_OTA_DEFAULT_READ_SIZE 1024
+#define GCP_OTA_DEFAULT_WRITE_BATCH_SIZE 4096 /* a flash sector */
+#define GCP_OTA_DEFAULT_TIMEOUT_MS 2000
+
+/* telemetry subfolder of the chunk requests and command subfolder of the chunks */
+#define GCP_OTA_MQTT_TOPIC "ota"
+/* base64 of a chunk and its JSON fit in the MQTT receive buffer */
+#define GCP_OTA_MQTT_CHUNK_SIZE (((GCP_CLIENT_RX_BUFFER_SIZE - 128) / 4) * 3)
+#define GCP_OTA_DEFAULT_MQTT_WINDOW 2
+
+#define GCP_OTA_HEALTH_DEFAULT_TIMEOUT_MS (5 * 60 * 1000)
+#define GCP_OTA_CHECK_CONNECTED (1 << 0)
+#define GCP_OTA_CHECK_CONFIG (1 << 1)
+#define GCP_OTA_CHECK_STATE (1 << 2)
+#define GCP_OTA_CHECK_ALL (GCP_OTA_CHECK_CONNECTED | GCP_OTA_CHECK_CONFIG | GCP_OTA_CHECK_STATE)
+
+typedef enum
+{
+    GCP_OTA_PHASE_IDLE = 0,
+    GCP_OTA_PHASE_CONNECTING,
+    GCP_OTA_PHASE_DOWNLOADING,
+    GCP_OTA_PHASE_VERIFYING,
+    GCP_OTA_PHASE_REBOOTING,
+    GCP_OTA_PHASE_FAILED,
+} gcp_ota_phase_t;
+
+typedef enum
+{
+    GCP_OTA_TRANSPORT_HTTP = 0, /* esp_http_client from url */
+    GCP_OTA_TRANSPORT_MQTT,     /* chunks as commands over the gcp_client connection */
+} gcp_ota_transport_t;
+
+typedef enum
+{
+    GCP_OTA_COMPRESSION_NONE = 0,
+    GCP_OTA_COMPRESSION_GZIP, /* gzip file, the trailer isn't checked, the image checksum is */
+    GCP_OTA_COMPRESSION_ZLIB, /* zlib stream with its adler32 checked */
+} gcp_ota_compression_t;
+
+typedef enum
+{
+    GCP_OTA_HEALTH_NONE = 0,    /* the running firmware doesn't need verifying */
+    GCP_OTA_HEALTH_PENDING,     /* booted from an update, rolls back unless every check passes in time */
+    GCP_OTA_HEALTH_VALID,       /* the update passed its checks */
+    GCP_OTA_HEALTH_ROLLED_BACK, /* the last update was rejected and this is the firmware it replaced */
+} gcp_ota_health_state_t;
+
+typedef struct
+{
+    gcp_ota_health_state_t state;
+    uint32_t missing;            /* GCP_OTA_CHECK_ bits not passed yet, or the ones that caused the rollback */
+    char rejected_version[32];   /* version of the firmware rolled back */
+} gcp_ota_health_t;
+
+typedef struct
+{
+    gcp_ota_phase_t phase;
+    uint32_t bytes_read;    /* image bytes written to the partition */
+    uint32_t download_size; /* 0 until the server reports it */
+    uint8_t percent;        /* of the download */
+    uint32_t bytes_per_sec; /* average since the download started */
+    uint32_t bytes_transferred; /* bytes received, more than bytes_read when a server ignored a Range request */
+    uint32_t retries;
+    uint32_t flash_ms; /* spent in esp_ota_write, erasing included */
+    uint32_t net_ms;   /* spent waiting for the server and the socket */
+    esp_err_t last_error;
+} gcp_ota_progress_t;
+
+typedef struct
+{
+    uint32_t image_size;
+    uint32_t download_size; /* smaller than image_size when the image was compressed */
+    uint32_t bytes_transferred;
+    uint32_t retries;
+    uint32_t duration_ms;
+    uint32_t bytes_per_sec;
+    uint32_t flash_ms;
+    uint32_t net_ms;
+    gcp_ota_compression_t compression;
+    bool delta; /* installed from a patch */
+} gcp_ota_result_t;
+
+/* zero values fall back to the GCP_OTA_DEFAULT_ ones */
+typedef struct
+{
+    uint32_t rx_buffer_size;   /* esp_http_client receive buffer */
+    uint32_t read_size;        /* bytes asked from each esp_http_client_read */
+    int32_t write_batch_size;  /* bytes gathered before an esp_ota_write, -1 writes every read as it comes */
+    uint32_t timeout_ms;       /* of a read or an MQTT chunk before the download is retried */
+    uint32_t mqtt_window;      /* chunks the server may send ahead of the last acknowledged one */
+} gcp_ota_transfer_config_t;
+
+typedef struct
+{
+    const char *url;      /* copied */
+    const char *cert_pem; /* not copied, it has to outlive the update. NULL uses the global CA store */
+    gcp_ota_compression_t compression;
+    const char *patch_url;          /* optional, copied. Falls back to url when it fails or doesn't apply */
+    const char *patch_base_version; /* the patch only applies on this running version */
+    const char *sha256;             /* optional, copied. 64 hex digits of the image, the boot partition isn't switched on a mismatch */
+    uint32_t size;                  /* optional, bytes of the image */
+    gcp_ota_transport_t transport;
+    gcp_client_handle_t mqtt_client; /* connection of the MQTT transport */
+    gcp_ota_transfer_config_t transfer;
+} gcp_ota_request_t;
+
 void gcp_ota_get_running_app_version(char *version);
-void gcp_ota_update_firmware(char *firmware_url, const char *cert_pem);
 
-#endif
\ No newline at end of file
+/* downloads and flashes the image on the calling task, reboots on success */
+esp_err_t gcp_ota_update_firmware(const gcp_ota_request_t *request);
+
+/* runs gcp_ota_update_firmware on its own task, ESP_ERR_INVALID_STATE while an update is already running */
+esp_err_t gcp_ota_start(const gcp_ota_request_t *request, const gcp_task_config_t *task_config);
+
+/* a command on the GCP_OTA_MQTT_TOPIC subfolder, {"offset":0,"total":1048576,"data":"base64"} */
+void gcp_ota_mqtt_chunk_received(const char *chunk);
+
+void gcp_ota_get_progress(gcp_ota_progress_t *progress);
+
+const char *gcp_ota_phase_name(gcp_ota_phase_t phase);
+
+const char *gcp_ota_compression_name(gcp_ota_compression_t compression);
+
+/* "gzip" or "zlib", anything else is an uncompressed image */
+gcp_ota_compression_t gcp_ota_compression_from_name(const char *name);
+
+/*
+ * Starts the post update health gate once per boot. A firmware pending verification stays so until connected, config and state
+ * checks pass, it is rolled back when they don't within timeout_ms. Needs CONFIG_BOOTLOADER_APP_ROLLBACK_ENABLE.
+ */
+void gcp_ota_health_begin(uint32_t timeout_ms);
+
+/* one of the GCP_OTA_CHECK_ bits, the firmware is marked valid when the last one passes */
+void gcp_ota_health_check_passed(uint32_t check);
+
+void gcp_ota_get_health(gcp_ota_health_t *health);
+
+const char *gcp_ota_health_name(gcp_ota_health_state_t state);
+
+/* cost of the update that installed the running firmware, ESP_ERR_NOT_FOUND after a power cycle or a serial flash */
+esp_err_t gcp_ota_get_last_update(gcp_ota_result_t *result);
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef GCP_OTA_INTERNAL__H
+#define GCP_OTA_INTERNAL__H
+
+#include "gcp_ota.h"
+#include "esp_ota_ops.h"
+#include "esp_app_format.h"
+#include "mbedtls/sha256.h"
+#include <stdbool.h>
+
+/* image header, first segment header and esp_app_desc_t, enough to know what is being installed */
+#define GCP_OTA_IMAGE_HEADER_SIZE (sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t))
+
+typedef struct gcp_ota_session_t gcp_ota_session_t;
+
+/* consumes downloaded bytes, the plain sink writes them to the partition and decoders write what they produce */
+typedef esp_err_t (*gcp_ota_sink_t)(gcp_ota_session_t *session, const char *data, size_t size);
+
+struct gcp_ota_session_t
+{
+    const gcp_ota_request_t *request;
+    const char *url; /* image or patch being downloaded */
+    bool patch;
+    esp_ota_handle_t ota_handle;
+    gcp_ota_sink_t sink;
+    void *decoder;        /* state of the decompressor or patcher, kept across retries so a range resumes mid stream */
+    bool decoder_done;    /* the decoder saw the end of its stream */
+    gcp_ota_transfer_config_t transfer; /* with the defaults filled in */
+    char *buffer;       /* read_size bytes for esp_http_client_read */
+    char *write_buffer; /* write_batch_size bytes, NULL when writes aren't batched */
+    uint32_t write_buffered;
+    uint32_t offset;      /* bytes of the download consumed, where the next range starts */
+    uint32_t download_size;
+    uint32_t written;     /* image bytes in the partition */
+    uint32_t transferred; /* bytes received over HTTP including skipped ones and a failed patch */
+    uint32_t retries;
+    int64_t range_start; /* first byte of a 206 response from its Content-Range, -1 without one */
+    bool restart; /* the server sent another range than asked for, the download starts over from byte 0 */
+    bool fatal; /* flash errors and invalid images are not retried */
+    bool check_sha256;
+    uint8_t expected_sha256[32];
+    mbedtls_sha256_context sha256; /* of the image as it is written, verified before esp_ota_end */
+    uint8_t header[GCP_OTA_IMAGE_HEADER_SIZE];
+    char version[32];
+    int64_t start_us;
+    int64_t flash_us;
+    int64_t net_us;
+};
+
+void gcp_ota_set_phase(gcp_ota_phase_t phase, esp_err_t err);
+void gcp_ota_update_progress(gcp_ota_session_t *session);
+
+esp_err_t gcp_ota_write_image(gcp_ota_session_t *session, const char *data, size_t size);
+
+esp_err_t gcp_ota_inflate_begin(gcp_ota_session_t *session);
+esp_err_t gcp_ota_inflate_write(gcp_ota_session_t *session, const char *data, size_t size);
+
+esp_err_t gcp_ota_delta_begin(gcp_ota_session_t *session);
+esp_err_t gcp_ota_delta_write(gcp_ota_session_t *session, const char *data, size_t size);
+
+/* one attempt of the MQTT transport, resumes from session->offset like download_range */
+esp_err_t gcp_ota_mqtt_download(gcp_ota_session_t *session);
+
+#endif
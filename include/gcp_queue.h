@@ -0,0 +1,36 @@
+#ifndef GCP_QUEUE__H
+#define GCP_QUEUE__H
+
+#include <stddef.h>
+#include "stdint.h"
+#include "stdbool.h"
+#include "gcp_mem.h"
+
+/* 
+ * Bounded single producer single consumer queue of fixed size slots. Slots are filled in place,
+ * producer acquires and commits, consumer peeks and releases. No locks, only ordered index updates.
+ */
+typedef struct
+{
+    uint8_t *slots;
+    size_t slot_size;
+    uint32_t slot_count; /* power of two */
+    uint32_t head;       /* written by the producer only */
+    uint32_t tail;       /* written by the consumer only */
+    uint32_t high_water;
+} gcp_queue_t;
+
+bool gcp_queue_init(gcp_queue_t *queue, gcp_mem_module_t module, uint32_t slot_count, size_t slot_size);
+void gcp_queue_deinit(gcp_queue_t *queue);
+
+/* returns NULL when the queue is full */
+void *gcp_queue_acquire(gcp_queue_t *queue);
+void gcp_queue_commit(gcp_queue_t *queue);
+
+/* returns NULL when the queue is empty */
+void *gcp_queue_peek(gcp_queue_t *queue);
+void gcp_queue_release(gcp_queue_t *queue);
+
+uint32_t gcp_queue_depth(gcp_queue_t *queue);
+
+#endif
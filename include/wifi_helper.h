@@ -2,14 +2,88 @@
 #define WIFI_HELPER__H
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_netif.h"
+
+#define WIFI_HELPER_MAX_APS 4
+#define WIFI_BACKOFF_DEFAULT_INITIAL_DELAY_MS 500
+#define WIFI_BACKOFF_DEFAULT_MAX_DELAY_MS 30000
+#define WIFI_BACKOFF_DEFAULT_ATTEMPTS_PER_AP 2
 
 typedef struct{
-    char ssid[20];
-    char passphrase[20];
+    char ssid[33];
+    char passphrase[65];
 } wifi_credentials_t;
 
+/* reconnect window grows exponentially from initial_delay_ms up to max_delay_ms, the delay is picked randomly inside it. Zero values keep the defaults */
+typedef struct{
+    uint32_t initial_delay_ms;
+    uint32_t max_delay_ms;
+    uint32_t attempts_per_ap; /* failed attempts before moving to the next AP of the list */
+} wifi_backoff_config_t;
+
+typedef struct{
+    const char *ssid;         /* AP in use */
+    uint32_t disconnects;
+    uint32_t reconnects;      /* connections after a lost one */
+    uint32_t ap_switches;
+    uint32_t failed_attempts; /* since the last connection */
+    uint32_t next_retry_ms;   /* 0 while connected */
+    uint32_t last_offline_ms;
+    uint8_t last_reason;      /* wifi_err_reason_t of the last disconnect */
+    uint32_t ca_store_ms;     /* loading the global CA store, 0 until one is set */
+    uint32_t ca_store_heap;   /* heap the global CA store took */
+} wifi_helper_stats_t;
+
+typedef enum{
+    WIFI_TIME_SOURCE_SNTP = 0, /* time1.google.com and pool.ntp.org */
+    WIFI_TIME_SOURCE_DHCP,     /* NTP servers of the DHCP lease, needs CONFIG_LWIP_DHCP_GET_NTP_SRV */
+    WIFI_TIME_SOURCE_RTC,      /* a valid RTC time is used right away, SNTP corrects it in the background */
+} wifi_time_source_t;
+
+typedef enum{
+    WIFI_IP_DHCP = 0,
+    WIFI_IP_STATIC,       /* ip_info and dns of wifi_ip_config_t */
+    WIFI_IP_CACHED_LEASE, /* the last DHCP lease while the cached AP answers, DHCP otherwise */
+} wifi_ip_mode_t;
+
+typedef struct{
+    wifi_ip_mode_t mode;
+    esp_netif_ip_info_t ip_info;
+    esp_ip4_addr_t dns;
+} wifi_ip_config_t;
+
+/* of the last connection */
+typedef struct{
+    uint32_t connect_ms;  /* from the start or the disconnect to the association */
+    uint32_t ip_ms;       /* from the association to the address */
+    bool directed;        /* associated with the cached BSSID and channel, without a scan */
+    bool static_ip;       /* DHCP was skipped */
+    uint32_t connections; /* since boot */
+} wifi_helper_timings_t;
+
+typedef struct{
+    const unsigned char *der;
+    size_t size;
+} wifi_helper_der_cert_t;
+
+/* before wifi_helper_start */
+void wifi_helper_set_time_source(wifi_time_source_t source);
+void wifi_helper_set_ip_config(const wifi_ip_config_t *config);
+void wifi_helper_set_backoff(const wifi_backoff_config_t *config);
+/* the BSSID, channel and lease of the last connection are cached and tried first, a failed directed connect falls back to a scan */
 void wifi_helper_start(wifi_credentials_t *wifi_credentials);
+/*
+ * Up to WIFI_HELPER_MAX_APS credentials, the AP of the last connection is tried first. After attempts_per_ap failures the next
+ * one is picked by fewest consecutive failures, then strongest RSSI at its last connection, then most connections.
+ */
+void wifi_helper_start_list(const wifi_credentials_t *credentials, size_t count);
+void wifi_helper_get_timings(wifi_helper_timings_t *timings);
+void wifi_helper_get_stats(wifi_helper_stats_t *stats);
 void wifi_helper_set_global_ca_store(const unsigned char *pem_key, size_t pem_key_size);
+void wifi_helper_set_global_ca_store_der(const wifi_helper_der_cert_t *certs, size_t cert_count);
+/* returns once there is an IP and the time was set, esp_restart when SNTP doesn't sync within 100 s */
 void wifi_wait_connection();
 
 #endif
\ No newline at end of file
@@ -1,24 +1,267 @@
 #include "device_data.h"
+#include <freertos/FreeRTOS.h>
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 #include "nvs_flash.h"
 #include "nvs.h"
 #include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_ota_ops.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include "gcp_mem.h"
 
 #define TAG "DEVICE_DATA"
 
 #define DEVICE_DATA_NVS_NAMESPACE "data_h"
+#define DEVICE_DATA_FIRMWARE_KEY "_gcp_fw" /* app_elf_sha256 of the firmware the schemas were migrated for */
+#define DEVICE_DATA_TYPED_MAGIC 0x4456
+#define DEVICE_DATA_TYPED_VERSION 1 /* of integers and strings */
+#define DEVICE_DATA_FLUSH_TASK_STACK_SIZE 3072
+#define DEVICE_DATA_FLUSH_TASK_PRIORITY 1
 
-void *gcp_nvs_get_data(char *name, void *default_data, size_t size)
+typedef enum
+{
+    DEVICE_DATA_TYPE_I32 = 1,
+    DEVICE_DATA_TYPE_STR,
+    DEVICE_DATA_TYPE_BLOB,
+} device_data_type_t;
+
+/* prefix of typed values, blobs without it come from gcp_nvs_set_data */
+typedef struct __attribute__((packed))
+{
+    uint16_t magic;
+    uint8_t type;
+    uint8_t version;
+    uint32_t check; /* FNV-1a of the header and the value, a plain blob that happens to start with the magic doesn't match it */
+} device_data_header_t;
+
+typedef struct
+{
+    bool used;
+    bool dirty;  /* differs from flash */
+    bool erased; /* deleted, erased from flash with the next flush */
+    char name[NVS_KEY_NAME_MAX_SIZE];
+    void *data;
+    size_t size;
+} gcp_nvs_entry_t;
+
+/*
+ * Write-back cache in front of a namespace that stays open. Sets only touch RAM, the dirty keys are written
+ * with one commit when the flush timer fires, on gcp_nvs_flush or from the shutdown handler before esp_restart.
+ * The timer only wakes the flush task, flash writes would stall every other esp_timer callback.
+ */
+static gcp_nvs_entry_t cache[GCP_NVS_CACHE_KEYS];
+static nvs_handle_t nvs;
+static bool nvs_opened;
+static uint32_t flush_delay_ms = GCP_NVS_DEFAULT_FLUSH_DELAY_MS;
+static gcp_nvs_stats_t nvs_stats;
+static esp_timer_handle_t flush_timer;
+static TaskHandle_t flush_task;
+static StaticTask_t flush_task_buffer;
+static StackType_t flush_task_stack[DEVICE_DATA_FLUSH_TASK_STACK_SIZE];
+static SemaphoreHandle_t cache_lock;
+static StaticSemaphore_t cache_lock_buffer;
+static portMUX_TYPE init_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void lock(void)
+{
+    portENTER_CRITICAL(&init_lock);
+    if (cache_lock == NULL)
+    {
+        cache_lock = xSemaphoreCreateMutexStatic(&cache_lock_buffer);
+    }
+    portEXIT_CRITICAL(&init_lock);
+    xSemaphoreTake(cache_lock, portMAX_DELAY);
+}
+
+static void unlock(void)
+{
+    xSemaphoreGive(cache_lock);
+}
+
+static void flush_task_main(void *arg)
+{
+    while (true)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        gcp_nvs_flush();
+    }
+}
+
+static void flush_timer_callback(void *arg)
 {
-    // Open
-    nvs_handle_t nvs;
-    esp_err_t err = nvs_open(DEVICE_DATA_NVS_NAMESPACE, NVS_READONLY, &nvs);
+    xTaskNotifyGive(flush_task);
+}
+
+static void shutdown_handler(void)
+{
+    gcp_nvs_flush();
+}
+
+static esp_err_t open_nvs(void)
+{
+    if (nvs_opened)
+    {
+        return ESP_OK;
+    }
+    esp_err_t err = nvs_open(DEVICE_DATA_NVS_NAMESPACE, NVS_READWRITE, &nvs);
     if (err != ESP_OK)
     {
-        goto end;
+        return err;
     }
-    err = nvs_get_blob(nvs, name, default_data, &size);
-end:
-    nvs_close(nvs);
+    nvs_opened = true;
+    esp_register_shutdown_handler(&shutdown_handler);
+    flush_task = xTaskCreateStatic(&flush_task_main, "gcp_nvs_flush", DEVICE_DATA_FLUSH_TASK_STACK_SIZE, NULL, DEVICE_DATA_FLUSH_TASK_PRIORITY, flush_task_stack, &flush_task_buffer);
+    if (flush_task == NULL)
+    {
+        ESP_LOGE(TAG, "[open_nvs] flush task failed, writing through");
+        flush_delay_ms = 0;
+        return ESP_OK;
+    }
+    esp_timer_create_args_t timer_args = {
+        .callback = &flush_timer_callback,
+        .name = "gcp_nvs_flush"};
+    if (esp_timer_create(&timer_args, &flush_timer) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "[open_nvs] flush timer failed, writing through");
+        flush_delay_ms = 0;
+    }
+    return ESP_OK;
+}
+
+static gcp_nvs_entry_t *find_entry(const char *name)
+{
+    for (int i = 0; i < GCP_NVS_CACHE_KEYS; i++)
+    {
+        if (cache[i].used && strcmp(cache[i].name, name) == 0)
+        {
+            return &cache[i];
+        }
+    }
+    return NULL;
+}
+
+static void drop_entry(gcp_nvs_entry_t *entry)
+{
+    if (entry != NULL)
+    {
+        gcp_mem_free(entry->data);
+        memset(entry, 0, sizeof(gcp_nvs_entry_t));
+    }
+}
+
+/* a free slot, or one holding a key that is already in flash */
+static gcp_nvs_entry_t *new_entry(const char *name)
+{
+    gcp_nvs_entry_t *entry = NULL;
+    for (int i = 0; i < GCP_NVS_CACHE_KEYS && entry == NULL; i++)
+    {
+        if (!cache[i].used)
+        {
+            entry = &cache[i];
+        }
+    }
+    for (int i = 0; i < GCP_NVS_CACHE_KEYS && entry == NULL; i++)
+    {
+        if (!cache[i].dirty)
+        {
+            entry = &cache[i];
+        }
+    }
+    if (entry == NULL || strlen(name) >= sizeof(entry->name))
+    {
+        return NULL;
+    }
+    drop_entry(entry);
+    entry->used = true;
+    strcpy(entry->name, name);
+    return entry;
+}
+
+static esp_err_t cache_store(const char *name, const void *data, size_t size, bool dirty)
+{
+    gcp_nvs_entry_t *entry = find_entry(name);
+    if (size > GCP_NVS_CACHE_MAX_DATA_SIZE)
+    {
+        drop_entry(entry);
+        return ESP_ERR_NO_MEM;
+    }
+    if (entry != NULL && !entry->erased && entry->size == size && memcmp(entry->data, data, size) == 0)
+    {
+        /* unchanged values don't cost a write */
+        return ESP_OK;
+    }
+    if (!dirty && entry != NULL && entry->dirty)
+    {
+        /* what was read from flash is older than the pending set */
+        return ESP_OK;
+    }
+    if (entry == NULL && (entry = new_entry(name)) == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    if (entry->data == NULL || entry->size != size)
+    {
+        gcp_mem_free(entry->data);
+        entry->data = gcp_mem_malloc(GCP_MEM_NVS, size);
+        if (entry->data == NULL)
+        {
+            drop_entry(entry);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    memcpy(entry->data, data, size);
+    entry->size = size;
+    entry->erased = false;
+    entry->dirty = entry->dirty || dirty;
+    return ESP_OK;
+}
+
+static void schedule_flush(void)
+{
+    /* armed by the first dirty key, later sets ride along */
+    esp_timer_start_once(flush_timer, (uint64_t)flush_delay_ms * 1000);
+}
+
+void *gcp_nvs_get_data(char *name, void *default_data, size_t size)
+{
+    lock();
+    esp_err_t err = ESP_OK;
+    gcp_nvs_entry_t *entry = find_entry(name);
+    if (entry != NULL && entry->erased)
+    {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    }
+    else if (entry != NULL && entry->size == size)
+    {
+        memcpy(default_data, entry->data, size);
+        nvs_stats.cache_hits++;
+        unlock();
+        return default_data;
+    }
+    else if (entry != NULL && entry->dirty)
+    {
+        /* flash still has the value the pending set replaces, neither it nor the default may overwrite the set */
+        unlock();
+        ESP_LOGW(TAG, "[get_data] %s is %d bytes, not %d, keeping the default", name, entry->size, size);
+        return default_data;
+    }
+    else
+    {
+        err = open_nvs();
+        if (err == ESP_OK)
+        {
+            err = nvs_get_blob(nvs, name, default_data, &size);
+        }
+        if (err == ESP_OK)
+        {
+            cache_store(name, default_data, size, false);
+        }
+    }
+    unlock();
     if (err != ESP_OK)
     {
         ESP_LOGI(TAG, "[get_data] Problem reading data from nvs: %s", esp_err_to_name(err));
@@ -28,50 +271,369 @@ end:
     return default_data;
 }
 
-esp_err_t gcp_nvs_set_data(char *name, void *data, size_t size)
+static esp_err_t store_raw(const char *name, const void *data, size_t size)
 {
-    // Open
-    nvs_handle_t nvs;
-    esp_err_t err = nvs_open(DEVICE_DATA_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    lock();
+    nvs_stats.sets++;
+    esp_err_t err = open_nvs();
     if (err != ESP_OK)
     {
-        goto err;
+        goto end;
+    }
+    if (flush_delay_ms > 0 && cache_store(name, data, size, true) == ESP_OK)
+    {
+        schedule_flush();
+        goto end;
     }
+    /* write through, the cached copy would be stale */
+    drop_entry(find_entry(name));
     err = nvs_set_blob(nvs, name, data, size);
     if (err != ESP_OK)
     {
-        goto err;
+        goto end;
     }
+    nvs_stats.writes++;
+    nvs_stats.commits++;
     err = nvs_commit(nvs);
-err:
-    nvs_close(nvs);
+end:
+    unlock();
     if (err != ESP_OK)
     {
-        ESP_LOGI(TAG, "[get_data] Error writing data: %s", esp_err_to_name(err));
+        ESP_LOGI(TAG, "[set_data] Error writing data: %s", esp_err_to_name(err));
     }
     return err;
 }
 
+esp_err_t gcp_nvs_set_data(char *name, void *data, size_t size)
+{
+    return store_raw(name, data, size);
+}
+
 esp_err_t gcp_nvs_delete_data(char *name, size_t size)
 {
-    // Open
-    nvs_handle_t nvs;
-    esp_err_t err = nvs_open(DEVICE_DATA_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    lock();
+    nvs_stats.sets++;
+    esp_err_t err = open_nvs();
     if (err != ESP_OK)
     {
-        goto err;
+        goto end;
+    }
+    gcp_nvs_entry_t *entry = find_entry(name);
+    if (flush_delay_ms > 0 && (entry != NULL || (entry = new_entry(name)) != NULL))
+    {
+        gcp_mem_free(entry->data);
+        entry->data = NULL;
+        entry->size = 0;
+        entry->erased = true;
+        entry->dirty = true;
+        schedule_flush();
+        goto end;
     }
+    drop_entry(entry);
     err = nvs_erase_key(nvs, name);
     if (err != ESP_OK)
     {
-        goto err;
+        goto end;
     }
+    nvs_stats.writes++;
+    nvs_stats.commits++;
     err = nvs_commit(nvs);
-err:
-    nvs_close(nvs);
+end:
+    unlock();
+    if (err != ESP_OK)
+    {
+        ESP_LOGI(TAG, "[delete_data] Error erasing data: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+esp_err_t gcp_nvs_flush(void)
+{
+    lock();
+    esp_err_t err = ESP_OK;
+    uint32_t written = 0;
+    if (flush_timer != NULL)
+    {
+        /* the next set arms it again with the current delay */
+        esp_timer_stop(flush_timer);
+    }
+    for (int i = 0; i < GCP_NVS_CACHE_KEYS; i++)
+    {
+        gcp_nvs_entry_t *entry = &cache[i];
+        if (!entry->used || !entry->dirty)
+        {
+            continue;
+        }
+        esp_err_t entry_err = entry->erased ? nvs_erase_key(nvs, entry->name) : nvs_set_blob(nvs, entry->name, entry->data, entry->size);
+        if (entry_err != ESP_OK && !(entry->erased && entry_err == ESP_ERR_NVS_NOT_FOUND))
+        {
+            /* stays dirty for the next flush */
+            ESP_LOGE(TAG, "[gcp_nvs_flush] %s: %s", entry->name, esp_err_to_name(entry_err));
+            err = entry_err;
+            continue;
+        }
+        written++;
+        if (entry->erased)
+        {
+            drop_entry(entry);
+        }
+        else
+        {
+            entry->dirty = false;
+        }
+    }
+    if (written > 0)
+    {
+        nvs_stats.writes += written;
+        nvs_stats.commits++;
+        esp_err_t commit_err = nvs_commit(nvs);
+        err = err == ESP_OK ? commit_err : err;
+        ESP_LOGD(TAG, "[gcp_nvs_flush] %u keys committed", written);
+    }
+    unlock();
+    return err;
+}
+
+void gcp_nvs_set_flush_delay(uint32_t delay_ms)
+{
+    lock();
+    flush_delay_ms = delay_ms;
+    unlock();
+    if (delay_ms == 0)
+    {
+        gcp_nvs_flush();
+    }
+}
+
+void gcp_nvs_get_stats(gcp_nvs_stats_t *stats)
+{
+    lock();
+    *stats = nvs_stats;
+    stats->dirty_keys = 0;
+    for (int i = 0; i < GCP_NVS_CACHE_KEYS; i++)
+    {
+        stats->dirty_keys += cache[i].used && cache[i].dirty;
+    }
+    unlock();
+}
+
+/* a copy of the stored bytes whatever their size, from the cache when it has the key */
+static esp_err_t load_raw(const char *name, uint8_t **data, size_t *size)
+{
+    lock();
+    esp_err_t err = ESP_OK;
+    gcp_nvs_entry_t *entry = find_entry(name);
+    if (entry != NULL)
+    {
+        err = entry->erased ? ESP_ERR_NVS_NOT_FOUND : ESP_OK;
+        *size = entry->size;
+        nvs_stats.cache_hits += err == ESP_OK;
+    }
+    else
+    {
+        err = open_nvs();
+        if (err == ESP_OK)
+        {
+            err = nvs_get_blob(nvs, name, NULL, size);
+        }
+    }
+    *data = err == ESP_OK ? gcp_mem_malloc(GCP_MEM_NVS, *size > 0 ? *size : 1) : NULL;
+    if (err == ESP_OK && *data == NULL)
+    {
+        err = ESP_ERR_NO_MEM;
+    }
+    if (err == ESP_OK && entry != NULL)
+    {
+        memcpy(*data, entry->data, *size);
+    }
+    else if (err == ESP_OK)
+    {
+        err = nvs_get_blob(nvs, name, *data, size);
+        if (err == ESP_OK)
+        {
+            cache_store(name, *data, *size, false);
+        }
+    }
+    unlock();
     if (err != ESP_OK)
     {
-        ESP_LOGI(TAG, "[get_data] Error erasing data: %s", esp_err_to_name(err));
+        gcp_mem_free(*data);
+        *data = NULL;
     }
     return err;
-}
\ No newline at end of file
+}
+
+static uint32_t header_check(const device_data_header_t *header, const uint8_t *value, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    const uint8_t *fields = (const uint8_t *)header;
+    for (size_t i = 0; i < offsetof(device_data_header_t, check); i++)
+    {
+        hash = (hash ^ fields[i]) * 16777619u;
+    }
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ value[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/* false for blobs of gcp_nvs_set_data, whatever their first bytes are */
+static bool read_header(const uint8_t *stored, size_t stored_size, device_data_header_t *header)
+{
+    if (stored_size < sizeof(device_data_header_t))
+    {
+        return false;
+    }
+    memcpy(header, stored, sizeof(device_data_header_t));
+    return header->magic == DEVICE_DATA_TYPED_MAGIC && header->check == header_check(header, stored + sizeof(device_data_header_t), stored_size - sizeof(device_data_header_t));
+}
+
+/* exact is false for strings, they are shorter than the buffer */
+static esp_err_t get_typed(const char *name, device_data_type_t type, uint8_t version, void *value, size_t size, bool exact)
+{
+    uint8_t *stored;
+    size_t stored_size;
+    esp_err_t err = load_raw(name, &stored, &stored_size);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    device_data_header_t header;
+    size_t value_size = stored_size - sizeof(header);
+    if (!read_header(stored, stored_size, &header) || header.type != type)
+    {
+        err = ESP_ERR_NVS_TYPE_MISMATCH;
+    }
+    else if (header.version != version)
+    {
+        err = ESP_ERR_INVALID_VERSION;
+    }
+    else if (exact ? value_size != size : value_size > size)
+    {
+        err = ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    else
+    {
+        memcpy(value, stored + sizeof(header), value_size);
+    }
+    gcp_mem_free(stored);
+    if (err != ESP_OK)
+    {
+        ESP_LOGD(TAG, "[get_typed] %s: %s", name, esp_err_to_name(err));
+    }
+    return err;
+}
+
+static esp_err_t set_typed(const char *name, device_data_type_t type, uint8_t version, const void *value, size_t size)
+{
+    uint8_t *stored = gcp_mem_malloc(GCP_MEM_NVS, sizeof(device_data_header_t) + size);
+    if (stored == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    device_data_header_t header = {
+        .magic = DEVICE_DATA_TYPED_MAGIC,
+        .type = type,
+        .version = version};
+    header.check = header_check(&header, value, size);
+    memcpy(stored, &header, sizeof(header));
+    memcpy(stored + sizeof(header), value, size);
+    esp_err_t err = store_raw(name, stored, sizeof(header) + size);
+    gcp_mem_free(stored);
+    return err;
+}
+
+esp_err_t gcp_nvs_get_i32(const char *name, int32_t *value)
+{
+    return get_typed(name, DEVICE_DATA_TYPE_I32, DEVICE_DATA_TYPED_VERSION, value, sizeof(*value), true);
+}
+
+esp_err_t gcp_nvs_set_i32(const char *name, int32_t value)
+{
+    return set_typed(name, DEVICE_DATA_TYPE_I32, DEVICE_DATA_TYPED_VERSION, &value, sizeof(value));
+}
+
+esp_err_t gcp_nvs_get_str(const char *name, char *value, size_t size)
+{
+    return get_typed(name, DEVICE_DATA_TYPE_STR, DEVICE_DATA_TYPED_VERSION, value, size, false);
+}
+
+esp_err_t gcp_nvs_set_str(const char *name, const char *value)
+{
+    return set_typed(name, DEVICE_DATA_TYPE_STR, DEVICE_DATA_TYPED_VERSION, value, strlen(value) + 1);
+}
+
+esp_err_t gcp_nvs_get_blob(const char *name, uint8_t version, void *data, size_t size)
+{
+    return get_typed(name, DEVICE_DATA_TYPE_BLOB, version, data, size, true);
+}
+
+esp_err_t gcp_nvs_set_blob(const char *name, uint8_t version, const void *data, size_t size)
+{
+    return set_typed(name, DEVICE_DATA_TYPE_BLOB, version, data, size);
+}
+
+static void migrate_key(const gcp_nvs_schema_t *schema)
+{
+    uint8_t *stored;
+    size_t stored_size;
+    if (load_raw(schema->name, &stored, &stored_size) != ESP_OK)
+    {
+        return;
+    }
+    device_data_header_t header;
+    uint8_t from_version = 0;
+    const uint8_t *old_data = stored;
+    size_t old_size = stored_size;
+    if (read_header(stored, stored_size, &header) && header.type == DEVICE_DATA_TYPE_BLOB)
+    {
+        from_version = header.version;
+        old_data += sizeof(header);
+        old_size -= sizeof(header);
+    }
+    if (from_version == schema->version && old_size == schema->size)
+    {
+        goto end;
+    }
+    void *new_data = gcp_mem_calloc(GCP_MEM_NVS, 1, schema->size);
+    if (new_data != NULL && schema->migrate != NULL && schema->migrate(from_version, old_data, old_size, new_data, schema->size) == ESP_OK)
+    {
+        ESP_LOGI(TAG, "[migrate_key] %s migrated from version %d to %d", schema->name, from_version, schema->version);
+        gcp_nvs_set_blob(schema->name, schema->version, new_data, schema->size);
+    }
+    else
+    {
+        ESP_LOGW(TAG, "[migrate_key] %s version %d can't be migrated to %d, erased", schema->name, from_version, schema->version);
+        gcp_nvs_delete_data((char *)schema->name, 0);
+    }
+    gcp_mem_free(new_data);
+end:
+    gcp_mem_free(stored);
+}
+
+esp_err_t gcp_nvs_init(const gcp_nvs_schema_t *schemas, size_t count)
+{
+    const esp_app_desc_t *app_desc = esp_ota_get_app_description();
+    uint8_t migrated_for[sizeof(app_desc->app_elf_sha256)];
+    size_t size = sizeof(migrated_for);
+    lock();
+    esp_err_t err = open_nvs();
+    if (err == ESP_OK)
+    {
+        err = nvs_get_blob(nvs, DEVICE_DATA_FIRMWARE_KEY, migrated_for, &size);
+    }
+    unlock();
+    if (err == ESP_OK && size == sizeof(migrated_for) && memcmp(migrated_for, app_desc->app_elf_sha256, size) == 0)
+    {
+        ESP_LOGD(TAG, "[gcp_nvs_init] schemas are up to date");
+        return ESP_OK;
+    }
+    ESP_LOGI(TAG, "[gcp_nvs_init] new firmware, checking %d schemas", count);
+    for (size_t i = 0; i < count; i++)
+    {
+        migrate_key(&schemas[i]);
+    }
+    store_raw(DEVICE_DATA_FIRMWARE_KEY, app_desc->app_elf_sha256, sizeof(app_desc->app_elf_sha256));
+    return gcp_nvs_flush();
+}
@@ -1,127 +1,161 @@
 #include "gcp_app.h"
 #include "gcp_app_internal.h"
 #include <freertos/FreeRTOS.h>
-#include <freertos/timers.h>
+#include <freertos/task.h>
 #include "freertos/event_groups.h"
 #include "esp_log.h"
 #include "esp_wifi.h"
+#include "esp_timer.h"
+#include "esp_system.h"
 #include <string.h>
+#include <time.h>
 
 #include "gcp_ota.h"
+#include "gcp_mem.h"
+#include "device_data.h"
+#include "wifi_helper.h"
 
 #define TAG "GCP_APP"
 
 #define TOPIC_TELEMETRY_ROOT_FORMAT "/devices/%s/events/%s"
 #define TOPIC_DEFAULT_PULSE "pulse"
 #define TOPIC_DEFAULT_LOG "logs"
+#define PULSE_PAYLOAD "pulse"
+#define GCP_APP_TASK_END_WARN_MS 1000
 
 #define JSON_KEY_DEVICE_CONFIG "device_config"
 #define JSON_KEY_DEVICE_CONFIG_TIMEZONE "tz"
 #define JSON_KEY_DEVICE_CONFIG_STATE_PERIOD "state_period_ms"
 #define JSON_KEY_DEVICE_CONFIG_PULSE_PERIOD "pulse_period_ms"
+#define JSON_KEY_DEVICE_CONFIG_JOBS "jobs"
 #define JSON_KEY_DEVICE_FIRMWARE "firmware"
 #define JSON_KEY_DEVICE_FIRMWARE_VERSION "version"
 #define JSON_KEY_DEVICE_FIRMWARE_URL "url"
+#define JSON_KEY_DEVICE_FIRMWARE_COMPRESSION "compression"
+#define JSON_KEY_DEVICE_FIRMWARE_PATCH "patch"
+#define JSON_KEY_DEVICE_FIRMWARE_SHA256 "sha256"
+#define JSON_KEY_DEVICE_FIRMWARE_SIZE "size"
+#define JSON_KEY_DEVICE_FIRMWARE_TRANSPORT "transport"
+#define JSON_KEY_DEVICE_FIRMWARE_TRANSPORT_MQTT "mqtt"
+#define TOPIC_COMMAND_OTA "/commands/" GCP_OTA_MQTT_TOPIC
+#define JSON_KEY_DEVICE_FIRMWARE_PATCH_BASE_VERSION "base_version"
 #define JSON_KEY_APP_CONFIG "app_config"
 #define JSON_KEY_DEVICE_STATE "device_state"
 #define JSON_KEY_APP_STATE "app_state"
 #define JSON_KEY_FIRMWARE "firmware"
 #define JSON_KEY_RSSI "rssi"
+#define JSON_KEY_LINK "link"
+#define JSON_KEY_LINK_CHANNEL "channel"
+#define JSON_KEY_LINK_PHY "phy"
+#define JSON_KEY_LINK_RTT_MS "rtt_ms"
 #define JSON_KEY_RESET_REASON "reset_reason"
-
-#define TIMER_WAIT (500 / portTICK_PERIOD_MS)
-
-static void timer_callback(TimerHandle_t timer)
+#define JSON_KEY_MQTT "mqtt"
+#define JSON_KEY_MQTT_RECONNECTS "reconnects"
+#define JSON_KEY_MQTT_CONNECT_MS "connect_ms"
+#define JSON_KEY_MQTT_OFFLINE_MS "offline_ms"
+#define JSON_KEY_MQTT_JWT_MS "jwt_ms"
+#define JSON_KEY_MQTT_ENDPOINT "endpoint"
+
+#define JSON_KEY_OTA "ota"
+#define JSON_KEY_OTA_PHASE "phase"
+#define JSON_KEY_OTA_BYTES "bytes"
+#define JSON_KEY_OTA_PERCENT "percent"
+#define JSON_KEY_OTA_BPS "bps"
+#define JSON_KEY_OTA_ERROR "error"
+#define JSON_KEY_OTA_TRANSFERRED "transferred"
+#define JSON_KEY_OTA_RETRIES "retries"
+#define JSON_KEY_OTA_LAST "last"
+#define JSON_KEY_OTA_SIZE "size"
+#define JSON_KEY_OTA_DOWNLOAD "download"
+#define JSON_KEY_OTA_MS "ms"
+#define JSON_KEY_OTA_FLASH_MS "flash_ms"
+#define JSON_KEY_OTA_NET_MS "net_ms"
+#define JSON_KEY_OTA_HEALTH "health"
+#define JSON_KEY_OTA_REJECTED "rejected"
+#define JSON_KEY_OTA_MISSING "missing"
+
+#define JSON_KEY_WIFI "wifi"
+#define JSON_KEY_WIFI_CONNECT_MS "connect_ms"
+#define JSON_KEY_WIFI_IP_MS "ip_ms"
+#define JSON_KEY_WIFI_DIRECTED "directed"
+#define JSON_KEY_WIFI_STATIC_IP "static_ip"
+#define JSON_KEY_WIFI_SSID "ssid"
+#define JSON_KEY_WIFI_DISCONNECTS "disconnects"
+#define JSON_KEY_WIFI_RECONNECTS "reconnects"
+#define JSON_KEY_WIFI_AP_SWITCHES "ap_switches"
+#define JSON_KEY_WIFI_REASON "reason"
+#define JSON_KEY_WIFI_OFFLINE_MS "offline_ms"
+#define JSON_KEY_WIFI_CA_STORE_MS "ca_store_ms"
+#define JSON_KEY_WIFI_CA_STORE_HEAP "ca_store_heap"
+
+#define JSON_KEY_HEAP "heap"
+#define JSON_KEY_PIPELINE "pipeline"
+#define JSON_KEY_PIPELINE_DROPPED "dropped"
+#define JSON_KEY_PIPELINE_FAILED "failed"
+#define JSON_KEY_PIPELINE_MAX_DEPTH "max_depth"
+#define JSON_KEY_STACK "stack_free"
+#define JSON_KEY_STACK_APP "app"
+#define JSON_KEY_STACK_MQTT "mqtt"
+
+#define JSON_KEY_RADIO_WAKES "radio_wakes"
+#define JSON_KEY_NVS_COMMITS "nvs_commits"
+#define JSON_KEY_TX_ALIGNED "aligned"
+
+#define STATE_BUFFER_INITIAL_SIZE 512
+#define STATE_BUFFER_MAX_SIZE 8192
+
+#define JOB_NAME_STATE "state"
+#define JOB_NAME_PULSE "pulse"
+
+static void wake_app_task(gcp_app_handle_t app)
 {
-    ESP_LOGD(TAG, "[timer_callback] %s", pcTimerGetTimerName(timer));
-    configASSERT(timer);
-    gcp_app_handle_t app_handle = (gcp_app_handle_t)pvTimerGetTimerID(timer);
-    if (timer == app_handle->state_update_timer)
-    {
-        xEventGroupSetBits(app_handle->app_event_group, GCP_EVENT_STATE_UPDATE_BIT);
-    }
-    else if (timer == app_handle->device_pulse_timer)
-    {
-        xEventGroupSetBits(app_handle->app_event_group, GCP_EVENT_DEVICE_PULSE_BIT);
-    }
-    else
-    {
-        ESP_LOGE(TAG, "[timer_callback] unrecognized timer");
-    }
+    xEventGroupSetBits(app->app_event_group, GCP_EVENT_SCHEDULE_CHANGED_BIT);
 }
 
-static bool stop_timer(xTimerHandle timer_handle)
+/* state and pulse periods also live in app_config so they are reported in device_state */
+static uint32_t *job_config_period(gcp_app_handle_t app, const char *name)
 {
-    ESP_LOGD(TAG, "[stop_timer] %s", pcTimerGetTimerName(timer_handle));
-    if (xTimerStop(timer_handle, TIMER_WAIT) != pdPASS)
+    if (strcmp(name, JOB_NAME_STATE) == 0)
     {
-        ESP_LOGE(TAG, "[stop_timer] failed");
-        return false;
+        return &app->app_config->state_update_period_ms;
     }
-    return true;
-}
-
-static bool change_timer_period(xTimerHandle timer_handle, uint32_t period_ms)
-{
-    ESP_LOGD(TAG, "[change_timer_period] timer:%s, period:%d", pcTimerGetTimerName(timer_handle), period_ms);
-    if (xTimerChangePeriod(timer_handle, period_ms / portTICK_PERIOD_MS, TIMER_WAIT) == pdFAIL)
+    if (strcmp(name, JOB_NAME_PULSE) == 0)
     {
-        ESP_LOGE(TAG, "[change_timer_period] failed");
-        return false;
+        return &app->app_config->pulse_update_period_ms;
     }
-    return true;
+    return NULL;
 }
 
-static void delete_timer_from_config(xTimerHandle *config_timer_handle)
+esp_err_t gcp_app_set_job_period(gcp_app_handle_t client, const char *name, uint32_t period_ms)
 {
-    ESP_LOGD(TAG, "[delete_timer_from_config] %s", pcTimerGetTimerName(*config_timer_handle));
-    if (xTimerDelete(*config_timer_handle, TIMER_WAIT) != pdPASS)
+    esp_err_t err = gcp_scheduler_set_period(client, name, period_ms);
+    if (err != ESP_OK)
     {
-        ESP_LOGE(TAG, "[delete_timer_from_config] failed");
+        ESP_LOGE(TAG, "[gcp_app_set_job_period] %s: %s", name, esp_err_to_name(err));
+        return err;
     }
-    else
+    uint32_t *config_period = job_config_period(client, name);
+    if (config_period != NULL)
     {
-        *config_timer_handle = NULL;
+        *config_period = period_ms;
     }
+    wake_app_task(client);
+    return ESP_OK;
 }
 
-static void create_timer_in_config(gcp_app_handle_t app, xTimerHandle *config_timer_handle, char *name, uint32_t period_ms)
-{
-    ESP_LOGD(TAG, "[create_timer_in_config] %s", name);
-    *config_timer_handle = xTimerCreate(
-        name,
-        period_ms / portTICK_PERIOD_MS,
-        pdTRUE,
-        app,
-        timer_callback);
-}
-
-static void timer_config_received(xTimerHandle timer, uint32_t *config_period, uint32_t new_period)
+static void jobs_config_received(gcp_app_handle_t app_handle, const cJSON *jobs)
 {
-    if (*config_period == new_period)
-    {
-        return;
-    }
-    ESP_LOGD(TAG, "[timer_config_received] %s timer period changing to:%d", pcTimerGetTimerName(timer), new_period);
-    if (new_period == -1)
+    const cJSON *job_period_ms = NULL;
+    cJSON_ArrayForEach(job_period_ms, jobs)
     {
-        if (!stop_timer(timer))
+        if (cJSON_IsNumber(job_period_ms) && job_config_period(app_handle, job_period_ms->string) == NULL)
         {
-            return;
+            gcp_app_set_job_period(app_handle, job_period_ms->string, job_period_ms->valueint);
         }
     }
-    else
-    {
-        if (!change_timer_period(timer, new_period))
-        {
-            return;
-        }
-    }
-    ESP_LOGI(TAG, "[timer_config_received] %s timer period changed to:%d", pcTimerGetTimerName(timer), new_period);
-    *config_period = new_period;
 }
 
-static void gcp_app_device_config_received(gcp_app_handle_t app_handle, cJSON *device_config)
+void gcp_app_device_config_received(gcp_app_handle_t app_handle, cJSON *device_config)
 {
     const cJSON *timezone = cJSON_GetObjectItem(device_config, JSON_KEY_DEVICE_CONFIG_TIMEZONE);
     if (cJSON_IsString(timezone))
@@ -132,26 +166,57 @@ static void gcp_app_device_config_received(gcp_app_handle_t app_handle, cJSON *d
     const cJSON *state_period_ms = cJSON_GetObjectItem(device_config, JSON_KEY_DEVICE_CONFIG_STATE_PERIOD);
     if (cJSON_IsNumber(state_period_ms))
     {
-        timer_config_received(app_handle->state_update_timer, &app_handle->app_config->state_update_period_ms, state_period_ms->valueint);
+        gcp_app_set_job_period(app_handle, JOB_NAME_STATE, state_period_ms->valueint);
     }
     const cJSON *pulse_period_ms = cJSON_GetObjectItem(device_config, JSON_KEY_DEVICE_CONFIG_PULSE_PERIOD);
     if (cJSON_IsNumber(pulse_period_ms))
     {
-        timer_config_received(app_handle->device_pulse_timer, &app_handle->app_config->pulse_update_period_ms, pulse_period_ms->valueint);
+        gcp_app_set_job_period(app_handle, JOB_NAME_PULSE, pulse_period_ms->valueint);
+    }
+    const cJSON *jobs = cJSON_GetObjectItem(device_config, JSON_KEY_DEVICE_CONFIG_JOBS);
+    if (cJSON_IsObject(jobs))
+    {
+        jobs_config_received(app_handle, jobs);
     }
     const cJSON *firmware = cJSON_GetObjectItem(device_config, JSON_KEY_DEVICE_FIRMWARE);
     if (cJSON_IsObject(firmware))
     {
         const cJSON *firmware_version = cJSON_GetObjectItem(firmware, JSON_KEY_DEVICE_FIRMWARE_VERSION);
         const cJSON *firmware_url = cJSON_GetObjectItem(firmware, JSON_KEY_DEVICE_FIRMWARE_URL);
-        if (cJSON_IsString(firmware_version) && cJSON_IsString(firmware_url))
+        const char *transport = cJSON_GetStringValue(cJSON_GetObjectItem(firmware, JSON_KEY_DEVICE_FIRMWARE_TRANSPORT));
+        bool mqtt_transport = transport != NULL && strcmp(transport, JSON_KEY_DEVICE_FIRMWARE_TRANSPORT_MQTT) == 0;
+        if (cJSON_IsString(firmware_version) && (cJSON_IsString(firmware_url) || mqtt_transport))
         {
             char device_firmware_version[32];
             gcp_ota_get_running_app_version(device_firmware_version);
-            if (strcmp(device_firmware_version, firmware_version->valuestring) != 0)
+            gcp_ota_health_t health;
+            gcp_ota_get_health(&health);
+            if (health.state == GCP_OTA_HEALTH_ROLLED_BACK && strcmp(health.rejected_version, firmware_version->valuestring) == 0)
+            {
+                /* installing it again would roll back again, device_state.ota.rejected tells the cloud to change the config */
+                ESP_LOGW(TAG, "[gcp_app_device_config_received] %s was rolled back, not installing it again", firmware_version->valuestring);
+            }
+            else if (strcmp(device_firmware_version, firmware_version->valuestring) != 0)
             {
                 ESP_LOGI(TAG, "[gcp_app_device_config_received] current version:%s, new version:%s", device_firmware_version, firmware_version->valuestring);
-                gcp_ota_update_firmware(firmware_url->valuestring, app_handle->app_config->ota_server_cert_pem);
+                const cJSON *compression = cJSON_GetObjectItem(firmware, JSON_KEY_DEVICE_FIRMWARE_COMPRESSION);
+                const cJSON *patch = cJSON_GetObjectItem(firmware, JSON_KEY_DEVICE_FIRMWARE_PATCH);
+                gcp_ota_request_t request = {
+                    .url = cJSON_GetStringValue(firmware_url),
+                    .cert_pem = app_handle->app_config->ota_server_cert_pem,
+                    .compression = gcp_ota_compression_from_name(cJSON_GetStringValue(compression)),
+                    .patch_url = cJSON_GetStringValue(cJSON_GetObjectItem(patch, JSON_KEY_DEVICE_FIRMWARE_URL)),
+                    .patch_base_version = cJSON_GetStringValue(cJSON_GetObjectItem(patch, JSON_KEY_DEVICE_FIRMWARE_PATCH_BASE_VERSION)),
+                    .sha256 = cJSON_GetStringValue(cJSON_GetObjectItem(firmware, JSON_KEY_DEVICE_FIRMWARE_SHA256)),
+                    .transport = mqtt_transport ? GCP_OTA_TRANSPORT_MQTT : GCP_OTA_TRANSPORT_HTTP,
+                    .mqtt_client = app_handle->gcp_client,
+                    .transfer = app_handle->app_config->ota_transfer};
+                const cJSON *size = cJSON_GetObjectItem(firmware, JSON_KEY_DEVICE_FIRMWARE_SIZE);
+                if (cJSON_IsNumber(size))
+                {
+                    request.size = size->valueint;
+                }
+                gcp_ota_start(&request, &app_handle->app_config->ota_task);
             }
         }
     }
@@ -172,6 +237,10 @@ void gcp_app_config_callback(gcp_client_handle_t client, gcp_client_config_handl
 
         cJSON *device_config = cJSON_GetObjectItem(gcp_config_json, JSON_KEY_DEVICE_CONFIG);
         gcp_app_device_config_received(app_client, device_config);
+        if (app_client->app_config->duty_cycle.enabled)
+        {
+            gcp_duty_cycle_config_received(app_client, device_config);
+        }
 
         /* call application callback */
         if (app_client->app_config->config_callback != NULL)
@@ -179,6 +248,8 @@ void gcp_app_config_callback(gcp_client_handle_t client, gcp_client_config_handl
             cJSON *app_config = cJSON_GetObjectItem(gcp_config_json, JSON_KEY_APP_CONFIG);
             app_client->app_config->config_callback(app_client, app_config, app_client->app_config->user_context);
         }
+        xEventGroupSetBits(app_client->app_event_group, GCP_EVENT_CONFIG_RECEIVED_BIT);
+        gcp_ota_health_check_passed(GCP_OTA_CHECK_CONFIG);
     }
     cJSON_Delete(gcp_config_json);
 }
@@ -186,12 +257,181 @@ void gcp_app_config_callback(gcp_client_handle_t client, gcp_client_config_handl
 void gcp_app_command_callback(gcp_client_handle_t client, char *topic, char *command, void *user_context)
 {
     gcp_app_handle_t app_client = (gcp_app_handle_t)user_context;
+    size_t topic_len = strlen(topic);
+    if (topic_len >= strlen(TOPIC_COMMAND_OTA) && strcmp(topic + topic_len - strlen(TOPIC_COMMAND_OTA), TOPIC_COMMAND_OTA) == 0)
+    {
+        gcp_ota_mqtt_chunk_received(command);
+        return;
+    }
     if (app_client->app_config->cmd_callback != NULL)
     {
         app_client->app_config->cmd_callback(app_client, topic, command, app_client->app_config->user_context);
     }
 }
 
+/* only values that change on connection events are reported, so they don't trigger state updates on their own */
+static cJSON *get_mqtt_state(gcp_app_handle_t app_client)
+{
+    gcp_client_stats_t stats = {0};
+    gcp_client_get_stats(app_client->gcp_client, &stats);
+    cJSON *json_mqtt = cJSON_CreateObject();
+    cJSON_AddStringToObject(json_mqtt, JSON_KEY_MQTT_ENDPOINT, app_client->app_config->mqtt_endpoint == GCP_CLIENT_ENDPOINT_LTS ? "lts" : "default");
+    cJSON_AddNumberToObject(json_mqtt, JSON_KEY_MQTT_RECONNECTS, stats.reconnect_count);
+    cJSON_AddNumberToObject(json_mqtt, JSON_KEY_MQTT_CONNECT_MS, stats.last_connect_latency_ms);
+    cJSON_AddNumberToObject(json_mqtt, JSON_KEY_MQTT_OFFLINE_MS, stats.last_offline_ms);
+    cJSON_AddNumberToObject(json_mqtt, JSON_KEY_MQTT_JWT_MS, stats.last_jwt_ms);
+    return json_mqtt;
+}
+
+/* values cached by the link job, NULL until a sample was taken while associated */
+static cJSON *get_link_state(gcp_app_handle_t app_client)
+{
+    const gcp_link_sample_t *link = &app_client->link;
+    if (!link->associated)
+    {
+        return NULL;
+    }
+    cJSON *json_link = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json_link, JSON_KEY_RSSI, link->rssi);
+    cJSON_AddNumberToObject(json_link, JSON_KEY_LINK_CHANNEL, link->channel);
+    cJSON_AddStringToObject(json_link, JSON_KEY_LINK_PHY, link->phy);
+    cJSON_AddNumberToObject(json_link, JSON_KEY_LINK_RTT_MS, link->rtt_ms);
+    return json_link;
+}
+
+/* NULL when the application doesn't connect with wifi_helper */
+static cJSON *get_wifi_state()
+{
+    wifi_helper_timings_t timings;
+    wifi_helper_get_timings(&timings);
+    if (timings.connections == 0)
+    {
+        return NULL;
+    }
+    cJSON *json_wifi = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json_wifi, JSON_KEY_WIFI_CONNECT_MS, timings.connect_ms);
+    cJSON_AddNumberToObject(json_wifi, JSON_KEY_WIFI_IP_MS, timings.ip_ms);
+    cJSON_AddBoolToObject(json_wifi, JSON_KEY_WIFI_DIRECTED, timings.directed);
+    cJSON_AddBoolToObject(json_wifi, JSON_KEY_WIFI_STATIC_IP, timings.static_ip);
+    wifi_helper_stats_t stats;
+    wifi_helper_get_stats(&stats);
+    cJSON_AddStringToObject(json_wifi, JSON_KEY_WIFI_SSID, stats.ssid);
+    cJSON_AddNumberToObject(json_wifi, JSON_KEY_WIFI_DISCONNECTS, stats.disconnects);
+    cJSON_AddNumberToObject(json_wifi, JSON_KEY_WIFI_RECONNECTS, stats.reconnects);
+    cJSON_AddNumberToObject(json_wifi, JSON_KEY_WIFI_AP_SWITCHES, stats.ap_switches);
+    cJSON_AddNumberToObject(json_wifi, JSON_KEY_WIFI_REASON, stats.last_reason);
+    cJSON_AddNumberToObject(json_wifi, JSON_KEY_WIFI_OFFLINE_MS, stats.last_offline_ms);
+    cJSON_AddNumberToObject(json_wifi, JSON_KEY_WIFI_CA_STORE_MS, stats.ca_store_ms);
+    cJSON_AddNumberToObject(json_wifi, JSON_KEY_WIFI_CA_STORE_HEAP, stats.ca_store_heap);
+    return json_wifi;
+}
+
+/* "module":[current bytes, peak bytes, live allocations] for modules that allocated anything */
+static cJSON *get_heap_state()
+{
+    cJSON *json_heap = cJSON_CreateObject();
+    for (gcp_mem_module_t module = 0; module < GCP_MEM_MODULE_MAX; module++)
+    {
+        gcp_mem_stats_t stats;
+        gcp_mem_get_stats(module, &stats);
+        if (stats.total_allocs == 0)
+        {
+            continue;
+        }
+        cJSON *json_module = cJSON_CreateArray();
+        cJSON_AddItemToArray(json_module, cJSON_CreateNumber(stats.current_bytes));
+        cJSON_AddItemToArray(json_module, cJSON_CreateNumber(stats.peak_bytes));
+        cJSON_AddItemToArray(json_module, cJSON_CreateNumber(stats.live_allocs));
+        cJSON_AddItemToObject(json_heap, gcp_mem_module_name(module), json_module);
+    }
+    return json_heap;
+}
+
+/* high water marks only go down, they don't cause state updates unless a stack got deeper */
+static cJSON *get_stack_state(gcp_app_handle_t app_client)
+{
+    cJSON *json_stack = cJSON_CreateObject();
+    if (app_client->app_task != NULL)
+    {
+        cJSON_AddNumberToObject(json_stack, JSON_KEY_STACK_APP, uxTaskGetStackHighWaterMark(app_client->app_task));
+    }
+    gcp_client_stats_t stats = {0};
+    gcp_client_get_stats(app_client->gcp_client, &stats);
+    if (stats.mqtt_stack_free > 0)
+    {
+        cJSON_AddNumberToObject(json_stack, JSON_KEY_STACK_MQTT, stats.mqtt_stack_free);
+    }
+    return json_stack;
+}
+
+/* present once an update started or when the running firmware came from an update, it changes with every state period while downloading */
+static cJSON *get_ota_state()
+{
+    gcp_ota_progress_t progress;
+    gcp_ota_get_progress(&progress);
+    gcp_ota_result_t last_update;
+    bool updated = gcp_ota_get_last_update(&last_update) == ESP_OK;
+    gcp_ota_health_t health;
+    gcp_ota_get_health(&health);
+    if (progress.phase == GCP_OTA_PHASE_IDLE && !updated && health.state == GCP_OTA_HEALTH_NONE)
+    {
+        return NULL;
+    }
+    cJSON *json_ota = cJSON_CreateObject();
+    cJSON_AddStringToObject(json_ota, JSON_KEY_OTA_PHASE, gcp_ota_phase_name(progress.phase));
+    if (health.state != GCP_OTA_HEALTH_NONE)
+    {
+        cJSON_AddStringToObject(json_ota, JSON_KEY_OTA_HEALTH, gcp_ota_health_name(health.state));
+    }
+    if (health.state == GCP_OTA_HEALTH_ROLLED_BACK)
+    {
+        cJSON_AddStringToObject(json_ota, JSON_KEY_OTA_REJECTED, health.rejected_version);
+    }
+    if (health.missing != 0)
+    {
+        cJSON *json_missing = cJSON_AddArrayToObject(json_ota, JSON_KEY_OTA_MISSING);
+        const char *check_names[] = {"connected", "config", "state"};
+        for (int i = 0; i < 3; i++)
+        {
+            if (health.missing & (1 << i))
+            {
+                cJSON_AddItemToArray(json_missing, cJSON_CreateString(check_names[i]));
+            }
+        }
+    }
+    if (updated)
+    {
+        cJSON *json_last = cJSON_CreateObject();
+        cJSON_AddNumberToObject(json_last, JSON_KEY_OTA_SIZE, last_update.image_size);
+        cJSON_AddStringToObject(json_last, JSON_KEY_DEVICE_FIRMWARE_COMPRESSION, gcp_ota_compression_name(last_update.compression));
+        cJSON_AddBoolToObject(json_last, JSON_KEY_DEVICE_FIRMWARE_PATCH, last_update.delta);
+        cJSON_AddNumberToObject(json_last, JSON_KEY_OTA_DOWNLOAD, last_update.download_size);
+        cJSON_AddNumberToObject(json_last, JSON_KEY_OTA_TRANSFERRED, last_update.bytes_transferred);
+        cJSON_AddNumberToObject(json_last, JSON_KEY_OTA_RETRIES, last_update.retries);
+        cJSON_AddNumberToObject(json_last, JSON_KEY_OTA_MS, last_update.duration_ms);
+        cJSON_AddNumberToObject(json_last, JSON_KEY_OTA_BPS, last_update.bytes_per_sec);
+        cJSON_AddNumberToObject(json_last, JSON_KEY_OTA_FLASH_MS, last_update.flash_ms);
+        cJSON_AddNumberToObject(json_last, JSON_KEY_OTA_NET_MS, last_update.net_ms);
+        cJSON_AddItemToObject(json_ota, JSON_KEY_OTA_LAST, json_last);
+    }
+    if (progress.phase == GCP_OTA_PHASE_IDLE)
+    {
+        return json_ota;
+    }
+    cJSON_AddNumberToObject(json_ota, JSON_KEY_OTA_BYTES, progress.bytes_read);
+    cJSON_AddNumberToObject(json_ota, JSON_KEY_OTA_PERCENT, progress.percent);
+    cJSON_AddNumberToObject(json_ota, JSON_KEY_OTA_BPS, progress.bytes_per_sec);
+    cJSON_AddNumberToObject(json_ota, JSON_KEY_OTA_TRANSFERRED, progress.bytes_transferred);
+    cJSON_AddNumberToObject(json_ota, JSON_KEY_OTA_RETRIES, progress.retries);
+    cJSON_AddNumberToObject(json_ota, JSON_KEY_OTA_FLASH_MS, progress.flash_ms);
+    cJSON_AddNumberToObject(json_ota, JSON_KEY_OTA_NET_MS, progress.net_ms);
+    if (progress.last_error != ESP_OK)
+    {
+        cJSON_AddStringToObject(json_ota, JSON_KEY_OTA_ERROR, esp_err_to_name(progress.last_error));
+    }
+    return json_ota;
+}
+
 static cJSON *get_app_device_state(gcp_app_handle_t app_client)
 {
     cJSON *json_state = cJSON_CreateObject();
@@ -202,7 +442,41 @@ static cJSON *get_app_device_state(gcp_app_handle_t app_client)
     cJSON_AddStringToObject(json_device_state, JSON_KEY_FIRMWARE, version);
     cJSON_AddNumberToObject(json_device_state, JSON_KEY_DEVICE_CONFIG_STATE_PERIOD, app_client->app_config->state_update_period_ms);
     cJSON_AddNumberToObject(json_device_state, JSON_KEY_DEVICE_CONFIG_PULSE_PERIOD, app_client->app_config->pulse_update_period_ms);
+    cJSON *json_jobs = gcp_scheduler_get_periods(app_client);
+    if (json_jobs != NULL)
+    {
+        cJSON_AddItemToObject(json_device_state, JSON_KEY_DEVICE_CONFIG_JOBS, json_jobs);
+    }
     cJSON_AddNumberToObject(json_device_state, JSON_KEY_RESET_REASON, esp_reset_reason());
+    cJSON_AddItemToObject(json_device_state, JSON_KEY_MQTT, get_mqtt_state(app_client));
+    cJSON_AddItemToObject(json_device_state, JSON_KEY_STACK, get_stack_state(app_client));
+    cJSON *json_link = get_link_state(app_client);
+    if (json_link != NULL)
+    {
+        cJSON_AddItemToObject(json_device_state, JSON_KEY_LINK, json_link);
+    }
+    cJSON *json_wifi = get_wifi_state();
+    if (json_wifi != NULL)
+    {
+        cJSON_AddItemToObject(json_device_state, JSON_KEY_WIFI, json_wifi);
+    }
+    cJSON *json_ota = get_ota_state();
+    if (json_ota != NULL)
+    {
+        cJSON_AddItemToObject(json_device_state, JSON_KEY_OTA, json_ota);
+    }
+    if (app_client->app_config->pipeline.enabled)
+    {
+        cJSON *json_pipeline = cJSON_CreateObject();
+        cJSON_AddNumberToObject(json_pipeline, JSON_KEY_PIPELINE_DROPPED, app_client->pipeline_dropped);
+        cJSON_AddNumberToObject(json_pipeline, JSON_KEY_PIPELINE_FAILED, app_client->pipeline_failed);
+        cJSON_AddNumberToObject(json_pipeline, JSON_KEY_PIPELINE_MAX_DEPTH, app_client->pipeline_queue.high_water);
+        cJSON_AddItemToObject(json_device_state, JSON_KEY_PIPELINE, json_pipeline);
+    }
+    if (app_client->app_config->heap_stats)
+    {
+        cJSON_AddItemToObject(json_device_state, JSON_KEY_HEAP, get_heap_state());
+    }
 
     cJSON_AddItemToObject(json_state, JSON_KEY_DEVICE_STATE, json_device_state);
 
@@ -216,51 +490,120 @@ static cJSON *get_app_device_state(gcp_app_handle_t app_client)
     return json_state;
 }
 
+static char *print_state(gcp_app_handle_t app_client, cJSON *state)
+{
+    for (;;)
+    {
+        if (app_client->state_buffer != NULL && cJSON_PrintPreallocated(state, app_client->state_buffer, app_client->state_buffer_size, false))
+        {
+            return app_client->state_buffer;
+        }
+        size_t new_size = app_client->state_buffer_size == 0 ? STATE_BUFFER_INITIAL_SIZE : app_client->state_buffer_size * 2;
+        gcp_mem_free(app_client->state_buffer);
+        app_client->state_buffer = NULL;
+        app_client->state_buffer_size = 0;
+        if (new_size > STATE_BUFFER_MAX_SIZE)
+        {
+            return NULL;
+        }
+        app_client->state_buffer = gcp_mem_malloc(GCP_MEM_APP, new_size);
+        if (app_client->state_buffer == NULL)
+        {
+            return NULL;
+        }
+        app_client->state_buffer_size = new_size;
+    }
+}
+
 static void gcp_app_send_state(gcp_app_handle_t app_client)
 {
     static cJSON *last_state;
+    esp_err_t err = ESP_FAIL;
     cJSON *new_state = get_app_device_state(app_client);
-    if (cJSON_Compare(last_state, new_state, true))
+    if (!app_client->state_resend && cJSON_Compare(last_state, new_state, true))
     {
+        cJSON_Delete(new_state);
+        return;
+    }
+    gcp_app_count_radio_tx(app_client);
+    if (app_client->app_config->pipeline.enabled)
+    {
+        /* queued is remembered as sent, the network task raises state_resend if the publish fails */
+        err = gcp_pipeline_send_state(app_client, new_state);
+        goto end;
+    }
+    char *new_state_s = print_state(app_client, new_state);
+    if (new_state_s == NULL)
+    {
+        ESP_LOGE(TAG, "[gcp_send_state] state doesn't fit in %d bytes", STATE_BUFFER_MAX_SIZE);
         goto end;
     }
-    char *new_state_s = cJSON_Print(new_state);
-    cJSON_Minify(new_state_s);
     ESP_LOGI(TAG, "[gcp_send_state] sending new state:\n%s", new_state_s);
-    gcp_send_state(app_client->gcp_client, new_state_s);
-    free(new_state_s);
+    err = gcp_send_state(app_client->gcp_client, new_state_s);
+    if (err == ESP_OK)
+    {
+        gcp_ota_health_check_passed(GCP_OTA_CHECK_STATE);
+    }
 end:
+    /* a state that wasn't sent stays different from last_state, so the next period retries it */
+    if (err != ESP_OK)
+    {
+        cJSON_Delete(new_state);
+        return;
+    }
     cJSON_Delete(last_state);
     last_state = new_state;
 }
 
-static void gcp_send_device_pulse(gcp_app_handle_t app_client)
+static void state_job(gcp_app_handle_t app_client, void *job_context)
+{
+    gcp_app_send_state(app_client);
+}
+
+/* wake counters change every period so they go with the pulse instead of churning device_state */
+static void pulse_job(gcp_app_handle_t app_client, void *job_context)
 {
     char *pulse_path_log = app_client->app_config->topic_path_pulse == NULL ? TOPIC_DEFAULT_PULSE : app_client->app_config->topic_path_pulse;
-    gcp_send_telemetry(app_client->gcp_client, pulse_path_log, "pulse");
+    if (!app_client->app_config->pulse_metrics)
+    {
+        gcp_app_send_telemetry(app_client, pulse_path_log, PULSE_PAYLOAD);
+        return;
+    }
+    char pulse[192];
+    gcp_nvs_stats_t nvs_stats;
+    gcp_nvs_get_stats(&nvs_stats);
+    int length = snprintf(pulse, sizeof(pulse), "{\"" JSON_KEY_RADIO_WAKES "\":%u,\"" JSON_KEY_TX_ALIGNED "\":%u,\"" JSON_KEY_NVS_COMMITS "\":%u",
+                          app_client->radio_wakes, app_client->tx_aligned, nvs_stats.commits);
+    if (app_client->app_config->duty_cycle.enabled)
+    {
+        length += gcp_duty_cycle_print(app_client, pulse + length, sizeof(pulse) - length);
+    }
+    snprintf(pulse + length, sizeof(pulse) - length, "}");
+    gcp_app_send_telemetry(app_client, pulse_path_log, pulse);
 }
 
 static void gcp_app_task(void *pvParameter)
 {
     ESP_LOGI(TAG, "[gcp_app_task] started");
     gcp_app_handle_t app_client = (gcp_app_handle_t)pvParameter;
-    for (;;)
+    if (app_client->app_config->duty_cycle.enabled)
     {
-        EventBits_t evt_bit = xEventGroupWaitBits(app_client->app_event_group, GCP_EVENT_STATE_UPDATE_BIT | GCP_EVENT_DEVICE_PULSE_BIT | GCP_EVENT_APP_TASK_END_BIT, true, false, portMAX_DELAY);
-        if (evt_bit & GCP_EVENT_APP_TASK_END_BIT)
-        {
-            break;
-        }
-        if (evt_bit & GCP_EVENT_STATE_UPDATE_BIT)
-        {
-            gcp_app_send_state(app_client);
-        }
-        if (evt_bit & GCP_EVENT_DEVICE_PULSE_BIT)
+        gcp_duty_cycle_run(app_client);
+    }
+    else
+    {
+        for (;;)
         {
-            gcp_send_device_pulse(app_client);
+            TickType_t wait = gcp_scheduler_run(app_client);
+            EventBits_t evt_bit = xEventGroupWaitBits(app_client->app_event_group, GCP_EVENT_SCHEDULE_CHANGED_BIT | GCP_EVENT_APP_TASK_END_BIT, true, false, wait);
+            if (evt_bit & GCP_EVENT_APP_TASK_END_BIT)
+            {
+                break;
+            }
         }
     }
     ESP_LOGI(TAG, "[gcp_app_task] ended");
+    xEventGroupSetBits(app_client->app_event_group, GCP_EVENT_APP_TASK_ENDED_BIT);
     vTaskDelete(NULL);
 }
 
@@ -269,14 +612,9 @@ void gcp_app_connected_callback(gcp_client_handle_t client, void *user_context)
     ESP_LOGD(TAG, "[gcp_client_connected_callback]");
     gcp_app_handle_t app_client = (gcp_app_handle_t)user_context;
     gcp_app_config_t *app_config = app_client->app_config;
-    if (app_config->state_update_period_ms > 0)
-    {
-        change_timer_period(app_client->state_update_timer, app_config->state_update_period_ms);
-    }
-    if (app_config->pulse_update_period_ms > 0)
-    {
-        change_timer_period(app_client->device_pulse_timer, app_config->pulse_update_period_ms);
-    }
+    gcp_scheduler_set_connected(app_client, true);
+    xEventGroupSetBits(app_client->app_event_group, GCP_EVENT_CONNECTED_BIT | GCP_EVENT_SCHEDULE_CHANGED_BIT);
+    gcp_ota_health_check_passed(GCP_OTA_CHECK_CONNECTED);
     if (app_config->connected_callback != NULL)
     {
         app_config->connected_callback(app_client, app_config->user_context);
@@ -287,8 +625,8 @@ void gcp_app_disconnected_callback(gcp_client_handle_t client, void *user_contex
 {
     ESP_LOGD(TAG, "[gcp_app_disconnected_callback]");
     gcp_app_handle_t app_client = (gcp_app_handle_t)user_context;
-    stop_timer(app_client->state_update_timer);
-    stop_timer(app_client->device_pulse_timer);
+    gcp_scheduler_set_connected(app_client, false);
+    xEventGroupClearBits(app_client->app_event_group, GCP_EVENT_CONNECTED_BIT);
 
     if (app_client->app_config->disconnected_callback != NULL)
     {
@@ -296,11 +634,11 @@ void gcp_app_disconnected_callback(gcp_client_handle_t client, void *user_contex
     }
 }
 
-static gcp_app_config_t *deep_copy_config(gcp_app_config_t *app_config)
+static gcp_app_config_t *deep_copy_config(gcp_app_handle_t app, gcp_app_config_t *app_config)
 {
-    gcp_app_config_t *config_copy = calloc(1, sizeof(*config_copy));
+    gcp_app_config_t *config_copy = &app->app_config_storage;
     memcpy(config_copy, app_config, sizeof(gcp_app_config_t));
-    config_copy->device_identifiers = calloc(1, sizeof(gcp_device_identifiers_t));
+    config_copy->device_identifiers = &app->device_identifiers_storage;
     memcpy(config_copy->device_identifiers, app_config->device_identifiers, sizeof(gcp_device_identifiers_t));
     return config_copy;
 }
@@ -308,82 +646,217 @@ static gcp_app_config_t *deep_copy_config(gcp_app_config_t *app_config)
 esp_err_t gcp_app_destroy(gcp_app_handle_t app)
 {
     xEventGroupSetBits(app->app_event_group, GCP_EVENT_APP_TASK_END_BIT);
+    /* jobs and the network task publish through the client, both have to be gone before it is destroyed */
+    while (app->app_task != NULL && !(xEventGroupWaitBits(app->app_event_group, GCP_EVENT_APP_TASK_ENDED_BIT, false, true, GCP_APP_TASK_END_WARN_MS / portTICK_PERIOD_MS) & GCP_EVENT_APP_TASK_ENDED_BIT))
+    {
+        ESP_LOGW(TAG, "[gcp_app_destroy] still waiting for the app task to end");
+    }
+    if (app->app_config->pipeline.enabled)
+    {
+        gcp_pipeline_stop(app);
+    }
     gcp_client_destroy(app->gcp_client);
-    delete_timer_from_config(&app->state_update_timer);
-    delete_timer_from_config(&app->device_pulse_timer);
-    free(app->app_config->device_identifiers);
-    free(app->app_config);
-    free(app);
+    gcp_mem_free(app->state_buffer);
+    if (!app->static_storage)
+    {
+        gcp_mem_free(app);
+    }
     app = NULL;
     return ESP_OK;
 }
 
-static void init_timers(gcp_app_handle_t app)
+static void init_jobs(gcp_app_handle_t app)
 {
+    gcp_scheduler_init(app);
     /* state */
     if (app->app_config->state_update_period_ms == 0)
     {
         app->app_config->state_update_period_ms = APP_CONFIG_DEFAULT_STATE_PERIOD_MS;
     }
-    create_timer_in_config(app, &app->state_update_timer, "state_update_timer", app->app_config->state_update_period_ms);
+    gcp_scheduler_add(app, JOB_NAME_STATE, app->app_config->state_update_period_ms, 0, GCP_APP_JOB_WHEN_CONNECTED | GCP_APP_JOB_TX | GCP_JOB_INTERNAL, &state_job, NULL);
 
     /* pulse */
     if (app->app_config->pulse_update_period_ms == 0)
     {
         app->app_config->pulse_update_period_ms = APP_CONFIG_DEFAULT_PULSE_PERIOD_MS;
     }
-    create_timer_in_config(app, &app->device_pulse_timer, "device_pulse_timer", app->app_config->pulse_update_period_ms);
+    gcp_scheduler_add(app, JOB_NAME_PULSE, app->app_config->pulse_update_period_ms, 0, GCP_APP_JOB_WHEN_CONNECTED | GCP_APP_JOB_TX | GCP_JOB_INTERNAL, &pulse_job, NULL);
+
+    /* link quality */
+    gcp_link_init(app);
+}
+
+typedef struct
+{
+    struct gcp_app_client_t app;
+    gcp_client_static_storage_t client;
+    StackType_t app_task_stack[GCP_APP_TASK_STACK_SIZE];
+} gcp_app_static_layout_t;
+
+_Static_assert(sizeof(gcp_app_static_layout_t) <= GCP_APP_STATIC_STORAGE_SIZE, "GCP_APP_STATIC_STORAGE_SIZE is too small");
+
+static void init_task_config(gcp_task_config_t *task_config)
+{
+    if (task_config->stack_size == 0)
+    {
+        task_config->stack_size = GCP_APP_TASK_STACK_SIZE;
+    }
+    if (task_config->priority == 0)
+    {
+        task_config->priority = GCP_APP_TASK_PRIORITY;
+    }
+}
+
+static void init_app(gcp_app_handle_t new_app, gcp_app_config_t *app_config, gcp_client_config_t *gcp_client_config)
+{
+    new_app->app_config = deep_copy_config(new_app, app_config);
+    init_task_config(&new_app->app_config->app_task);
+    if (new_app->app_config->duty_cycle.enabled && new_app->app_config->pipeline.enabled)
+    {
+        ESP_LOGW(TAG, "[init_app] pipeline is not used in duty cycle mode");
+        new_app->app_config->pipeline.enabled = false;
+    }
+    if (new_app->static_storage && new_app->app_config->pipeline.enabled)
+    {
+        ESP_LOGW(TAG, "[init_app] pipeline is not used with static storage, its queue and task are allocated from the heap");
+        new_app->app_config->pipeline.enabled = false;
+    }
+    if (new_app->app_config->pipeline.enabled && gcp_pipeline_init(new_app) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "[init_app] pipeline init failed, publishing from the calling task");
+        new_app->app_config->pipeline.enabled = false;
+    }
+    new_app->app_event_group = xEventGroupCreateStatic(&new_app->app_event_group_buffer);
+    gcp_ota_health_begin(new_app->app_config->ota_health_timeout_ms);
+    init_jobs(new_app);
+    if (new_app->app_config->duty_cycle.enabled)
+    {
+        gcp_duty_cycle_init(new_app);
+    }
+
+    gcp_client_config->cmd_callback = &gcp_app_command_callback;
+    gcp_client_config->config_callback = &gcp_app_config_callback;
+    gcp_client_config->connected_callback = &gcp_app_connected_callback;
+    gcp_client_config->disconnected_callback = &gcp_app_disconnected_callback;
+    gcp_client_config->device_identifiers = app_config->device_identifiers;
+    gcp_client_config->jwt_callback = app_config->jwt_callback;
+    gcp_client_config->user_context = new_app;
+    gcp_client_config->backoff = app_config->mqtt_backoff;
+    gcp_client_config->jwt_rtc_cache = app_config->jwt_rtc_cache || app_config->duty_cycle.enabled;
+    gcp_client_config->endpoint = app_config->mqtt_endpoint;
+    gcp_client_config->mqtt_task = app_config->mqtt_task;
 }
 
 gcp_app_handle_t gcp_app_init(gcp_app_config_t *app_config)
 {
     ESP_LOGD(TAG, "[gcp_app_init] started");
-    gcp_app_handle_t new_app = calloc(1, sizeof(*new_app));
-    new_app->app_config = deep_copy_config(app_config);
-    new_app->app_event_group = xEventGroupCreate();
-    init_timers(new_app);
-
-    gcp_client_config_t gcp_client_config = {
-        .cmd_callback = &gcp_app_command_callback,
-        .config_callback = &gcp_app_config_callback,
-        .connected_callback = &gcp_app_connected_callback,
-        .disconnected_callback = &gcp_app_disconnected_callback,
-        .device_identifiers = app_config->device_identifiers,
-        .jwt_callback = app_config->jwt_callback,
-        .user_context = new_app};
-
+    gcp_app_handle_t new_app = gcp_mem_calloc(GCP_MEM_APP, 1, sizeof(*new_app));
+    gcp_client_config_t gcp_client_config = {};
+    init_app(new_app, app_config, &gcp_client_config);
     new_app->gcp_client = gcp_client_init(&gcp_client_config);
     return new_app;
 }
+
+gcp_app_handle_t gcp_app_init_static(gcp_app_config_t *app_config, gcp_app_static_storage_t *storage)
+{
+    ESP_LOGD(TAG, "[gcp_app_init_static] started");
+    gcp_app_static_layout_t *layout = (gcp_app_static_layout_t *)storage;
+    gcp_app_handle_t new_app = &layout->app;
+    memset(new_app, 0, sizeof(*new_app));
+    new_app->static_storage = true;
+    new_app->app_task_stack = layout->app_task_stack;
+    gcp_client_config_t gcp_client_config = {};
+    init_app(new_app, app_config, &gcp_client_config);
+    new_app->gcp_client = gcp_client_init_static(&gcp_client_config, &layout->client);
+    return new_app;
+}
+
+static esp_err_t create_app_task(gcp_app_handle_t client)
+{
+    gcp_task_config_t *task_config = &client->app_config->app_task;
+    BaseType_t core_id = task_config->pin_to_core ? task_config->core_id : tskNO_AFFINITY;
+    ESP_LOGD(TAG, "[create_app_task] stack:%d, priority:%d, core:%d", task_config->stack_size, task_config->priority, core_id);
+    if (client->app_task_stack != NULL)
+    {
+        if (task_config->stack_size > GCP_APP_TASK_STACK_SIZE)
+        {
+            ESP_LOGE(TAG, "[create_app_task] stack_size is bigger than the static storage stack:%d", GCP_APP_TASK_STACK_SIZE);
+            return ESP_ERR_INVALID_SIZE;
+        }
+        client->app_task = xTaskCreateStaticPinnedToCore(&gcp_app_task, "gcp_app_task", task_config->stack_size, client, task_config->priority, client->app_task_stack, &client->app_task_buffer, core_id);
+    }
+    else if (xTaskCreatePinnedToCore(&gcp_app_task, "gcp_app_task", task_config->stack_size, client, task_config->priority, &client->app_task, core_id) != pdPASS)
+    {
+        client->app_task = NULL;
+    }
+    return client->app_task != NULL ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
 esp_err_t gcp_app_start(gcp_app_handle_t client)
 {
     ESP_LOGD(TAG, "[gcp_app_start] started");
     esp_err_t err = gcp_client_start(client->gcp_client);
+    if (err == ESP_OK && client->app_config->pipeline.enabled)
+    {
+        err = gcp_pipeline_start(client);
+    }
     if (err == ESP_OK)
     {
-        xTaskCreate(&gcp_app_task, "gcp_app_task", 4096, client, 2, NULL);
+        err = create_app_task(client);
     }
     return err;
 }
 
+/* a publish after the radio was idle for GCP_APP_RADIO_IDLE_MS counts as a wake, the modem sleeps between DTIM beacons in power save */
+void gcp_app_count_radio_tx(gcp_app_handle_t app)
+{
+    int64_t now_us = esp_timer_get_time();
+    if (app->last_tx_us == 0 || now_us - app->last_tx_us > GCP_APP_RADIO_IDLE_MS * 1000)
+    {
+        app->radio_wakes++;
+    }
+    app->last_tx_us = now_us;
+}
+
 esp_err_t gcp_app_send_telemetry(gcp_app_handle_t client, const char *topic, const char *msg)
 {
+    gcp_app_count_radio_tx(client);
+    if (client->app_config->pipeline.enabled)
+    {
+        return gcp_pipeline_send_telemetry(client, topic, msg);
+    }
     return gcp_send_telemetry(client->gcp_client, topic, msg);
 }
 
+gcp_app_job_t gcp_app_schedule(gcp_app_handle_t client, const char *name, uint32_t period_ms, uint32_t jitter_ms, uint32_t flags, gcp_app_job_callback_t callback, void *job_context)
+{
+    gcp_app_job_t job = gcp_scheduler_add(client, name, period_ms, jitter_ms, flags & ~GCP_JOB_INTERNAL, callback, job_context);
+    if (job >= 0)
+    {
+        wake_app_task(client);
+    }
+    return job;
+}
+
+esp_err_t gcp_app_unschedule(gcp_app_handle_t client, gcp_app_job_t job)
+{
+    return gcp_scheduler_remove(client, job);
+}
+
 esp_err_t gcp_app_logf(gcp_app_handle_t client, char *format, ...)
 {
     va_list argptr;
     va_start(argptr, format);
     char *message = NULL;
-    vasprintf(&message, format, argptr);
+    gcp_mem_vasprintf(GCP_MEM_APP, &message, format, argptr);
+    va_end(argptr);
     esp_err_t result = gcp_app_log(client, message);
-    free(message);
+    gcp_mem_free(message);
     return result;
 }
 
 esp_err_t gcp_app_log(gcp_app_handle_t client, char *message)
 {
     char *topic_path_log = client->app_config->topic_path_log == NULL ? TOPIC_DEFAULT_LOG : client->app_config->topic_path_log;
-    return gcp_send_telemetry(client->gcp_client, topic_path_log, message);
+    return gcp_app_send_telemetry(client, topic_path_log, message);
 }
@@ -1,4 +1,5 @@
 #include "gcp_client.h"
+#include "gcp_mem.h"
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -9,7 +10,10 @@
 #include "esp_https_ota.h"
 #include "esp_ota_ops.h"
 #include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
 #include <mbedtls/error.h>
+#include <mbedtls/base64.h>
 #include <mqtt_client.h>
 #include <string.h>
 #include "cJSON.h"
@@ -21,28 +25,165 @@
 #define DEVICE_COMMAND_TOPIC_FORMAT "/devices/%s/commands/#"
 #define DEVICE_CONFIG_TOPIC_FORMAT "/devices/%s/config"
 #define MQTT_BRIDGE_URI "mqtts://mqtt.googleapis.com:8883"
+#define MQTT_BRIDGE_LTS_URI "mqtts://mqtt.2030.ltsapis.goog:8883"
 #define MQTT_CLIENT_ID_FORMAT "projects/%s/locations/%s/registries/%s/devices/%s"
 
 #define GCP_MQTT_RETRY_PERIOD_MS 60000
+#define GCP_MQTT_RETRY_INITIAL_MS 1000
+#define GCP_MQTT_FAST_RETRY_MS 500
+#define GCP_MQTT_STABLE_CONNECTION_MS 60000
+#define GCP_MQTT_BACKOFF_MAX_SHIFT 16
+#define GCP_JWT_REFRESH_MARGIN_S 300
+#define GCP_JWT_PAYLOAD_MAX_SIZE 256
+#define GCP_JWT_RTC_CACHE_MAGIC 0x4a575431
+#define GCP_CLIENT_ID_MAX_SIZE 256
+#define GCP_CLIENT_TOPIC_MAX_SIZE 128
+#define GCP_CLIENT_RTT_PROBE_TIMEOUT_MS 10000
+#define GCP_CLIENT_MAX_UNACKED 16
+/* esp-mqtt expires outbox messages after OUTBOX_EXPIRED_TIMEOUT_MS, a PUBACK isn't coming after that */
+#define GCP_CLIENT_UNACKED_TIMEOUT_MS 30000
 #define GCP_EVENT_STATE_UPDATE_BIT BIT1
 #define GCP_EVENT_MQTT_CONNECTED_BIT BIT3
 #define GCP_EVENT_MQTT_DISCONNECT_BIT BIT4
 
+/* everything the client needs lives in the handle so it can be placed in caller provided storage */
 struct gcp_client_t
 {
     gcp_client_config_t *client_config;
+    gcp_client_config_t client_config_storage;
+    gcp_device_identifiers_t device_identifiers_storage;
+    bool static_storage;
     esp_mqtt_client_handle_t mqtt_client;
     char jwt_token_buffer[JWT_TOKEN_BUFFER_SIZE];
-    char *client_id;
-    char *topic_config;
-    char *topic_cmd;
-    char *topic_state;
+    time_t jwt_expires_at;
+    uint32_t last_jwt_ms;
+    /* msg_ids of QoS 1 publishes waiting for PUBACK, negative for a PUBACK that came before its msg_id was stored */
+    struct
+    {
+        int msg_id;
+        uint32_t sent_ms;
+    } unacked[GCP_CLIENT_MAX_UNACKED];
+    portMUX_TYPE unacked_lock;
+    volatile int rtt_msg_id; /* publish timed until its PUBACK, 0 when none is */
+    int64_t rtt_sent_us;
+    uint32_t last_rtt_ms;
+    char client_id[GCP_CLIENT_ID_MAX_SIZE];
+    char topic_config[GCP_CLIENT_TOPIC_MAX_SIZE];
+    char topic_cmd[GCP_CLIENT_TOPIC_MAX_SIZE];
+    char topic_state[GCP_CLIENT_TOPIC_MAX_SIZE];
+    char rx_topic[GCP_CLIENT_TOPIC_MAX_SIZE];
+    char rx_buffer[GCP_CLIENT_RX_BUFFER_SIZE];
+    int rx_len;
+    bool rx_dropped;
+    xTimerHandle reconnect_timer;
+    StaticTimer_t reconnect_timer_buffer;
+    TaskHandle_t mqtt_task;
+    gcp_client_state_t state;
+    int64_t state_entered_us;
+    uint32_t reconnect_count;
+    uint32_t failed_attempts;
+    uint32_t next_retry_delay_ms;
+    uint32_t last_connect_latency_ms;
+    uint32_t last_offline_ms;
+    int64_t offline_since_us;
 };
 
+/* survives deep sleep so a wake up doesn't pay for a new RSA signature */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t client_id_hash;
+    time_t expires_at;
+    char token[JWT_TOKEN_BUFFER_SIZE];
+} gcp_jwt_rtc_cache_t;
+
+static RTC_DATA_ATTR gcp_jwt_rtc_cache_t jwt_rtc_cache;
+
+_Static_assert(sizeof(struct gcp_client_t) <= GCP_CLIENT_STATIC_STORAGE_SIZE, "GCP_CLIENT_STATIC_STORAGE_SIZE is too small");
+
+static const char *state_name(gcp_client_state_t state)
+{
+    switch (state)
+    {
+    case GCP_CLIENT_STATE_STOPPED:
+        return "stopped";
+    case GCP_CLIENT_STATE_CONNECTING:
+        return "connecting";
+    case GCP_CLIENT_STATE_CONNECTED:
+        return "connected";
+    case GCP_CLIENT_STATE_BACKOFF:
+        return "backoff";
+    }
+    return "unknown";
+}
+
+static void set_state(gcp_client_handle_t gcp_client, gcp_client_state_t state)
+{
+    int64_t now = esp_timer_get_time();
+    ESP_LOGD(TAG, "[set_state] %s -> %s after %lld ms", state_name(gcp_client->state), state_name(state), (now - gcp_client->state_entered_us) / 1000);
+    gcp_client->state = state;
+    gcp_client->state_entered_us = now;
+}
+
+/* full jitter: pick uniformly from [0, window], window doubles on every failed attempt up to max_delay_ms */
+static uint32_t next_backoff_delay_ms(gcp_client_handle_t gcp_client, bool transient_drop)
+{
+    gcp_client_backoff_config_t *backoff = &gcp_client->client_config->backoff;
+    uint32_t window;
+    if (transient_drop)
+    {
+        gcp_client->failed_attempts = 0;
+        window = backoff->fast_retry_delay_ms;
+    }
+    else
+    {
+        uint32_t shift = gcp_client->failed_attempts < GCP_MQTT_BACKOFF_MAX_SHIFT ? gcp_client->failed_attempts : GCP_MQTT_BACKOFF_MAX_SHIFT;
+        uint64_t exp_window = (uint64_t)backoff->initial_delay_ms << shift;
+        window = exp_window > backoff->max_delay_ms ? backoff->max_delay_ms : (uint32_t)exp_window;
+        gcp_client->failed_attempts++;
+    }
+    return esp_random() % (window + 1);
+}
+
+static void reconnect_timer_callback(TimerHandle_t timer)
+{
+    gcp_client_handle_t gcp_client = (gcp_client_handle_t)pvTimerGetTimerID(timer);
+    ESP_LOGI(TAG, "[reconnect_timer_callback] reconnecting, attempt:%d", gcp_client->failed_attempts);
+    if (esp_mqtt_client_reconnect(gcp_client->mqtt_client) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "[reconnect_timer_callback] reconnect failed");
+    }
+}
+
+static void schedule_reconnect(gcp_client_handle_t gcp_client, bool transient_drop)
+{
+    gcp_client->next_retry_delay_ms = next_backoff_delay_ms(gcp_client, transient_drop);
+    set_state(gcp_client, GCP_CLIENT_STATE_BACKOFF);
+    ESP_LOGI(TAG, "[schedule_reconnect] next attempt in %d ms, transient:%d", gcp_client->next_retry_delay_ms, transient_drop);
+    /* timer period can not be zero */
+    TickType_t ticks = gcp_client->next_retry_delay_ms / portTICK_PERIOD_MS;
+    if (xTimerChangePeriod(gcp_client->reconnect_timer, ticks > 0 ? ticks : 1, portMAX_DELAY) != pdPASS)
+    {
+        ESP_LOGE(TAG, "[schedule_reconnect] failed to start reconnect timer");
+    }
+}
+
 static esp_err_t mqtt_connected(esp_mqtt_event_handle_t event)
 {
     ESP_LOGD(TAG, "MQTT_EVENT_CONNECTED");
     gcp_client_handle_t gcp_client = event->user_context;
+    int64_t now = esp_timer_get_time();
+    gcp_client->last_connect_latency_ms = (now - gcp_client->state_entered_us) / 1000;
+    if (gcp_client->offline_since_us != 0)
+    {
+        gcp_client->last_offline_ms = (now - gcp_client->offline_since_us) / 1000;
+        gcp_client->reconnect_count++;
+    }
+    gcp_client->failed_attempts = 0;
+    /* events are dispatched from the esp-mqtt task */
+    gcp_client->mqtt_task = xTaskGetCurrentTaskHandle();
+    set_state(gcp_client, GCP_CLIENT_STATE_CONNECTED);
+    ESP_LOGI(TAG, "[mqtt_connected] endpoint:%d, connect latency:%d ms, reconnects:%d", gcp_client->client_config->endpoint, gcp_client->last_connect_latency_ms, gcp_client->reconnect_count);
     esp_mqtt_client_subscribe(event->client, gcp_client->topic_config, 1);
     esp_mqtt_client_subscribe(event->client, gcp_client->topic_cmd, 1);
     if (gcp_client->client_config->connected_callback != NULL)
@@ -56,55 +197,274 @@ static esp_err_t mqtt_disconnected(esp_mqtt_event_handle_t event)
 {
     ESP_LOGD(TAG, "MQTT_EVENT_DISCONNECTED");
     gcp_client_handle_t gcp_client = event->user_context;
-    strcpy(gcp_client->jwt_token_buffer, "");
-    if (gcp_client->client_config->disconnected_callback != NULL)
+    bool was_connected = gcp_client->state == GCP_CLIENT_STATE_CONNECTED;
+    bool transient_drop = was_connected && (esp_timer_get_time() - gcp_client->state_entered_us) / 1000 >= gcp_client->client_config->backoff.stable_connection_ms;
+    if (was_connected)
+    {
+        gcp_client->offline_since_us = esp_timer_get_time();
+    }
+    /* its PUBACK won't come on this connection */
+    gcp_client->rtt_msg_id = 0;
+    if (gcp_client->state != GCP_CLIENT_STATE_STOPPED)
+    {
+        schedule_reconnect(gcp_client, transient_drop);
+    }
+    if (was_connected && gcp_client->client_config->disconnected_callback != NULL)
     {
         gcp_client->client_config->disconnected_callback(gcp_client, gcp_client->client_config->user_context);
     }
     return ESP_OK;
 }
 
+/* messages bigger than the esp-mqtt buffer arrive in fragments, topic is only set on the first one */
 static esp_err_t mqtt_data_received(esp_mqtt_event_handle_t event)
 {
     ESP_LOGD(TAG, "MQTT_EVENT_DATA: MSG_ID=%d, TOPIC=%.*s, DATA=%.*s", event->msg_id, event->topic_len, event->topic, event->data_len, event->data);
-    char *data_buffer = (char *)calloc(event->data_len + 1, sizeof(char));
-    sprintf(data_buffer, "%.*s", event->data_len, event->data);
     gcp_client_handle_t gcp_client = event->user_context;
-    if (strcmp(event->topic, gcp_client->topic_config) == 0)
+    if (event->current_data_offset == 0)
+    {
+        gcp_client->rx_len = 0;
+        gcp_client->rx_dropped = event->total_data_len >= GCP_CLIENT_RX_BUFFER_SIZE || event->topic_len >= GCP_CLIENT_TOPIC_MAX_SIZE;
+        if (gcp_client->rx_dropped)
+        {
+            ESP_LOGE(TAG, "[mqtt_data_received] dropping message, topic:%.*s size:%d", event->topic_len, event->topic, event->total_data_len);
+            return ESP_OK;
+        }
+        memcpy(gcp_client->rx_topic, event->topic, event->topic_len);
+        gcp_client->rx_topic[event->topic_len] = '\0';
+    }
+    if (gcp_client->rx_dropped)
+    {
+        return ESP_OK;
+    }
+    memcpy(gcp_client->rx_buffer + gcp_client->rx_len, event->data, event->data_len);
+    gcp_client->rx_len += event->data_len;
+    if (gcp_client->rx_len < event->total_data_len)
+    {
+        return ESP_OK;
+    }
+    gcp_client->rx_buffer[gcp_client->rx_len] = '\0';
+    if (strcmp(gcp_client->rx_topic, gcp_client->topic_config) == 0)
     {
         if (gcp_client->client_config->config_callback != NULL)
         {
-            gcp_client->client_config->config_callback(gcp_client, data_buffer, gcp_client->client_config->user_context);
+            gcp_client->client_config->config_callback(gcp_client, gcp_client->rx_buffer, gcp_client->client_config->user_context);
         }
     }
     else
     {
         if (gcp_client->client_config->cmd_callback != NULL)
         {
-            gcp_client->client_config->cmd_callback(gcp_client, event->topic, data_buffer, gcp_client->client_config->user_context);
+            gcp_client->client_config->cmd_callback(gcp_client, gcp_client->rx_topic, gcp_client->rx_buffer, gcp_client->client_config->user_context);
+        }
+    }
+    return ESP_OK;
+}
+
+/*
+ * Stores the msg_id of a publish (sent true) or removes it on its PUBACK or expiry (sent false). A PUBACK that comes before
+ * published() stored its msg_id is kept as -msg_id until it does. Entries older than GCP_CLIENT_UNACKED_TIMEOUT_MS are dropped on the way.
+ */
+static void unacked_update(gcp_client_handle_t client, int msg_id, bool sent)
+{
+    uint32_t now_ms = esp_timer_get_time() / 1000;
+    int free_slot = -1;
+    int oldest_slot = 0;
+    portENTER_CRITICAL(&client->unacked_lock);
+    for (int i = 0; i < GCP_CLIENT_MAX_UNACKED; i++)
+    {
+        if (client->unacked[i].msg_id != 0 && now_ms - client->unacked[i].sent_ms > GCP_CLIENT_UNACKED_TIMEOUT_MS)
+        {
+            client->unacked[i].msg_id = 0;
+        }
+        if (client->unacked[i].msg_id == (sent ? -msg_id : msg_id))
+        {
+            client->unacked[i].msg_id = 0;
+            goto end;
+        }
+        if (client->unacked[i].msg_id == 0)
+        {
+            free_slot = free_slot < 0 ? i : free_slot;
+        }
+        else if ((int32_t)(client->unacked[i].sent_ms - client->unacked[oldest_slot].sent_ms) < 0)
+        {
+            oldest_slot = i;
+        }
+    }
+    /* the table is full of publishes that are still in time, the oldest is forgotten */
+    int slot = free_slot >= 0 ? free_slot : oldest_slot;
+    client->unacked[slot].msg_id = sent ? msg_id : -msg_id;
+    client->unacked[slot].sent_ms = now_ms;
+end:
+    portEXIT_CRITICAL(&client->unacked_lock);
+}
+
+static uint32_t unacked_count(gcp_client_handle_t client)
+{
+    uint32_t now_ms = esp_timer_get_time() / 1000;
+    uint32_t count = 0;
+    portENTER_CRITICAL(&client->unacked_lock);
+    for (int i = 0; i < GCP_CLIENT_MAX_UNACKED; i++)
+    {
+        if (client->unacked[i].msg_id > 0 && now_ms - client->unacked[i].sent_ms <= GCP_CLIENT_UNACKED_TIMEOUT_MS)
+        {
+            count++;
         }
     }
-    free(data_buffer);
+    portEXIT_CRITICAL(&client->unacked_lock);
+    return count;
+}
+
+static esp_err_t mqtt_published(esp_mqtt_event_handle_t event)
+{
+    ESP_LOGD(TAG, "MQTT_EVENT_PUBLISHED: MSG_ID=%d", event->msg_id);
+    gcp_client_handle_t gcp_client = event->user_context;
+    unacked_update(gcp_client, event->msg_id, false);
+    if (event->msg_id == gcp_client->rtt_msg_id)
+    {
+        gcp_client->last_rtt_ms = (esp_timer_get_time() - gcp_client->rtt_sent_us) / 1000;
+        gcp_client->rtt_msg_id = 0;
+    }
     return ESP_OK;
 }
 
 static esp_err_t gcp_mqtt_event_handler(esp_mqtt_event_handle_t event);
 
+static uint32_t hash_string(const char *str)
+{
+    uint32_t hash = 5381;
+    while (*str)
+    {
+        hash = hash * 33 + (uint8_t)*str++;
+    }
+    return hash;
+}
+
+/* reads the exp claim of the token, returns 0 if it can't be found */
+static time_t jwt_get_expiry(const char *token)
+{
+    const char *payload_start = strchr(token, '.');
+    if (payload_start == NULL)
+    {
+        return 0;
+    }
+    payload_start++;
+    const char *payload_end = strchr(payload_start, '.');
+    if (payload_end == NULL || payload_end - payload_start > GCP_JWT_PAYLOAD_MAX_SIZE)
+    {
+        return 0;
+    }
+    /* base64url to base64 with padding */
+    unsigned char encoded[GCP_JWT_PAYLOAD_MAX_SIZE + 4];
+    size_t encoded_len = 0;
+    for (const char *c = payload_start; c < payload_end; c++)
+    {
+        encoded[encoded_len++] = *c == '-' ? '+' : (*c == '_' ? '/' : *c);
+    }
+    while (encoded_len % 4 != 0)
+    {
+        encoded[encoded_len++] = '=';
+    }
+    unsigned char decoded[GCP_JWT_PAYLOAD_MAX_SIZE];
+    size_t decoded_len = 0;
+    if (mbedtls_base64_decode(decoded, sizeof(decoded) - 1, &decoded_len, encoded, encoded_len) != 0)
+    {
+        return 0;
+    }
+    decoded[decoded_len] = '\0';
+    time_t expires_at = 0;
+    cJSON *payload = cJSON_Parse((char *)decoded);
+    const cJSON *exp = cJSON_GetObjectItem(payload, "exp");
+    if (cJSON_IsNumber(exp))
+    {
+        expires_at = (time_t)exp->valuedouble;
+    }
+    cJSON_Delete(payload);
+    return expires_at;
+}
+
+static bool jwt_is_valid(gcp_client_handle_t gcp_client)
+{
+    if (strcmp("", gcp_client->jwt_token_buffer) == 0)
+    {
+        return false;
+    }
+    time_t now;
+    time(&now);
+    return gcp_client->jwt_expires_at > now + GCP_JWT_REFRESH_MARGIN_S;
+}
+
+static void invalidate_jwt(gcp_client_handle_t gcp_client)
+{
+    strcpy(gcp_client->jwt_token_buffer, "");
+    gcp_client->jwt_expires_at = 0;
+    if (gcp_client->client_config->jwt_rtc_cache)
+    {
+        jwt_rtc_cache.magic = 0;
+    }
+}
+
+static void load_jwt_from_rtc(gcp_client_handle_t gcp_client)
+{
+    if (jwt_rtc_cache.magic != GCP_JWT_RTC_CACHE_MAGIC || jwt_rtc_cache.client_id_hash != hash_string(gcp_client->client_id))
+    {
+        return;
+    }
+    memcpy(gcp_client->jwt_token_buffer, jwt_rtc_cache.token, JWT_TOKEN_BUFFER_SIZE);
+    gcp_client->jwt_expires_at = jwt_rtc_cache.expires_at;
+    ESP_LOGI(TAG, "[load_jwt_from_rtc] cached token expires at %ld", (long)gcp_client->jwt_expires_at);
+}
+
+/* signing the token is the most expensive part of a reconnect, reuse it until it is about to expire */
+static bool refresh_jwt(gcp_client_handle_t gcp_client)
+{
+    if (jwt_is_valid(gcp_client))
+    {
+        gcp_client->last_jwt_ms = 0;
+        return false;
+    }
+    int64_t start = esp_timer_get_time();
+    gcp_client->client_config->jwt_callback(gcp_client->client_config->device_identifiers->project_id, gcp_client->jwt_token_buffer);
+    gcp_client->last_jwt_ms = (esp_timer_get_time() - start) / 1000;
+    gcp_client->jwt_expires_at = jwt_get_expiry(gcp_client->jwt_token_buffer);
+    ESP_LOGI(TAG, "[refresh_jwt] new token in %d ms, expires at %ld", gcp_client->last_jwt_ms, (long)gcp_client->jwt_expires_at);
+    if (gcp_client->client_config->jwt_rtc_cache && gcp_client->jwt_expires_at != 0)
+    {
+        jwt_rtc_cache.client_id_hash = hash_string(gcp_client->client_id);
+        jwt_rtc_cache.expires_at = gcp_client->jwt_expires_at;
+        memcpy(jwt_rtc_cache.token, gcp_client->jwt_token_buffer, JWT_TOKEN_BUFFER_SIZE);
+        jwt_rtc_cache.magic = GCP_JWT_RTC_CACHE_MAGIC;
+    }
+    return true;
+}
+
 static void create_mqtt_config(esp_mqtt_client_config_t *mqtt_cfg, gcp_client_handle_t gcp_client)
 {
-    mqtt_cfg->uri = MQTT_BRIDGE_URI;
+    if (gcp_client->client_config->endpoint == GCP_CLIENT_ENDPOINT_LTS)
+    {
+        mqtt_cfg->uri = MQTT_BRIDGE_LTS_URI;
+        mqtt_cfg->use_global_ca_store = true;
+    }
+    else
+    {
+        mqtt_cfg->uri = MQTT_BRIDGE_URI;
+    }
     mqtt_cfg->event_handle = gcp_mqtt_event_handler;
     mqtt_cfg->username = "unuser";
-    gcp_client->client_config->jwt_callback(gcp_client->client_config->device_identifiers->project_id, gcp_client->jwt_token_buffer);
     mqtt_cfg->password = gcp_client->jwt_token_buffer;
     mqtt_cfg->client_id = gcp_client->client_id;
     mqtt_cfg->user_context = gcp_client;
+    /* reconnects are driven by the backoff state machine */
+    mqtt_cfg->disable_auto_reconnect = true;
+    mqtt_cfg->task_stack = gcp_client->client_config->mqtt_task.stack_size;
+    mqtt_cfg->task_prio = gcp_client->client_config->mqtt_task.priority;
 }
 
 static esp_err_t mqtt_before_connect(esp_mqtt_event_handle_t event)
 {
     gcp_client_handle_t gcp_client = event->user_context;
-    if (strcmp("", gcp_client->jwt_token_buffer) == 0)
+    set_state(gcp_client, GCP_CLIENT_STATE_CONNECTING);
+    if (refresh_jwt(gcp_client))
     {
         esp_mqtt_client_config_t mqtt_cfg = {};
         create_mqtt_config(&mqtt_cfg, gcp_client);
@@ -113,6 +473,21 @@ static esp_err_t mqtt_before_connect(esp_mqtt_event_handle_t event)
     return ESP_OK;
 }
 
+static esp_err_t mqtt_error(esp_mqtt_event_handle_t event)
+{
+    gcp_client_handle_t gcp_client = event->user_context;
+    if (event->error_handle != NULL && event->error_handle->connect_return_code != 0)
+    {
+        ESP_LOGE(TAG, "MQTT_EVENT_ERROR: connection refused:%d, dropping cached token", event->error_handle->connect_return_code);
+        invalidate_jwt(gcp_client);
+    }
+    else
+    {
+        ESP_LOGE(TAG, "MQTT_EVENT_ERROR");
+    }
+    return ESP_OK;
+}
+
 static esp_err_t gcp_mqtt_event_handler(esp_mqtt_event_handle_t event)
 {
     esp_err_t result = ESP_OK;
@@ -134,13 +509,20 @@ static esp_err_t gcp_mqtt_event_handler(esp_mqtt_event_handle_t event)
         ESP_LOGD(TAG, "MQTT_EVENT_UNSUBSCRIBED: topic=%.*s", event->topic_len, event->topic);
         break;
     case MQTT_EVENT_PUBLISHED:
-        ESP_LOGD(TAG, "MQTT_EVENT_PUBLISHED: topic=%.*s", event->topic_len, event->topic);
+        result = mqtt_published(event);
         break;
+#ifdef MQTT_SUPPORTED_FEATURE_EVENT_DELETED
+    case MQTT_EVENT_DELETED:
+        /* expired in the outbox, it won't be acknowledged */
+        ESP_LOGW(TAG, "MQTT_EVENT_DELETED: MSG_ID=%d", event->msg_id);
+        unacked_update(event->user_context, event->msg_id, false);
+        break;
+#endif
     case MQTT_EVENT_DATA:
         result = mqtt_data_received(event);
         break;
     case MQTT_EVENT_ERROR:
-        ESP_LOGE(TAG, "MQTT_EVENT_ERROR");
+        result = mqtt_error(event);
         break;
     case MQTT_EVENT_ANY:
         ESP_LOGE(TAG, "MQTT_EVENT_ANY");
@@ -152,72 +534,164 @@ static esp_err_t gcp_mqtt_event_handler(esp_mqtt_event_handle_t event)
 static void gcp_mqtt_connect(gcp_client_handle_t gcp_client)
 {
     esp_mqtt_client_config_t mqtt_cfg = {};
+    refresh_jwt(gcp_client);
     create_mqtt_config(&mqtt_cfg, gcp_client);
     gcp_client->mqtt_client = esp_mqtt_client_init(&mqtt_cfg);
     ESP_ERROR_CHECK(esp_mqtt_client_start(gcp_client->mqtt_client));
 }
 
-static gcp_client_config_t *deep_copy_config(gcp_client_config_t *client_config)
+static gcp_client_config_t *deep_copy_config(gcp_client_handle_t client, gcp_client_config_t *client_config)
 {
-    gcp_client_config_t *config_copy = calloc(1, sizeof(gcp_client_config_t));
+    gcp_client_config_t *config_copy = &client->client_config_storage;
     config_copy->cmd_callback = client_config->cmd_callback;
     config_copy->config_callback = client_config->config_callback;
     config_copy->jwt_callback = client_config->jwt_callback;
     config_copy->connected_callback = client_config->connected_callback;
     config_copy->disconnected_callback = client_config->disconnected_callback;
-    config_copy->device_identifiers = calloc(1, sizeof(gcp_device_identifiers_t));
+    config_copy->device_identifiers = &client->device_identifiers_storage;
     config_copy->user_context = client_config->user_context;
+    config_copy->backoff = client_config->backoff;
+    config_copy->jwt_rtc_cache = client_config->jwt_rtc_cache;
+    config_copy->endpoint = client_config->endpoint;
+    config_copy->mqtt_task = client_config->mqtt_task;
     memcpy(config_copy->device_identifiers, client_config->device_identifiers, sizeof(gcp_device_identifiers_t));
     return config_copy;
 }
 
+static void init_backoff_config(gcp_client_backoff_config_t *backoff)
+{
+    if (backoff->initial_delay_ms == 0)
+    {
+        backoff->initial_delay_ms = GCP_MQTT_RETRY_INITIAL_MS;
+    }
+    if (backoff->max_delay_ms == 0)
+    {
+        backoff->max_delay_ms = GCP_MQTT_RETRY_PERIOD_MS;
+    }
+    if (backoff->fast_retry_delay_ms == 0)
+    {
+        backoff->fast_retry_delay_ms = GCP_MQTT_FAST_RETRY_MS;
+    }
+    if (backoff->stable_connection_ms == 0)
+    {
+        backoff->stable_connection_ms = GCP_MQTT_STABLE_CONNECTION_MS;
+    }
+}
+
 static void setup_topic_strings(gcp_client_handle_t client)
 {
-    asprintf(&client->topic_config, DEVICE_CONFIG_TOPIC_FORMAT, client->client_config->device_identifiers->device_id);
-    asprintf(&client->topic_cmd, DEVICE_COMMAND_TOPIC_FORMAT, client->client_config->device_identifiers->device_id);
-    asprintf(&client->topic_state, DEVICE_STATE_TOPIC_FORMAT, client->client_config->device_identifiers->device_id);
+    snprintf(client->topic_config, GCP_CLIENT_TOPIC_MAX_SIZE, DEVICE_CONFIG_TOPIC_FORMAT, client->client_config->device_identifiers->device_id);
+    snprintf(client->topic_cmd, GCP_CLIENT_TOPIC_MAX_SIZE, DEVICE_COMMAND_TOPIC_FORMAT, client->client_config->device_identifiers->device_id);
+    snprintf(client->topic_state, GCP_CLIENT_TOPIC_MAX_SIZE, DEVICE_STATE_TOPIC_FORMAT, client->client_config->device_identifiers->device_id);
 }
 
 esp_err_t gcp_client_destroy(gcp_client_handle_t client)
 {
+    client->state = GCP_CLIENT_STATE_STOPPED;
+    xTimerDelete(client->reconnect_timer, portMAX_DELAY);
     esp_mqtt_client_destroy(client->mqtt_client);
-    free(client->client_id);
-    free(client->client_config->device_identifiers);
-    free(client->client_config);
-    free(client);
+    if (!client->static_storage)
+    {
+        gcp_mem_free(client);
+    }
     client = NULL;
     return ESP_OK;
 }
 
-gcp_client_handle_t gcp_client_init(gcp_client_config_t *client_config)
+static gcp_client_handle_t init_client(gcp_client_handle_t new_client, gcp_client_config_t *client_config)
 {
-    gcp_client_handle_t new_client = calloc(1, sizeof(*new_client));
-    new_client->client_config = deep_copy_config(client_config);
-    asprintf(&new_client->client_id, MQTT_CLIENT_ID_FORMAT, client_config->device_identifiers->project_id, client_config->device_identifiers->region, client_config->device_identifiers->registery, client_config->device_identifiers->device_id);
+    new_client->client_config = deep_copy_config(new_client, client_config);
+    new_client->unacked_lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+    init_backoff_config(&new_client->client_config->backoff);
+    new_client->reconnect_timer = xTimerCreateStatic("gcp_reconnect", 1, pdFALSE, new_client, reconnect_timer_callback, &new_client->reconnect_timer_buffer);
+    snprintf(new_client->client_id, GCP_CLIENT_ID_MAX_SIZE, MQTT_CLIENT_ID_FORMAT, client_config->device_identifiers->project_id, client_config->device_identifiers->region, client_config->device_identifiers->registery, client_config->device_identifiers->device_id);
     setup_topic_strings(new_client);
+    if (new_client->client_config->jwt_rtc_cache)
+    {
+        load_jwt_from_rtc(new_client);
+    }
     return new_client;
 }
 
+gcp_client_handle_t gcp_client_init(gcp_client_config_t *client_config)
+{
+    gcp_client_handle_t new_client = gcp_mem_calloc(GCP_MEM_CLIENT, 1, sizeof(*new_client));
+    if (new_client == NULL)
+    {
+        return NULL;
+    }
+    return init_client(new_client, client_config);
+}
+
+gcp_client_handle_t gcp_client_init_static(gcp_client_config_t *client_config, gcp_client_static_storage_t *storage)
+{
+    gcp_client_handle_t new_client = (gcp_client_handle_t)storage;
+    memset(new_client, 0, sizeof(*new_client));
+    new_client->static_storage = true;
+    return init_client(new_client, client_config);
+}
+
 esp_err_t gcp_client_start(gcp_client_handle_t client)
 {
     ESP_LOGD(TAG, "[gcp_client_start] starting gcp client for device %s", client->client_config->device_identifiers->device_id);
     assert(client != NULL);
+    set_state(client, GCP_CLIENT_STATE_CONNECTING);
     gcp_mqtt_connect(client);
     return ESP_OK;
 }
 
+/*
+ * QoS 1 publishes get a msg_id and a MQTT_EVENT_PUBLISHED once the PUBACK arrives. One publish at a time is timed for the
+ * round trip, a probe whose PUBACK was lost or came before its msg_id was stored is replaced after GCP_CLIENT_RTT_PROBE_TIMEOUT_MS.
+ */
+static esp_err_t published(gcp_client_handle_t client, int msg_id, int64_t sent_us)
+{
+    if (msg_id <= 0)
+    {
+        return ESP_FAIL;
+    }
+    unacked_update(client, msg_id, true);
+    if (client->rtt_msg_id == 0 || (sent_us - client->rtt_sent_us) / 1000 > GCP_CLIENT_RTT_PROBE_TIMEOUT_MS)
+    {
+        client->rtt_sent_us = sent_us;
+        client->rtt_msg_id = msg_id;
+    }
+    return ESP_OK;
+}
+
 esp_err_t gcp_send_state(gcp_client_handle_t client, const char *state)
 {
+    int64_t sent_us = esp_timer_get_time();
     esp_err_t result = esp_mqtt_client_publish(client->mqtt_client, client->topic_state, state, 0, 1, 1);
-    return result > 0 ? ESP_OK : ESP_FAIL;
+    return published(client, result, sent_us);
 }
 
 esp_err_t gcp_send_telemetry(gcp_client_handle_t client, const char *topic, const char *msg)
 {
-    char *device_topic;
-    asprintf(&device_topic, DEVICE_TELEMETRY_TOPIC_FORMAT, client->client_config->device_identifiers->device_id, topic);
+    char device_topic[GCP_CLIENT_TOPIC_MAX_SIZE];
+    if (snprintf(device_topic, sizeof(device_topic), DEVICE_TELEMETRY_TOPIC_FORMAT, client->client_config->device_identifiers->device_id, topic) >= sizeof(device_topic))
+    {
+        ESP_LOGE(TAG, "[gcp_send_telemetry] topic is too long:%s", topic);
+        return ESP_ERR_INVALID_SIZE;
+    }
     ESP_LOGI(TAG, "[gcp_send_telemetry] topic:%s, msg:%s", device_topic, msg);
+    int64_t sent_us = esp_timer_get_time();
     esp_err_t result = esp_mqtt_client_publish(client->mqtt_client, device_topic, msg, 0, 1, 1);
-    free(device_topic);
-    return result > 0 ? ESP_OK : ESP_FAIL;
+    return published(client, result, sent_us);
+}
+
+esp_err_t gcp_client_get_stats(gcp_client_handle_t client, gcp_client_stats_t *stats)
+{
+    stats->state = client->state;
+    stats->time_in_state_ms = (esp_timer_get_time() - client->state_entered_us) / 1000;
+    stats->reconnect_count = client->reconnect_count;
+    stats->failed_attempts = client->failed_attempts;
+    stats->next_retry_delay_ms = client->next_retry_delay_ms;
+    stats->last_connect_latency_ms = client->last_connect_latency_ms;
+    stats->last_offline_ms = client->last_offline_ms;
+    stats->last_jwt_ms = client->last_jwt_ms;
+    stats->mqtt_stack_free = client->mqtt_task != NULL ? uxTaskGetStackHighWaterMark(client->mqtt_task) : 0;
+    stats->unacked_publishes = unacked_count(client);
+    stats->last_rtt_ms = client->last_rtt_ms;
+    return ESP_OK;
 }
\ No newline at end of file
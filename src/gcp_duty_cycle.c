@@ -0,0 +1,201 @@
+#include "gcp_app.h"
+#include "gcp_app_internal.h"
+#include "device_data.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "freertos/event_groups.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_attr.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include <stdio.h>
+#include <string.h>
+
+#define TAG "GCP_DUTY_CYCLE"
+
+#define GCP_DUTY_CYCLE_RTC_MAGIC 0x44435931
+#define GCP_DUTY_CYCLE_CONFIG_CACHE_SIZE 256
+#define GCP_DUTY_CYCLE_DEFAULT_SLEEP_PERIOD_MS (15 * 60 * 1000)
+#define GCP_DUTY_CYCLE_DEFAULT_CONNECT_TIMEOUT_MS 20000
+#define GCP_DUTY_CYCLE_DEFAULT_ACK_TIMEOUT_MS 5000
+#define GCP_DUTY_CYCLE_DEFAULT_CONFIG_WAIT_MS 2000
+#define GCP_DUTY_CYCLE_MIN_SLEEP_MS 1000
+#define GCP_DUTY_CYCLE_ACK_POLL_MS 10
+
+#define JSON_KEY_DEVICE_FIRMWARE "firmware"
+#define JSON_KEY_DEVICE_CONFIG_JOBS "jobs"
+
+/* milliseconds since the app started, the bootloader isn't included */
+typedef struct
+{
+    uint32_t connect_ms; /* wake to MQTT connected */
+    uint32_t publish_ms; /* running the jobs */
+    uint32_t ack_ms;     /* waiting for PUBACKs */
+    uint32_t config_ms;  /* waiting for the cloud config */
+    uint32_t awake_ms;   /* wake to deep sleep */
+} gcp_duty_cycle_phases_t;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t cycles;
+    uint32_t missed_cycles; /* cycles that went back to sleep without connecting */
+    gcp_duty_cycle_phases_t last;
+    char device_config[GCP_DUTY_CYCLE_CONFIG_CACHE_SIZE]; /* applied before connecting, firmware and jobs are left out */
+} gcp_duty_cycle_rtc_t;
+
+static RTC_DATA_ATTR gcp_duty_cycle_rtc_t duty_cycle_rtc;
+
+static uint32_t elapsed_ms(int64_t since_us)
+{
+    return (esp_timer_get_time() - since_us) / 1000;
+}
+
+void gcp_duty_cycle_init(gcp_app_handle_t app)
+{
+    gcp_app_duty_cycle_config_t *duty_cycle = &app->app_config->duty_cycle;
+    if (duty_cycle->sleep_period_ms == 0)
+    {
+        duty_cycle->sleep_period_ms = GCP_DUTY_CYCLE_DEFAULT_SLEEP_PERIOD_MS;
+    }
+    if (duty_cycle->connect_timeout_ms == 0)
+    {
+        duty_cycle->connect_timeout_ms = GCP_DUTY_CYCLE_DEFAULT_CONNECT_TIMEOUT_MS;
+    }
+    if (duty_cycle->ack_timeout_ms == 0)
+    {
+        duty_cycle->ack_timeout_ms = GCP_DUTY_CYCLE_DEFAULT_ACK_TIMEOUT_MS;
+    }
+    if (duty_cycle->config_wait_ms == 0)
+    {
+        duty_cycle->config_wait_ms = GCP_DUTY_CYCLE_DEFAULT_CONFIG_WAIT_MS;
+    }
+    if (duty_cycle_rtc.magic != GCP_DUTY_CYCLE_RTC_MAGIC)
+    {
+        memset(&duty_cycle_rtc, 0, sizeof(duty_cycle_rtc));
+        duty_cycle_rtc.magic = GCP_DUTY_CYCLE_RTC_MAGIC;
+        return;
+    }
+    cJSON *device_config = cJSON_Parse(duty_cycle_rtc.device_config);
+    if (device_config != NULL)
+    {
+        ESP_LOGD(TAG, "[gcp_duty_cycle_init] applying cached device_config");
+        gcp_app_device_config_received(app, device_config);
+        cJSON_Delete(device_config);
+    }
+}
+
+void gcp_duty_cycle_config_received(gcp_app_handle_t app, cJSON *device_config)
+{
+    if (!cJSON_IsObject(device_config))
+    {
+        return;
+    }
+    cJSON *cached = cJSON_Duplicate(device_config, true);
+    cJSON_DeleteItemFromObject(cached, JSON_KEY_DEVICE_FIRMWARE);
+    cJSON_DeleteItemFromObject(cached, JSON_KEY_DEVICE_CONFIG_JOBS);
+    if (!cJSON_PrintPreallocated(cached, duty_cycle_rtc.device_config, sizeof(duty_cycle_rtc.device_config), false))
+    {
+        ESP_LOGW(TAG, "[gcp_duty_cycle_config_received] device_config doesn't fit in %d bytes of RTC memory", GCP_DUTY_CYCLE_CONFIG_CACHE_SIZE);
+        duty_cycle_rtc.device_config[0] = '\0';
+    }
+    cJSON_Delete(cached);
+}
+
+/* cycle counters and the phases of the previous cycle, appended to the pulse */
+int gcp_duty_cycle_print(gcp_app_handle_t app, char *buffer, size_t size)
+{
+    gcp_duty_cycle_phases_t *last = &duty_cycle_rtc.last;
+    return snprintf(buffer, size, ",\"cycle\":%u,\"missed\":%u,\"wake_ms\":[%u,%u,%u,%u,%u]",
+                    duty_cycle_rtc.cycles, duty_cycle_rtc.missed_cycles,
+                    last->connect_ms, last->publish_ms, last->ack_ms, last->config_ms, last->awake_ms);
+}
+
+static void wait_for_acks(gcp_app_handle_t app)
+{
+    int64_t start = esp_timer_get_time();
+    for (;;)
+    {
+        gcp_client_stats_t stats = {0};
+        gcp_client_get_stats(app->gcp_client, &stats);
+        if (stats.unacked_publishes == 0)
+        {
+            return;
+        }
+        if (elapsed_ms(start) >= app->app_config->duty_cycle.ack_timeout_ms)
+        {
+            ESP_LOGW(TAG, "[wait_for_acks] %d publishes not acknowledged", stats.unacked_publishes);
+            return;
+        }
+        vTaskDelay(GCP_DUTY_CYCLE_ACK_POLL_MS / portTICK_PERIOD_MS);
+    }
+}
+
+static void enter_deep_sleep(gcp_app_handle_t app)
+{
+    gcp_app_duty_cycle_config_t *duty_cycle = &app->app_config->duty_cycle;
+    if (duty_cycle->sleep_callback != NULL)
+    {
+        duty_cycle->sleep_callback(app, app->app_config->user_context);
+    }
+    /* deep sleep skips the shutdown handlers */
+    gcp_nvs_flush();
+    uint32_t awake_ms = elapsed_ms(0);
+    duty_cycle_rtc.last.awake_ms = awake_ms;
+    duty_cycle_rtc.cycles++;
+    /* the period is wake to wake, the time spent awake is taken out of the sleep */
+    uint32_t sleep_ms = duty_cycle->sleep_period_ms > awake_ms + GCP_DUTY_CYCLE_MIN_SLEEP_MS ? duty_cycle->sleep_period_ms - awake_ms : GCP_DUTY_CYCLE_MIN_SLEEP_MS;
+    ESP_LOGI(TAG, "[enter_deep_sleep] awake:%d ms, sleeping:%d ms", awake_ms, sleep_ms);
+    esp_sleep_enable_timer_wakeup((uint64_t)sleep_ms * 1000);
+    esp_deep_sleep_start();
+}
+
+/* runs on the app task instead of the scheduler loop, it only returns when the app is destroyed before going to sleep */
+void gcp_duty_cycle_run(gcp_app_handle_t app)
+{
+    gcp_app_duty_cycle_config_t *duty_cycle = &app->app_config->duty_cycle;
+    gcp_duty_cycle_phases_t phases = {0};
+    EventBits_t bits = xEventGroupWaitBits(app->app_event_group, GCP_EVENT_CONNECTED_BIT | GCP_EVENT_APP_TASK_END_BIT, false, false, duty_cycle->connect_timeout_ms / portTICK_PERIOD_MS);
+    if (bits & GCP_EVENT_APP_TASK_END_BIT)
+    {
+        return;
+    }
+    if (bits & GCP_EVENT_CONNECTED_BIT)
+    {
+        int64_t connected_us = esp_timer_get_time();
+        phases.connect_ms = elapsed_ms(0);
+
+        gcp_scheduler_run_all(app);
+        phases.publish_ms = elapsed_ms(connected_us);
+
+        int64_t ack_start_us = esp_timer_get_time();
+        wait_for_acks(app);
+        phases.ack_ms = elapsed_ms(ack_start_us);
+
+        /* the bridge sends the config right after the subscription, it usually arrived while publishing */
+        int64_t config_start_us = esp_timer_get_time();
+        uint32_t since_connected_ms = elapsed_ms(connected_us);
+        TickType_t config_wait = since_connected_ms < duty_cycle->config_wait_ms ? (duty_cycle->config_wait_ms - since_connected_ms) / portTICK_PERIOD_MS : 0;
+        gcp_ota_health_t health;
+        gcp_ota_get_health(&health);
+        if (health.state == GCP_OTA_HEALTH_PENDING)
+        {
+            /* waking from deep sleep goes through the bootloader, it rolls back a firmware that is still pending */
+            config_wait = portMAX_DELAY;
+        }
+        xEventGroupWaitBits(app->app_event_group, GCP_EVENT_CONFIG_RECEIVED_BIT, false, false, config_wait);
+        phases.config_ms = elapsed_ms(config_start_us);
+    }
+    else
+    {
+        ESP_LOGW(TAG, "[gcp_duty_cycle_run] not connected in %d ms", duty_cycle->connect_timeout_ms);
+        duty_cycle_rtc.missed_cycles++;
+    }
+    duty_cycle_rtc.last = phases;
+    if (xEventGroupGetBits(app->app_event_group) & GCP_EVENT_APP_TASK_END_BIT)
+    {
+        return;
+    }
+    enter_deep_sleep(app);
+}
@@ -1,4 +1,5 @@
 #include "gcp_jwt.h"
+#include "gcp_mem.h"
 #include <mbedtls/pk.h>
 #include <mbedtls/error.h>
 #include <mbedtls/entropy.h>
@@ -45,23 +46,23 @@ char *create_GCP_JWT(const char *projectId, const char *privateKey, size_t priva
     uint32_t exp = iat + 60 * 60 * 24; // Set the expiry time.
 
     char *payload;
-    asprintf(&payload, "{\"iat\":%d,\"exp\":%d,\"aud\":\"%s\"}", iat, exp, projectId);
+    gcp_mem_asprintf(GCP_MEM_JWT, &payload, "{\"iat\":%d,\"exp\":%d,\"aud\":\"%s\"}", iat, exp, projectId);
     ESP_LOGD(TAG, "[create_GCP_JWT] payload: %s", payload);
 
     unsigned char *base64Payload;
     size_t base_64_payload_size;
     mbedtls_base64_encode(NULL, 0, &base_64_payload_size, (const unsigned char *)payload, strlen((char *)payload));
-    base64Payload = calloc(base_64_payload_size, sizeof(*base64Payload));
+    base64Payload = gcp_mem_calloc(GCP_MEM_JWT, base_64_payload_size, sizeof(*base64Payload));
     mbedtls_base64_encode(base64Payload, base_64_payload_size, &base_64_payload_size, (const unsigned char *)payload, strlen((char *)payload));
     ESP_LOGD(TAG, "[create_GCP_JWT] base64 payload: %s", base64Payload);
 
-    free(payload);
+    gcp_mem_free(payload);
 
     char *headerAndPayload;
-    asprintf(&headerAndPayload, "%s.%s", JWT_BASE_64_HEADER, base64Payload);
+    gcp_mem_asprintf(GCP_MEM_JWT, &headerAndPayload, "%s.%s", JWT_BASE_64_HEADER, base64Payload);
     ESP_LOGD(TAG, "[create_GCP_JWT] headerAndPayload: %s", headerAndPayload);
 
-    free(base64Payload);
+    gcp_mem_free(base64Payload);
 
     // At this point we have created the header and payload parts, converted both to base64 and concatenated them
     // together as a single string.  Now we need to sign them using RSASSA
@@ -70,6 +71,7 @@ char *create_GCP_JWT(const char *projectId, const char *privateKey, size_t priva
     if (rc != 0)
     {
         ESP_LOGE(TAG, "Failed to mbedtls_md: %d (-0x%x): %s\n", rc, -rc, mbedtlsError(rc));
+        gcp_mem_free(headerAndPayload);
         return NULL;
     }
 
@@ -96,13 +98,14 @@ char *create_GCP_JWT(const char *projectId, const char *privateKey, size_t priva
     unsigned char *base64Signature;
     size_t base_64_signature_size;
     mbedtls_base64_encode(NULL, 0, &base_64_signature_size, oBuf, retSize);
-    base64Signature = calloc(base_64_signature_size, sizeof(*base64Signature));
+    base64Signature = gcp_mem_calloc(GCP_MEM_JWT, base_64_signature_size, sizeof(*base64Signature));
     mbedtls_base64_encode(base64Signature, base_64_signature_size, &base_64_signature_size, oBuf, retSize);
 
+    /* returned token is released by the caller with free */
     char *retData;
     asprintf(&retData, "%s.%s", headerAndPayload, base64Signature);
-    free(headerAndPayload);
-    free(base64Signature);
+    gcp_mem_free(headerAndPayload);
+    gcp_mem_free(base64Signature);
     ESP_LOGD(TAG, "[create_GCP_JWT] jwt: %s", retData);
     return retData;
 }
\ No newline at end of file
@@ -0,0 +1,81 @@
+#include "gcp_app.h"
+#include "gcp_app_internal.h"
+#include "esp_wifi.h"
+#include "esp_log.h"
+#include <stdlib.h>
+
+#define TAG "GCP_LINK"
+
+#define JOB_NAME_LINK "link"
+#define GCP_LINK_DEFAULT_SAMPLE_PERIOD_MS 30000
+#define GCP_LINK_DEFAULT_RSSI_DEADBAND 5
+#define GCP_LINK_DEFAULT_RTT_DEADBAND_MS 100
+
+static const char *phy_name(const wifi_ap_record_t *ap_info)
+{
+    if (ap_info->phy_lr)
+    {
+        return "lr";
+    }
+    if (ap_info->phy_11n)
+    {
+        return "11n";
+    }
+    if (ap_info->phy_11g)
+    {
+        return "11g";
+    }
+    return ap_info->phy_11b ? "11b" : "unknown";
+}
+
+/* channel, PHY mode and association changes are always reported, RSSI and round trip only past their deadbands */
+bool gcp_link_apply_deadband(gcp_link_sample_t *reported, const gcp_link_sample_t *sample, const gcp_app_link_config_t *config)
+{
+    bool changed = reported->associated != sample->associated || reported->channel != sample->channel || reported->phy != sample->phy ||
+                   abs(reported->rssi - sample->rssi) >= config->rssi_deadband ||
+                   labs((long)reported->rtt_ms - (long)sample->rtt_ms) >= config->rtt_deadband_ms;
+    if (changed)
+    {
+        *reported = *sample;
+    }
+    return changed;
+}
+
+static void link_job(gcp_app_handle_t app, void *job_context)
+{
+    gcp_link_sample_t sample = {0};
+    wifi_ap_record_t ap_info;
+    if (esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK)
+    {
+        sample.associated = true;
+        sample.rssi = ap_info.rssi;
+        sample.channel = ap_info.primary;
+        sample.phy = phy_name(&ap_info);
+    }
+    gcp_client_stats_t stats = {0};
+    gcp_client_get_stats(app->gcp_client, &stats);
+    sample.rtt_ms = stats.last_rtt_ms;
+    if (gcp_link_apply_deadband(&app->link, &sample, &app->app_config->link_quality))
+    {
+        ESP_LOGD(TAG, "[link_job] rssi:%d, channel:%d, phy:%s, rtt:%u ms", sample.rssi, sample.channel, sample.phy != NULL ? sample.phy : "-", sample.rtt_ms);
+    }
+}
+
+void gcp_link_init(gcp_app_handle_t app)
+{
+    gcp_app_link_config_t *config = &app->app_config->link_quality;
+    if (config->sample_period_ms == 0)
+    {
+        config->sample_period_ms = GCP_LINK_DEFAULT_SAMPLE_PERIOD_MS;
+    }
+    if (config->rssi_deadband == 0)
+    {
+        config->rssi_deadband = GCP_LINK_DEFAULT_RSSI_DEADBAND;
+    }
+    if (config->rtt_deadband_ms == 0)
+    {
+        config->rtt_deadband_ms = GCP_LINK_DEFAULT_RTT_DEADBAND_MS;
+    }
+    /* sampling doesn't need the connection or the radio, it runs while offline too */
+    gcp_scheduler_add(app, JOB_NAME_LINK, config->sample_period_ms, 0, GCP_JOB_INTERNAL, &link_job, NULL);
+}
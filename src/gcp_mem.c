@@ -0,0 +1,132 @@
+#include "gcp_mem.h"
+#include <freertos/FreeRTOS.h>
+#include "esp_log.h"
+#include "cJSON.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TAG "GCP_MEM"
+
+/* 8 bytes keeps the payload aligned like a plain malloc */
+typedef union
+{
+    struct
+    {
+        uint32_t size;
+        uint8_t module;
+    } info;
+    uint64_t align;
+} gcp_mem_header_t;
+
+static gcp_mem_stats_t mem_stats[GCP_MEM_MODULE_MAX];
+static portMUX_TYPE mem_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *module_names[GCP_MEM_MODULE_MAX] = {"app", "client", "jwt", "ota", "nvs", "json"};
+
+static void account_alloc(gcp_mem_module_t module, size_t size)
+{
+    portENTER_CRITICAL(&mem_stats_lock);
+    gcp_mem_stats_t *stats = &mem_stats[module];
+    stats->current_bytes += size;
+    if (stats->current_bytes > stats->peak_bytes)
+    {
+        stats->peak_bytes = stats->current_bytes;
+    }
+    stats->live_allocs++;
+    stats->total_allocs++;
+    portEXIT_CRITICAL(&mem_stats_lock);
+}
+
+static void account_free(gcp_mem_module_t module, size_t size)
+{
+    portENTER_CRITICAL(&mem_stats_lock);
+    mem_stats[module].current_bytes -= size;
+    mem_stats[module].live_allocs--;
+    portEXIT_CRITICAL(&mem_stats_lock);
+}
+
+void *gcp_mem_malloc(gcp_mem_module_t module, size_t size)
+{
+    gcp_mem_header_t *header = malloc(sizeof(gcp_mem_header_t) + size);
+    if (header == NULL)
+    {
+        ESP_LOGE(TAG, "[gcp_mem_malloc] %s failed to allocate %d bytes", module_names[module], size);
+        return NULL;
+    }
+    header->info.size = size;
+    header->info.module = module;
+    account_alloc(module, size);
+    return header + 1;
+}
+
+void *gcp_mem_calloc(gcp_mem_module_t module, size_t count, size_t size)
+{
+    void *ptr = gcp_mem_malloc(module, count * size);
+    if (ptr != NULL)
+    {
+        memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+
+int gcp_mem_vasprintf(gcp_mem_module_t module, char **str, const char *format, va_list argptr)
+{
+    va_list argptr_copy;
+    va_copy(argptr_copy, argptr);
+    int len = vsnprintf(NULL, 0, format, argptr_copy);
+    va_end(argptr_copy);
+    *str = gcp_mem_malloc(module, len + 1);
+    if (*str == NULL)
+    {
+        return -1;
+    }
+    vsnprintf(*str, len + 1, format, argptr);
+    return len;
+}
+
+int gcp_mem_asprintf(gcp_mem_module_t module, char **str, const char *format, ...)
+{
+    va_list argptr;
+    va_start(argptr, format);
+    int len = gcp_mem_vasprintf(module, str, format, argptr);
+    va_end(argptr);
+    return len;
+}
+
+void gcp_mem_free(void *ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+    gcp_mem_header_t *header = (gcp_mem_header_t *)ptr - 1;
+    account_free(header->info.module, header->info.size);
+    free(header);
+}
+
+void gcp_mem_get_stats(gcp_mem_module_t module, gcp_mem_stats_t *stats)
+{
+    portENTER_CRITICAL(&mem_stats_lock);
+    *stats = mem_stats[module];
+    portEXIT_CRITICAL(&mem_stats_lock);
+}
+
+const char *gcp_mem_module_name(gcp_mem_module_t module)
+{
+    return module < GCP_MEM_MODULE_MAX ? module_names[module] : "unknown";
+}
+
+static void *cjson_malloc(size_t size)
+{
+    return gcp_mem_malloc(GCP_MEM_JSON, size);
+}
+
+void gcp_mem_track_cjson(void)
+{
+    cJSON_Hooks hooks = {
+        .malloc_fn = cjson_malloc,
+        .free_fn = gcp_mem_free};
+    cJSON_InitHooks(&hooks);
+}
@@ -1,13 +1,157 @@
 #include "gcp_ota.h"
+#include "gcp_ota_internal.h"
 #include <freertos/FreeRTOS.h>
-#include <freertos/Task.h>
-#include "esp_https_ota.h"
+#include <freertos/task.h>
+#include "esp_http_client.h"
 #include "esp_ota_ops.h"
 #include "esp_log.h"
+#include "esp_system.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
 #include "string.h"
+#include <strings.h>
+#include <stdio.h>
+#include <ctype.h>
+#include "gcp_mem.h"
 
 #define TAG "GCP_OTA"
 
+#define GCP_OTA_MAX_RETRIES 8
+#define GCP_OTA_RETRY_INITIAL_DELAY_MS 1000
+#define GCP_OTA_RETRY_MAX_DELAY_MS 30000
+#define GCP_OTA_LAST_UPDATE_MAGIC 0x4f544131
+
+typedef struct
+{
+    uint32_t magic;
+    char version[32]; /* version the update installed */
+    gcp_ota_result_t result;
+} gcp_ota_last_update_t;
+
+static RTC_NOINIT_ATTR gcp_ota_last_update_t last_update;
+
+/* the request with its own copies of the strings, the config they come from is freed when the callback returns */
+typedef struct
+{
+    gcp_ota_request_t request;
+    char *url;
+    char *patch_url;
+    char *patch_base_version;
+    char *sha256;
+} gcp_ota_task_args_t;
+
+static gcp_ota_progress_t ota_progress;
+static bool ota_running;
+static portMUX_TYPE ota_lock = portMUX_INITIALIZER_UNLOCKED;
+
+const char *gcp_ota_compression_name(gcp_ota_compression_t compression)
+{
+    switch (compression)
+    {
+    case GCP_OTA_COMPRESSION_NONE:
+        return "none";
+    case GCP_OTA_COMPRESSION_GZIP:
+        return "gzip";
+    case GCP_OTA_COMPRESSION_ZLIB:
+        return "zlib";
+    }
+    return "unknown";
+}
+
+gcp_ota_compression_t gcp_ota_compression_from_name(const char *name)
+{
+    if (name != NULL && strcmp(name, "gzip") == 0)
+    {
+        return GCP_OTA_COMPRESSION_GZIP;
+    }
+    if (name != NULL && strcmp(name, "zlib") == 0)
+    {
+        return GCP_OTA_COMPRESSION_ZLIB;
+    }
+    return GCP_OTA_COMPRESSION_NONE;
+}
+
+const char *gcp_ota_phase_name(gcp_ota_phase_t phase)
+{
+    switch (phase)
+    {
+    case GCP_OTA_PHASE_IDLE:
+        return "idle";
+    case GCP_OTA_PHASE_CONNECTING:
+        return "connecting";
+    case GCP_OTA_PHASE_DOWNLOADING:
+        return "downloading";
+    case GCP_OTA_PHASE_VERIFYING:
+        return "verifying";
+    case GCP_OTA_PHASE_REBOOTING:
+        return "rebooting";
+    case GCP_OTA_PHASE_FAILED:
+        return "failed";
+    }
+    return "unknown";
+}
+
+void gcp_ota_set_phase(gcp_ota_phase_t phase, esp_err_t err)
+{
+    portENTER_CRITICAL(&ota_lock);
+    ota_progress.phase = phase;
+    ota_progress.last_error = err;
+    portEXIT_CRITICAL(&ota_lock);
+    ESP_LOGI(TAG, "[gcp_ota_set_phase] %s", gcp_ota_phase_name(phase));
+}
+
+void gcp_ota_update_progress(gcp_ota_session_t *session)
+{
+    int64_t elapsed_us = esp_timer_get_time() - session->start_us;
+    portENTER_CRITICAL(&ota_lock);
+    ota_progress.bytes_read = session->written;
+    ota_progress.download_size = session->download_size;
+    ota_progress.percent = session->download_size > 0 ? (uint64_t)session->offset * 100 / session->download_size : 0;
+    ota_progress.bytes_per_sec = elapsed_us > 0 ? (uint64_t)session->transferred * 1000000 / elapsed_us : 0;
+    ota_progress.bytes_transferred = session->transferred;
+    ota_progress.retries = session->retries;
+    ota_progress.flash_ms = session->flash_us / 1000;
+    ota_progress.net_ms = session->net_us / 1000;
+    portEXIT_CRITICAL(&ota_lock);
+}
+
+/* kept in RTC memory that survives esp_restart so the new firmware can report what its update cost */
+static void save_last_update(gcp_ota_session_t *session)
+{
+    last_update.magic = GCP_OTA_LAST_UPDATE_MAGIC;
+    memcpy(last_update.version, session->version, sizeof(last_update.version));
+    last_update.result.image_size = session->written;
+    last_update.result.download_size = session->offset;
+    last_update.result.bytes_transferred = session->transferred;
+    last_update.result.compression = session->patch ? GCP_OTA_COMPRESSION_NONE : session->request->compression;
+    last_update.result.delta = session->patch;
+    last_update.result.retries = session->retries;
+    int64_t duration_us = esp_timer_get_time() - session->start_us;
+    last_update.result.duration_ms = duration_us / 1000;
+    last_update.result.bytes_per_sec = duration_us > 0 ? (uint64_t)session->transferred * 1000000 / duration_us : 0;
+    last_update.result.flash_ms = session->flash_us / 1000;
+    last_update.result.net_ms = session->net_us / 1000;
+}
+
+esp_err_t gcp_ota_get_last_update(gcp_ota_result_t *result)
+{
+    char version[32] = {0};
+    gcp_ota_get_running_app_version(version);
+    if (last_update.magic != GCP_OTA_LAST_UPDATE_MAGIC || strncmp(version, last_update.version, sizeof(last_update.version)) != 0)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    *result = last_update.result;
+    return ESP_OK;
+}
+
+void gcp_ota_get_progress(gcp_ota_progress_t *progress)
+{
+    portENTER_CRITICAL(&ota_lock);
+    *progress = ota_progress;
+    portEXIT_CRITICAL(&ota_lock);
+}
+
 void gcp_ota_get_running_app_version(char *version)
 {
     const esp_partition_t *partition = esp_ota_get_running_partition();
@@ -18,11 +162,15 @@ void gcp_ota_get_running_app_version(char *version)
     }
 }
 
-static esp_err_t validate_image_header(esp_app_desc_t *new_app_info)
+/* esp_app_desc_t follows the image header and the first segment header */
+static esp_err_t validate_image_header(gcp_ota_session_t *session)
 {
-    if (new_app_info == NULL)
+    esp_app_desc_t new_app_info;
+    memcpy(&new_app_info, session->header + sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t), sizeof(esp_app_desc_t));
+    if (new_app_info.magic_word != ESP_APP_DESC_MAGIC_WORD)
     {
-        return ESP_ERR_INVALID_ARG;
+        ESP_LOGE(TAG, "[validate_image_header] not an application image");
+        return ESP_ERR_INVALID_RESPONSE;
     }
 
     const esp_partition_t *running = esp_ota_get_running_partition();
@@ -32,80 +180,553 @@ static esp_err_t validate_image_header(esp_app_desc_t *new_app_info)
         ESP_LOGI(TAG, "Running firmware version: %s", running_app_info.version);
     }
 
-    ESP_LOGI(TAG, "New firmware version: %s", new_app_info->version);
+    ESP_LOGI(TAG, "New firmware version: %s", new_app_info.version);
+    memcpy(session->version, new_app_info.version, sizeof(session->version));
+    return ESP_OK;
+}
+
+static esp_err_t flash_write(gcp_ota_session_t *session, const char *data, size_t size)
+{
+    int64_t start_us = esp_timer_get_time();
+    esp_err_t err = esp_ota_write(session->ota_handle, data, size);
+    session->flash_us += esp_timer_get_time() - start_us;
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "[flash_write] esp_ota_write failed: %s", esp_err_to_name(err));
+        session->fatal = true;
+    }
+    return err;
+}
+
+static esp_err_t flush_image(gcp_ota_session_t *session)
+{
+    if (session->write_buffered == 0)
+    {
+        return ESP_OK;
+    }
+    esp_err_t err = flash_write(session, session->write_buffer, session->write_buffered);
+    session->write_buffered = 0;
+    return err;
+}
+
+/*
+ * The header is collected from the first writes, they can be smaller than it when they come out of a decoder.
+ * Writes are gathered into write_batch_size chunks, esp_ota_write erases a sector at a time and small writes cost a call each.
+ */
+esp_err_t gcp_ota_write_image(gcp_ota_session_t *session, const char *data, size_t size)
+{
+    if (session->written < GCP_OTA_IMAGE_HEADER_SIZE)
+    {
+        size_t header_bytes = GCP_OTA_IMAGE_HEADER_SIZE - session->written < size ? GCP_OTA_IMAGE_HEADER_SIZE - session->written : size;
+        memcpy(session->header + session->written, data, header_bytes);
+        if (session->written + header_bytes == GCP_OTA_IMAGE_HEADER_SIZE && validate_image_header(session) != ESP_OK)
+        {
+            session->fatal = true;
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+    }
+    if (session->request->size > 0 && session->written + size > session->request->size)
+    {
+        ESP_LOGE(TAG, "[gcp_ota_write_image] image is larger than %u bytes", session->request->size);
+        session->fatal = true;
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (session->check_sha256)
+    {
+        mbedtls_sha256_update_ret(&session->sha256, (const unsigned char *)data, size);
+    }
+    session->written += size;
+    if (session->write_buffer == NULL)
+    {
+        return flash_write(session, data, size);
+    }
+    while (size > 0)
+    {
+        size_t space = session->transfer.write_batch_size - session->write_buffered;
+        size_t chunk = size < space ? size : space;
+        memcpy(session->write_buffer + session->write_buffered, data, chunk);
+        session->write_buffered += chunk;
+        data += chunk;
+        size -= chunk;
+        if (session->write_buffered == session->transfer.write_batch_size)
+        {
+            esp_err_t err = flush_image(session);
+            if (err != ESP_OK)
+            {
+                return err;
+            }
+        }
+    }
+    return ESP_OK;
+}
 
+/* a failed attempt resumes with a Range request from the first byte the sink didn't consume yet */
+/* response headers are only seen from the event handler */
+static esp_err_t http_event_handler(esp_http_client_event_t *event)
+{
+    gcp_ota_session_t *session = event->user_data;
+    unsigned int start;
+    if (event->event_id == HTTP_EVENT_ON_HEADER && strcasecmp(event->header_key, "Content-Range") == 0 && sscanf(event->header_value, "bytes %u-", &start) == 1)
+    {
+        session->range_start = start;
+    }
     return ESP_OK;
 }
 
-void gcp_ota_update_firmware(char *firmware_url, const char *cert_pem)
+static esp_err_t download_range(gcp_ota_session_t *session)
 {
-    ESP_LOGI(TAG, "[ota_update_firmware] target url: %s", firmware_url);
-    esp_err_t ota_finish_err = ESP_OK;
     esp_http_client_config_t config = {
-        .url = firmware_url,
-        .cert_pem =cert_pem,
-        .timeout_ms = 2000,
-        .use_global_ca_store = true};
+        .url = session->url,
+        .cert_pem = session->request->cert_pem,
+        .timeout_ms = session->transfer.timeout_ms,
+        .buffer_size = session->transfer.rx_buffer_size,
+        /* esp-tls prefers the global store over cert_pem, it may only hold the MQTT roots */
+        .use_global_ca_store = session->request->cert_pem == NULL,
+        .event_handler = &http_event_handler,
+        .user_data = session};
+    esp_http_client_handle_t http_client = esp_http_client_init(&config);
+    if (http_client == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = ESP_OK;
+    session->range_start = -1;
+    if (session->offset > 0)
+    {
+        char range[32];
+        snprintf(range, sizeof(range), "bytes=%u-", session->offset);
+        esp_http_client_set_header(http_client, "Range", range);
+    }
+    int64_t wait_start_us = esp_timer_get_time();
+    err = esp_http_client_open(http_client, 0);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "[download_range] failed to open connection: %s", esp_err_to_name(err));
+        goto end;
+    }
+    int content_length = esp_http_client_fetch_headers(http_client);
+    session->net_us += esp_timer_get_time() - wait_start_us;
+    int status = esp_http_client_get_status_code(http_client);
+    if (status == 416 && session->download_size > 0 && session->offset == session->download_size)
+    {
+        /* the connection dropped after the last byte */
+        goto end;
+    }
+    /* a server without Range support sends the whole file again, the part already consumed is skipped */
+    uint32_t skip = status == 200 ? session->offset : 0;
+    if (status != 200 && status != 206)
+    {
+        ESP_LOGE(TAG, "[download_range] http status:%d", status);
+        err = ESP_ERR_INVALID_RESPONSE;
+        goto end;
+    }
+    if (status == 206 && session->range_start != session->offset)
+    {
+        /* the decoders and the sha256 can't take bytes twice or skip any */
+        ESP_LOGE(TAG, "[download_range] asked for byte %u, got a range from %lld", session->offset, session->range_start);
+        session->restart = true;
+        err = ESP_ERR_INVALID_RESPONSE;
+        goto end;
+    }
+    if (session->download_size == 0 && content_length > 0)
+    {
+        session->download_size = status == 200 ? content_length : session->offset + content_length;
+    }
+    gcp_ota_set_phase(GCP_OTA_PHASE_DOWNLOADING, ESP_OK);
+    for (;;)
+    {
+        wait_start_us = esp_timer_get_time();
+        int read = esp_http_client_read(http_client, session->buffer, session->transfer.read_size);
+        session->net_us += esp_timer_get_time() - wait_start_us;
+        if (read < 0)
+        {
+            err = ESP_FAIL;
+            break;
+        }
+        if (read == 0)
+        {
+            err = esp_http_client_is_complete_data_received(http_client) ? ESP_OK : ESP_ERR_INVALID_SIZE;
+            break;
+        }
+        session->transferred += read;
+        char *data = session->buffer;
+        if (skip > 0)
+        {
+            uint32_t skipped = skip < read ? skip : read;
+            skip -= skipped;
+            data += skipped;
+            read -= skipped;
+        }
+        if (read > 0)
+        {
+            err = session->sink(session, data, read);
+            if (err != ESP_OK)
+            {
+                break;
+            }
+            session->offset += read;
+        }
+        gcp_ota_update_progress(session);
+    }
+end:
+    esp_http_client_close(http_client);
+    esp_http_client_cleanup(http_client);
+    return err;
+}
 
-    esp_https_ota_config_t ota_config = {
-        .http_config = &config,
-    };
+static bool parse_sha256(const char *hex, uint8_t *digest)
+{
+    if (strlen(hex) != 64)
+    {
+        return false;
+    }
+    /* %2x alone takes a sign, a 0x prefix or a single digit */
+    for (int i = 0; i < 64; i++)
+    {
+        if (!isxdigit((unsigned char)hex[i]))
+        {
+            return false;
+        }
+    }
+    for (int i = 0; i < 32; i++)
+    {
+        unsigned int byte;
+        if (sscanf(hex + i * 2, "%2x", &byte) != 1)
+        {
+            return false;
+        }
+        digest[i] = byte;
+    }
+    return true;
+}
 
-    esp_https_ota_handle_t https_ota_handle = NULL;
-    esp_err_t err = esp_https_ota_begin(&ota_config, &https_ota_handle);
-    if (err != ESP_OK)
+/* the digest is built while writing so the partition isn't read back */
+static esp_err_t verify_image(gcp_ota_session_t *session)
+{
+    if (session->request->size > 0 && session->written != session->request->size)
+    {
+        ESP_LOGE(TAG, "[verify_image] image is %u bytes instead of %u", session->written, session->request->size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (!session->check_sha256)
+    {
+        return ESP_OK;
+    }
+    uint8_t digest[32];
+    mbedtls_sha256_finish_ret(&session->sha256, digest);
+    if (memcmp(digest, session->expected_sha256, sizeof(digest)) != 0)
+    {
+        ESP_LOGE(TAG, "[verify_image] sha256 mismatch");
+        return ESP_ERR_INVALID_CRC;
+    }
+    ESP_LOGI(TAG, "[verify_image] sha256 matches");
+    return ESP_OK;
+}
+
+static void set_transfer_config(gcp_ota_transfer_config_t *transfer, const gcp_ota_transfer_config_t *config)
+{
+    *transfer = *config;
+    if (transfer->rx_buffer_size == 0)
+    {
+        transfer->rx_buffer_size = GCP_OTA_DEFAULT_RX_BUFFER_SIZE;
+    }
+    if (transfer->read_size == 0)
+    {
+        transfer->read_size = GCP_OTA_DEFAULT_READ_SIZE;
+    }
+    if (transfer->write_batch_size == 0)
+    {
+        transfer->write_batch_size = GCP_OTA_DEFAULT_WRITE_BATCH_SIZE;
+    }
+    if (transfer->timeout_ms == 0)
     {
-        ESP_LOGE(TAG, "ESP HTTPS OTA Begin failed");
-        vTaskDelete(NULL);
+        transfer->timeout_ms = GCP_OTA_DEFAULT_TIMEOUT_MS;
     }
+    if (transfer->mqtt_window == 0)
+    {
+        transfer->mqtt_window = GCP_OTA_DEFAULT_MQTT_WINDOW;
+    }
+    ESP_LOGD(TAG, "[set_transfer_config] rx buffer:%u, read:%u, write batch:%d, timeout:%u ms", transfer->rx_buffer_size, transfer->read_size, transfer->write_batch_size, transfer->timeout_ms);
+}
 
-    esp_app_desc_t app_desc;
-    err = esp_https_ota_get_img_desc(https_ota_handle, &app_desc);
+static void end_decoder(gcp_ota_session_t *session)
+{
+    gcp_mem_free(session->decoder);
+    session->decoder = NULL;
+}
+
+/* everything written so far is dropped, the partition and the decoder start from the first byte */
+static esp_err_t begin_install(gcp_ota_session_t *session, const esp_partition_t *partition)
+{
+    session->offset = 0;
+    session->download_size = 0;
+    session->written = 0;
+    session->write_buffered = 0;
+    session->restart = false;
+    session->fatal = false;
+    session->decoder_done = false;
+    if (session->check_sha256)
+    {
+        mbedtls_sha256_starts_ret(&session->sha256, 0);
+    }
+    esp_err_t err = ESP_OK;
+    if (session->patch)
+    {
+        session->sink = &gcp_ota_delta_write;
+        err = gcp_ota_delta_begin(session);
+    }
+    else if (session->request->compression != GCP_OTA_COMPRESSION_NONE)
+    {
+        session->sink = &gcp_ota_inflate_write;
+        err = gcp_ota_inflate_begin(session);
+    }
+    else
+    {
+        session->sink = &gcp_ota_write_image;
+    }
     if (err != ESP_OK)
     {
-        ESP_LOGE(TAG, "esp_https_ota_read_img_desc failed");
-        goto ota_end;
+        return err;
     }
-    err = validate_image_header(&app_desc);
+    err = esp_ota_begin(partition, OTA_WITH_SEQUENTIAL_WRITES, &session->ota_handle);
     if (err != ESP_OK)
     {
-        ESP_LOGE(TAG, "image header verification failed");
-        goto ota_end;
+        ESP_LOGE(TAG, "[install] esp_ota_begin failed: %s", esp_err_to_name(err));
+        end_decoder(session);
+        return err;
     }
+    return ESP_OK;
+}
 
-    while (1)
+/* downloads session->url into the partition, retrying from where it stopped, bytes transferred and time add up across calls */
+static esp_err_t install(gcp_ota_session_t *session, const esp_partition_t *partition)
+{
+    session->retries = 0;
+    esp_err_t err = begin_install(session, partition);
+    if (err != ESP_OK)
     {
-        err = esp_https_ota_perform(https_ota_handle);
-        if (err != ESP_ERR_HTTPS_OTA_IN_PROGRESS)
+        return err;
+    }
+
+    uint32_t backoff_ms = GCP_OTA_RETRY_INITIAL_DELAY_MS;
+    for (;;)
+    {
+        err = session->request->transport == GCP_OTA_TRANSPORT_MQTT ? gcp_ota_mqtt_download(session) : download_range(session);
+        if (err == ESP_OK || session->fatal || session->retries >= GCP_OTA_MAX_RETRIES)
         {
             break;
         }
-        // esp_https_ota_perform returns after every read operation which gives user the ability to
-        // monitor the status of OTA upgrade by calling esp_https_ota_get_image_len_read, which gives length of image
-        // data read so far.
-        ESP_LOGD(TAG, "Image bytes read: %d", esp_https_ota_get_image_len_read(https_ota_handle));
+        session->retries++;
+        ESP_LOGW(TAG, "[install] %s at %u bytes, retry %u in %u ms", esp_err_to_name(err), session->offset, session->retries, backoff_ms);
+        if (session->restart)
+        {
+            end_decoder(session);
+            esp_ota_abort(session->ota_handle);
+            err = begin_install(session, partition);
+            if (err != ESP_OK)
+            {
+                return err;
+            }
+        }
+        gcp_ota_set_phase(GCP_OTA_PHASE_CONNECTING, err);
+        gcp_ota_update_progress(session);
+        vTaskDelay(backoff_ms / portTICK_PERIOD_MS);
+        backoff_ms = backoff_ms * 2 < GCP_OTA_RETRY_MAX_DELAY_MS ? backoff_ms * 2 : GCP_OTA_RETRY_MAX_DELAY_MS;
+    }
+    end_decoder(session);
+    if (err == ESP_OK && session->sink != &gcp_ota_write_image && !session->decoder_done)
+    {
+        ESP_LOGE(TAG, "[install] %s stream is truncated", session->patch ? "patch" : "compressed");
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    if (err == ESP_OK)
+    {
+        err = flush_image(session);
+    }
+    if (err == ESP_OK)
+    {
+        err = verify_image(session);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "[install] download failed after %u retries: %s", session->retries, esp_err_to_name(err));
+        esp_ota_abort(session->ota_handle);
+        return err;
     }
 
-    if (esp_https_ota_is_complete_data_received(https_ota_handle) != true)
+    gcp_ota_set_phase(GCP_OTA_PHASE_VERIFYING, ESP_OK);
+    err = esp_ota_end(session->ota_handle);
+    if (err == ESP_ERR_OTA_VALIDATE_FAILED)
     {
-        // the OTA image was not completely received and user can customise the response to this situation.
-        ESP_LOGE(TAG, "Complete data was not received.");
+        ESP_LOGE(TAG, "Image validation failed, image is corrupted");
     }
+    return err;
+}
 
-ota_end:
-    ota_finish_err = esp_https_ota_finish(https_ota_handle);
-    if ((err == ESP_OK) && (ota_finish_err == ESP_OK))
+/* a patch only applies to the firmware it was made from */
+static bool patch_applies(const gcp_ota_request_t *request)
+{
+    if (request->patch_url == NULL || request->transport == GCP_OTA_TRANSPORT_MQTT)
     {
-        ESP_LOGI(TAG, "ESP_HTTPS_OTA upgrade successful. Rebooting ...");
-        vTaskDelay(1000 / portTICK_PERIOD_MS);
-        esp_restart();
+        return false;
     }
-    else
+    char running_version[32] = {0};
+    gcp_ota_get_running_app_version(running_version);
+    if (request->patch_base_version == NULL || strcmp(running_version, request->patch_base_version) != 0)
     {
-        if (ota_finish_err == ESP_ERR_OTA_VALIDATE_FAILED)
+        ESP_LOGW(TAG, "[patch_applies] patch is for %s, running %s", request->patch_base_version == NULL ? "unknown" : request->patch_base_version, running_version);
+        return false;
+    }
+    return true;
+}
+
+esp_err_t gcp_ota_update_firmware(const gcp_ota_request_t *request)
+{
+    ESP_LOGI(TAG, "[ota_update_firmware] target url: %s", request->transport == GCP_OTA_TRANSPORT_MQTT ? "mqtt" : request->url);
+    gcp_ota_session_t session = {
+        .request = request,
+        .start_us = esp_timer_get_time()};
+    portENTER_CRITICAL(&ota_lock);
+    memset(&ota_progress, 0, sizeof(ota_progress));
+    portEXIT_CRITICAL(&ota_lock);
+    gcp_ota_set_phase(GCP_OTA_PHASE_CONNECTING, ESP_OK);
+
+    const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+    if (partition == NULL)
+    {
+        gcp_ota_set_phase(GCP_OTA_PHASE_FAILED, ESP_ERR_NOT_FOUND);
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (request->sha256 != NULL)
+    {
+        if (!parse_sha256(request->sha256, session.expected_sha256))
         {
-            ESP_LOGE(TAG, "Image validation failed, image is corrupted");
+            ESP_LOGE(TAG, "[ota_update_firmware] sha256 is not 64 hex digits");
+            gcp_ota_set_phase(GCP_OTA_PHASE_FAILED, ESP_ERR_INVALID_ARG);
+            return ESP_ERR_INVALID_ARG;
         }
-        ESP_LOGE(TAG, "ESP_HTTPS_OTA upgrade failed %d", ota_finish_err);
+        session.check_sha256 = true;
+    }
+    set_transfer_config(&session.transfer, &request->transfer);
+    session.buffer = gcp_mem_malloc(GCP_MEM_OTA, session.transfer.read_size);
+    if (session.transfer.write_batch_size > 0)
+    {
+        session.write_buffer = gcp_mem_malloc(GCP_MEM_OTA, session.transfer.write_batch_size);
+    }
+    if (session.buffer == NULL || (session.transfer.write_batch_size > 0 && session.write_buffer == NULL))
+    {
+        gcp_mem_free(session.buffer);
+        gcp_mem_free(session.write_buffer);
+        gcp_ota_set_phase(GCP_OTA_PHASE_FAILED, ESP_ERR_NO_MEM);
+        return ESP_ERR_NO_MEM;
+    }
+    mbedtls_sha256_init(&session.sha256);
+    esp_err_t err = ESP_FAIL;
+    if (patch_applies(request))
+    {
+        ESP_LOGI(TAG, "[ota_update_firmware] patch url: %s", request->patch_url);
+        session.url = request->patch_url;
+        session.patch = true;
+        err = install(&session, partition);
+        if (err != ESP_OK)
+        {
+            ESP_LOGW(TAG, "[ota_update_firmware] patch failed: %s, falling back to the full image", esp_err_to_name(err));
+            session.patch = false;
+            gcp_ota_set_phase(GCP_OTA_PHASE_CONNECTING, err);
+        }
+    }
+    if (err != ESP_OK)
+    {
+        session.url = request->url;
+        err = install(&session, partition);
+    }
+    gcp_mem_free(session.buffer);
+    gcp_mem_free(session.write_buffer);
+    mbedtls_sha256_free(&session.sha256);
+    if (err == ESP_OK)
+    {
+        err = esp_ota_set_boot_partition(partition);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "[ota_update_firmware] upgrade failed: %s", esp_err_to_name(err));
+        gcp_ota_set_phase(GCP_OTA_PHASE_FAILED, err);
+        return err;
+    }
+    save_last_update(&session);
+    ESP_LOGI(TAG, "[ota_update_firmware] upgrade successful, %u bytes transferred for a %u bytes image in %u ms, %u bytes/s, flash:%u ms, network:%u ms. Rebooting ...",
+             session.transferred, session.written, last_update.result.duration_ms, last_update.result.bytes_per_sec, last_update.result.flash_ms, last_update.result.net_ms);
+    gcp_ota_set_phase(GCP_OTA_PHASE_REBOOTING, ESP_OK);
+    vTaskDelay(1000 / portTICK_PERIOD_MS);
+    esp_restart();
+    return ESP_OK;
+}
+
+static void free_task_args(gcp_ota_task_args_t *args)
+{
+    if (args != NULL)
+    {
+        gcp_mem_free(args->url);
+        gcp_mem_free(args->patch_url);
+        gcp_mem_free(args->patch_base_version);
+        gcp_mem_free(args->sha256);
+        gcp_mem_free(args);
     }
-}
\ No newline at end of file
+}
+
+static bool copy_string(char **copy, const char *str)
+{
+    return str == NULL || gcp_mem_asprintf(GCP_MEM_OTA, copy, "%s", str) >= 0;
+}
+
+static void gcp_ota_task(void *pvParameter)
+{
+    gcp_ota_task_args_t *args = (gcp_ota_task_args_t *)pvParameter;
+    gcp_ota_update_firmware(&args->request);
+    ESP_LOGI(TAG, "[gcp_ota_task] ended, stack free:%d", uxTaskGetStackHighWaterMark(NULL));
+    free_task_args(args);
+    portENTER_CRITICAL(&ota_lock);
+    ota_running = false;
+    portEXIT_CRITICAL(&ota_lock);
+    vTaskDelete(NULL);
+}
+
+esp_err_t gcp_ota_start(const gcp_ota_request_t *request, const gcp_task_config_t *task_config)
+{
+    portENTER_CRITICAL(&ota_lock);
+    bool already_running = ota_running;
+    ota_running = true;
+    portEXIT_CRITICAL(&ota_lock);
+    if (already_running)
+    {
+        ESP_LOGD(TAG, "[gcp_ota_start] update already running");
+        return ESP_ERR_INVALID_STATE;
+    }
+    gcp_ota_task_args_t *args = gcp_mem_calloc(GCP_MEM_OTA, 1, sizeof(gcp_ota_task_args_t));
+    if (args == NULL || !copy_string(&args->url, request->url) || !copy_string(&args->patch_url, request->patch_url) || !copy_string(&args->patch_base_version, request->patch_base_version) ||
+        !copy_string(&args->sha256, request->sha256))
+    {
+        free_task_args(args);
+        goto no_mem;
+    }
+    args->request = *request;
+    args->request.url = args->url;
+    args->request.patch_url = args->patch_url;
+    args->request.patch_base_version = args->patch_base_version;
+    args->request.sha256 = args->sha256;
+    uint32_t stack_size = task_config->stack_size > 0 ? task_config->stack_size : GCP_OTA_TASK_STACK_SIZE;
+    UBaseType_t priority = task_config->priority > 0 ? task_config->priority : GCP_OTA_TASK_PRIORITY;
+    BaseType_t core_id = task_config->pin_to_core ? task_config->core_id : tskNO_AFFINITY;
+    if (xTaskCreatePinnedToCore(&gcp_ota_task, "gcp_ota_task", stack_size, args, priority, NULL, core_id) != pdPASS)
+    {
+        free_task_args(args);
+        goto no_mem;
+    }
+    return ESP_OK;
+no_mem:
+    ESP_LOGE(TAG, "[gcp_ota_start] failed to start the OTA task");
+    portENTER_CRITICAL(&ota_lock);
+    ota_running = false;
+    portEXIT_CRITICAL(&ota_lock);
+    return ESP_ERR_NO_MEM;
+}
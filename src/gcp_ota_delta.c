@@ -0,0 +1,185 @@
+#include "gcp_ota_internal.h"
+#include "esp_partition.h"
+#include "esp_log.h"
+#include <string.h>
+#include "gcp_mem.h"
+
+#define TAG "GCP_OTA_DELTA"
+
+#define PATCH_MAGIC "GDP1"
+#define PATCH_HEADER_SIZE 12 /* magic, target size, base size */
+#define PATCH_COPY_CHUNK_SIZE 1024
+
+#define PATCH_OP_END 0x00
+#define PATCH_OP_COPY 0x01   /* u32 base offset, u32 length */
+#define PATCH_OP_INSERT 0x02 /* u32 length, then the bytes */
+
+typedef enum
+{
+    PATCH_STATE_HEADER = 0,
+    PATCH_STATE_OP,
+    PATCH_STATE_INSERT,
+    PATCH_STATE_DONE,
+} patch_state_t;
+
+/*
+ * A patch rebuilds the new image from ranges of the running partition and inserted bytes, integers are little endian.
+ * Fields are collected byte by byte since they can be split across reads, copies are done as soon as their op is complete.
+ */
+typedef struct
+{
+    const esp_partition_t *base;
+    patch_state_t state;
+    uint8_t field[PATCH_HEADER_SIZE];
+    size_t field_length;
+    size_t field_size;
+    uint32_t target_size;
+    uint32_t base_size;
+    uint32_t insert_remaining;
+    char copy_buffer[PATCH_COPY_CHUNK_SIZE];
+} gcp_ota_delta_t;
+
+static uint32_t read_u32(const uint8_t *data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static size_t op_size(uint8_t op)
+{
+    switch (op)
+    {
+    case PATCH_OP_COPY:
+        return 9;
+    case PATCH_OP_INSERT:
+        return 5;
+    default:
+        return 1;
+    }
+}
+
+esp_err_t gcp_ota_delta_begin(gcp_ota_session_t *session)
+{
+    gcp_ota_delta_t *delta = gcp_mem_calloc(GCP_MEM_OTA, 1, sizeof(gcp_ota_delta_t));
+    if (delta == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    delta->base = esp_ota_get_running_partition();
+    delta->state = PATCH_STATE_HEADER;
+    delta->field_size = PATCH_HEADER_SIZE;
+    session->decoder = delta;
+    return ESP_OK;
+}
+
+static esp_err_t copy_from_base(gcp_ota_session_t *session, gcp_ota_delta_t *delta, uint32_t offset, uint32_t length)
+{
+    if (offset > delta->base_size || length > delta->base_size - offset)
+    {
+        ESP_LOGE(TAG, "[copy_from_base] %u bytes at %u are outside of the %u bytes base", length, offset, delta->base_size);
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    while (length > 0)
+    {
+        uint32_t chunk = length < PATCH_COPY_CHUNK_SIZE ? length : PATCH_COPY_CHUNK_SIZE;
+        esp_err_t err = esp_partition_read(delta->base, offset, delta->copy_buffer, chunk);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "[copy_from_base] esp_partition_read failed: %s", esp_err_to_name(err));
+            return err;
+        }
+        err = gcp_ota_write_image(session, delta->copy_buffer, chunk);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        offset += chunk;
+        length -= chunk;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t field_complete(gcp_ota_session_t *session, gcp_ota_delta_t *delta)
+{
+    if (delta->state == PATCH_STATE_HEADER)
+    {
+        delta->target_size = read_u32(delta->field + 4);
+        delta->base_size = read_u32(delta->field + 8);
+        if (memcmp(delta->field, PATCH_MAGIC, 4) != 0 || delta->base_size > delta->base->size)
+        {
+            ESP_LOGE(TAG, "[field_complete] not a patch for this partition");
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        ESP_LOGI(TAG, "[field_complete] patching %u bytes of base into a %u bytes image", delta->base_size, delta->target_size);
+        delta->state = PATCH_STATE_OP;
+        return ESP_OK;
+    }
+    esp_err_t err = ESP_OK;
+    switch (delta->field[0])
+    {
+    case PATCH_OP_COPY:
+        err = copy_from_base(session, delta, read_u32(delta->field + 1), read_u32(delta->field + 5));
+        break;
+    case PATCH_OP_INSERT:
+        delta->insert_remaining = read_u32(delta->field + 1);
+        delta->state = delta->insert_remaining > 0 ? PATCH_STATE_INSERT : PATCH_STATE_OP;
+        break;
+    case PATCH_OP_END:
+        if (session->written != delta->target_size)
+        {
+            ESP_LOGE(TAG, "[field_complete] patch produced %u bytes instead of %u", session->written, delta->target_size);
+            return ESP_ERR_INVALID_SIZE;
+        }
+        delta->state = PATCH_STATE_DONE;
+        session->decoder_done = true;
+        break;
+    default:
+        ESP_LOGE(TAG, "[field_complete] unknown op:%d", delta->field[0]);
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    return err;
+}
+
+esp_err_t gcp_ota_delta_write(gcp_ota_session_t *session, const char *data, size_t size)
+{
+    gcp_ota_delta_t *delta = session->decoder;
+    const uint8_t *in = (const uint8_t *)data;
+    while (size > 0 && delta->state != PATCH_STATE_DONE)
+    {
+        if (delta->state == PATCH_STATE_INSERT)
+        {
+            uint32_t chunk = delta->insert_remaining < size ? delta->insert_remaining : size;
+            esp_err_t err = gcp_ota_write_image(session, (const char *)in, chunk);
+            if (err != ESP_OK)
+            {
+                return err;
+            }
+            in += chunk;
+            size -= chunk;
+            delta->insert_remaining -= chunk;
+            if (delta->insert_remaining == 0)
+            {
+                delta->state = PATCH_STATE_OP;
+            }
+            continue;
+        }
+        delta->field[delta->field_length++] = *in++;
+        size--;
+        if (delta->state == PATCH_STATE_OP && delta->field_length == 1)
+        {
+            delta->field_size = op_size(delta->field[0]);
+        }
+        if (delta->field_length < delta->field_size)
+        {
+            continue;
+        }
+        delta->field_length = 0;
+        esp_err_t err = field_complete(session, delta);
+        if (err != ESP_OK)
+        {
+            /* a bad patch or base won't get better with a retry, the full image is downloaded instead */
+            session->fatal = true;
+            return err;
+        }
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,150 @@
+#include "gcp_ota.h"
+#include <freertos/FreeRTOS.h>
+#include "esp_ota_ops.h"
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include <string.h>
+
+#define TAG "GCP_OTA_HEALTH"
+
+#define GCP_OTA_ROLLBACK_MAGIC 0x524f4c31
+
+/* written before the rollback reboot so the previous firmware can report why, esp_ota_get_last_invalid_partition covers power cycles */
+typedef struct
+{
+    uint32_t magic;
+    char version[32];
+    uint32_t missing;
+} gcp_ota_rollback_t;
+
+static RTC_NOINIT_ATTR gcp_ota_rollback_t last_rollback;
+
+static gcp_ota_health_t health;
+static bool health_started;
+static esp_timer_handle_t deadline_timer;
+static portMUX_TYPE health_lock = portMUX_INITIALIZER_UNLOCKED;
+
+const char *gcp_ota_health_name(gcp_ota_health_state_t state)
+{
+    switch (state)
+    {
+    case GCP_OTA_HEALTH_PENDING:
+        return "pending";
+    case GCP_OTA_HEALTH_VALID:
+        return "valid";
+    case GCP_OTA_HEALTH_ROLLED_BACK:
+        return "rolled_back";
+    default:
+        return "none";
+    }
+}
+
+static void deadline_callback(void *arg)
+{
+    portENTER_CRITICAL(&health_lock);
+    bool pending = health.state == GCP_OTA_HEALTH_PENDING;
+    uint32_t missing = health.missing;
+    /* a late check can't mark it valid anymore */
+    health.state = GCP_OTA_HEALTH_NONE;
+    portEXIT_CRITICAL(&health_lock);
+    if (!pending)
+    {
+        return;
+    }
+    if (!esp_ota_check_rollback_is_possible())
+    {
+        ESP_LOGE(TAG, "[deadline_callback] checks:0x%x missing but there is no firmware to roll back to, keeping this one", missing);
+        esp_ota_mark_app_valid_cancel_rollback();
+        portENTER_CRITICAL(&health_lock);
+        health.state = GCP_OTA_HEALTH_VALID;
+        portEXIT_CRITICAL(&health_lock);
+        return;
+    }
+    ESP_LOGE(TAG, "[deadline_callback] checks:0x%x missing, rolling back", missing);
+    last_rollback.magic = GCP_OTA_ROLLBACK_MAGIC;
+    gcp_ota_get_running_app_version(last_rollback.version);
+    last_rollback.missing = missing;
+    esp_ota_mark_app_invalid_rollback_and_reboot();
+}
+
+static void find_rollback(void)
+{
+    const esp_partition_t *invalid = esp_ota_get_last_invalid_partition();
+    if (invalid == NULL)
+    {
+        return;
+    }
+    esp_app_desc_t app_desc;
+    if (esp_ota_get_partition_description(invalid, &app_desc) != ESP_OK)
+    {
+        return;
+    }
+    health.state = GCP_OTA_HEALTH_ROLLED_BACK;
+    strncpy(health.rejected_version, app_desc.version, sizeof(health.rejected_version) - 1);
+    /* without the record the bootloader rolled it back, it crashed or rebooted before passing */
+    if (last_rollback.magic == GCP_OTA_ROLLBACK_MAGIC && strncmp(last_rollback.version, app_desc.version, sizeof(last_rollback.version)) == 0)
+    {
+        health.missing = last_rollback.missing;
+    }
+    ESP_LOGW(TAG, "[find_rollback] update to %s was rolled back", health.rejected_version);
+}
+
+void gcp_ota_health_begin(uint32_t timeout_ms)
+{
+    if (health_started)
+    {
+        return;
+    }
+    health_started = true;
+    esp_ota_img_states_t ota_state;
+    if (esp_ota_get_state_partition(esp_ota_get_running_partition(), &ota_state) != ESP_OK || ota_state != ESP_OTA_IMG_PENDING_VERIFY)
+    {
+        find_rollback();
+        return;
+    }
+    uint32_t deadline_ms = timeout_ms > 0 ? timeout_ms : GCP_OTA_HEALTH_DEFAULT_TIMEOUT_MS;
+    portENTER_CRITICAL(&health_lock);
+    health.state = GCP_OTA_HEALTH_PENDING;
+    health.missing = GCP_OTA_CHECK_ALL;
+    portEXIT_CRITICAL(&health_lock);
+    esp_timer_create_args_t timer_args = {
+        .callback = &deadline_callback,
+        .name = "gcp_ota_health"};
+    if (esp_timer_create(&timer_args, &deadline_timer) != ESP_OK || esp_timer_start_once(deadline_timer, (uint64_t)deadline_ms * 1000) != ESP_OK)
+    {
+        /* without a deadline a reboot still rolls it back */
+        ESP_LOGE(TAG, "[gcp_ota_health_begin] deadline timer failed");
+    }
+    ESP_LOGI(TAG, "[gcp_ota_health_begin] new firmware pending verification for %u ms", deadline_ms);
+}
+
+void gcp_ota_health_check_passed(uint32_t check)
+{
+    portENTER_CRITICAL(&health_lock);
+    bool pending = health.state == GCP_OTA_HEALTH_PENDING && (health.missing & check);
+    if (pending)
+    {
+        health.missing &= ~check;
+        if (health.missing == 0)
+        {
+            health.state = GCP_OTA_HEALTH_VALID;
+        }
+    }
+    bool valid = pending && health.state == GCP_OTA_HEALTH_VALID;
+    portEXIT_CRITICAL(&health_lock);
+    if (!valid)
+    {
+        return;
+    }
+    esp_timer_stop(deadline_timer);
+    esp_err_t err = esp_ota_mark_app_valid_cancel_rollback();
+    ESP_LOGI(TAG, "[gcp_ota_health_check_passed] firmware marked valid: %s", esp_err_to_name(err));
+}
+
+void gcp_ota_get_health(gcp_ota_health_t *health_out)
+{
+    portENTER_CRITICAL(&health_lock);
+    *health_out = health;
+    portEXIT_CRITICAL(&health_lock);
+}
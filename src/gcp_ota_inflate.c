@@ -0,0 +1,221 @@
+#include "gcp_ota_internal.h"
+#include "esp32/rom/miniz.h"
+#include "esp_log.h"
+#include <string.h>
+#include "gcp_mem.h"
+
+#define TAG "GCP_OTA_INFLATE"
+
+#define GZIP_HEADER_SIZE 10
+#define GZIP_FLAG_FHCRC (1 << 1)
+#define GZIP_FLAG_FEXTRA (1 << 2)
+#define GZIP_FLAG_FNAME (1 << 3)
+#define GZIP_FLAG_FCOMMENT (1 << 4)
+
+typedef enum
+{
+    GZIP_HEADER_FIXED = 0,
+    GZIP_HEADER_EXTRA_LENGTH,
+    GZIP_HEADER_EXTRA,
+    GZIP_HEADER_NAME,
+    GZIP_HEADER_COMMENT,
+    GZIP_HEADER_CRC,
+    GZIP_HEADER_DONE,
+} gzip_header_state_t;
+
+/*
+ * tinfl from the ROM writes into a 32 KB ring that doubles as the deflate window,
+ * every chunk it produces goes straight to the partition so memory use doesn't depend on the image size.
+ */
+typedef struct
+{
+    tinfl_decompressor inflator;
+    mz_uint8 dict[TINFL_LZ_DICT_SIZE];
+    size_t dict_offset;
+    mz_uint32 flags;
+    gzip_header_state_t gzip_state;
+    uint8_t gzip_flags;
+    uint32_t gzip_remaining; /* bytes left in the current header field */
+    uint16_t gzip_extra_length;
+} gcp_ota_inflate_t;
+
+esp_err_t gcp_ota_inflate_begin(gcp_ota_session_t *session)
+{
+    gcp_ota_inflate_t *inflate = gcp_mem_malloc(GCP_MEM_OTA, sizeof(gcp_ota_inflate_t));
+    if (inflate == NULL)
+    {
+        ESP_LOGE(TAG, "[gcp_ota_inflate_begin] no memory for a %d bytes window", TINFL_LZ_DICT_SIZE);
+        return ESP_ERR_NO_MEM;
+    }
+    tinfl_init(&inflate->inflator);
+    inflate->dict_offset = 0;
+    inflate->flags = TINFL_FLAG_HAS_MORE_INPUT;
+    if (session->request->compression == GCP_OTA_COMPRESSION_ZLIB)
+    {
+        inflate->flags |= TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_COMPUTE_ADLER32;
+        inflate->gzip_state = GZIP_HEADER_DONE;
+    }
+    else
+    {
+        inflate->gzip_state = GZIP_HEADER_FIXED;
+        inflate->gzip_remaining = GZIP_HEADER_SIZE;
+    }
+    session->decoder = inflate;
+    return ESP_OK;
+}
+
+static void next_gzip_field(gcp_ota_inflate_t *inflate)
+{
+    while (inflate->gzip_state != GZIP_HEADER_DONE)
+    {
+        inflate->gzip_state++;
+        switch (inflate->gzip_state)
+        {
+        case GZIP_HEADER_EXTRA_LENGTH:
+            if (inflate->gzip_flags & GZIP_FLAG_FEXTRA)
+            {
+                inflate->gzip_remaining = 2;
+                return;
+            }
+            inflate->gzip_state = GZIP_HEADER_EXTRA;
+            break;
+        case GZIP_HEADER_NAME:
+            if (inflate->gzip_flags & GZIP_FLAG_FNAME)
+            {
+                return;
+            }
+            break;
+        case GZIP_HEADER_COMMENT:
+            if (inflate->gzip_flags & GZIP_FLAG_FCOMMENT)
+            {
+                return;
+            }
+            break;
+        case GZIP_HEADER_CRC:
+            if (inflate->gzip_flags & GZIP_FLAG_FHCRC)
+            {
+                inflate->gzip_remaining = 2;
+                return;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+/* consumes the gzip member header byte by byte since it can be split across reads, returns the bytes used */
+static size_t parse_gzip_header(gcp_ota_inflate_t *inflate, const uint8_t *data, size_t size, esp_err_t *err)
+{
+    size_t used = 0;
+    while (used < size && inflate->gzip_state != GZIP_HEADER_DONE)
+    {
+        uint8_t byte = data[used++];
+        switch (inflate->gzip_state)
+        {
+        case GZIP_HEADER_FIXED:
+            if ((inflate->gzip_remaining == GZIP_HEADER_SIZE && byte != 0x1f) ||
+                (inflate->gzip_remaining == GZIP_HEADER_SIZE - 1 && byte != 0x8b) ||
+                (inflate->gzip_remaining == GZIP_HEADER_SIZE - 2 && byte != 8))
+            {
+                ESP_LOGE(TAG, "[parse_gzip_header] not a deflate gzip file");
+                *err = ESP_ERR_INVALID_RESPONSE;
+                return used;
+            }
+            if (inflate->gzip_remaining == GZIP_HEADER_SIZE - 3)
+            {
+                inflate->gzip_flags = byte;
+            }
+            if (--inflate->gzip_remaining == 0)
+            {
+                next_gzip_field(inflate);
+            }
+            break;
+        case GZIP_HEADER_EXTRA_LENGTH:
+            /* little endian XLEN, the low byte comes first */
+            if (--inflate->gzip_remaining == 1)
+            {
+                inflate->gzip_extra_length = byte;
+            }
+            else
+            {
+                inflate->gzip_remaining = inflate->gzip_extra_length | (byte << 8);
+                inflate->gzip_state = GZIP_HEADER_EXTRA;
+                if (inflate->gzip_remaining == 0)
+                {
+                    next_gzip_field(inflate);
+                }
+            }
+            break;
+        case GZIP_HEADER_EXTRA:
+        case GZIP_HEADER_CRC:
+            if (--inflate->gzip_remaining == 0)
+            {
+                next_gzip_field(inflate);
+            }
+            break;
+        case GZIP_HEADER_NAME:
+        case GZIP_HEADER_COMMENT:
+            if (byte == 0)
+            {
+                next_gzip_field(inflate);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    return used;
+}
+
+esp_err_t gcp_ota_inflate_write(gcp_ota_session_t *session, const char *data, size_t size)
+{
+    gcp_ota_inflate_t *inflate = session->decoder;
+    const mz_uint8 *in = (const mz_uint8 *)data;
+    esp_err_t err = ESP_OK;
+    if (inflate->gzip_state != GZIP_HEADER_DONE)
+    {
+        size_t used = parse_gzip_header(inflate, in, size, &err);
+        if (err != ESP_OK)
+        {
+            session->fatal = true;
+            return err;
+        }
+        in += used;
+        size -= used;
+    }
+    while (!session->decoder_done)
+    {
+        size_t in_bytes = size;
+        size_t out_bytes = TINFL_LZ_DICT_SIZE - inflate->dict_offset;
+        tinfl_status status = tinfl_decompress(&inflate->inflator, in, &in_bytes, inflate->dict, inflate->dict + inflate->dict_offset, &out_bytes, inflate->flags);
+        in += in_bytes;
+        size -= in_bytes;
+        if (out_bytes > 0)
+        {
+            err = gcp_ota_write_image(session, (const char *)inflate->dict + inflate->dict_offset, out_bytes);
+            if (err != ESP_OK)
+            {
+                return err;
+            }
+            inflate->dict_offset = (inflate->dict_offset + out_bytes) & (TINFL_LZ_DICT_SIZE - 1);
+        }
+        if (status < TINFL_STATUS_DONE)
+        {
+            ESP_LOGE(TAG, "[gcp_ota_inflate_write] corrupted stream:%d", status);
+            session->fatal = true;
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        if (status == TINFL_STATUS_DONE)
+        {
+            /* the gzip trailer is left unread, esp_ota_end checks the image */
+            session->decoder_done = true;
+        }
+        else if (status == TINFL_STATUS_NEEDS_MORE_INPUT)
+        {
+            /* all input is consumed, HAS_MORE_OUTPUT loops to flush the window */
+            break;
+        }
+    }
+    return ESP_OK;
+}
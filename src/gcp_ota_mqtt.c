@@ -0,0 +1,184 @@
+#include "gcp_ota_internal.h"
+#include <freertos/FreeRTOS.h>
+#include "freertos/message_buffer.h"
+#include "freertos/semphr.h"
+#include <mbedtls/base64.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "cJSON.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "gcp_mem.h"
+
+#define TAG "GCP_OTA_MQTT"
+
+#define JSON_KEY_OFFSET "offset"
+#define JSON_KEY_TOTAL "total"
+#define JSON_KEY_DATA "data"
+
+typedef struct
+{
+    uint32_t offset;
+    uint32_t total;
+    uint8_t data[GCP_OTA_MQTT_CHUNK_SIZE];
+} gcp_ota_chunk_t;
+
+#define CHUNK_HEADER_SIZE offsetof(gcp_ota_chunk_t, data)
+/* xMessageBufferSend stores a length with each message */
+#define CHUNK_BUFFER_SIZE(window) ((window) * (sizeof(gcp_ota_chunk_t) + sizeof(size_t)))
+
+/*
+ * Chunks are decoded on the MQTT task and handed to the OTA task through a message buffer sized for the window,
+ * so flash writes don't hold up the MQTT task. It is created with the first MQTT update and kept, a late chunk can
+ * arrive after an update ended.
+ */
+static MessageBufferHandle_t chunks;
+static uint32_t chunks_window;
+static gcp_ota_chunk_t *rx_chunk; /* decoded on the MQTT task */
+static gcp_ota_chunk_t *ota_chunk; /* received on the OTA task */
+/* held by the MQTT task while it sends a chunk, the OTA task takes it to start or stop receiving so a reset never meets a send */
+static SemaphoreHandle_t rx_lock;
+static StaticSemaphore_t rx_lock_buffer;
+static bool receiving;
+
+static void set_receiving(bool on)
+{
+    xSemaphoreTake(rx_lock, portMAX_DELAY);
+    if (on)
+    {
+        xMessageBufferReset(chunks);
+    }
+    receiving = on;
+    xSemaphoreGive(rx_lock);
+}
+
+void gcp_ota_mqtt_chunk_received(const char *chunk)
+{
+    if (rx_lock == NULL)
+    {
+        ESP_LOGW(TAG, "[gcp_ota_mqtt_chunk_received] no update running");
+        return;
+    }
+    xSemaphoreTake(rx_lock, portMAX_DELAY);
+    if (!receiving)
+    {
+        xSemaphoreGive(rx_lock);
+        ESP_LOGW(TAG, "[gcp_ota_mqtt_chunk_received] no update running");
+        return;
+    }
+    cJSON *json = cJSON_Parse(chunk);
+    const cJSON *offset = cJSON_GetObjectItem(json, JSON_KEY_OFFSET);
+    const cJSON *total = cJSON_GetObjectItem(json, JSON_KEY_TOTAL);
+    const char *data = cJSON_GetStringValue(cJSON_GetObjectItem(json, JSON_KEY_DATA));
+    size_t length = 0;
+    if (!cJSON_IsNumber(offset) || !cJSON_IsNumber(total) || data == NULL)
+    {
+        ESP_LOGE(TAG, "[gcp_ota_mqtt_chunk_received] invalid chunk");
+        goto end;
+    }
+    if (mbedtls_base64_decode(rx_chunk->data, sizeof(rx_chunk->data), &length, (const unsigned char *)data, strlen(data)) != 0)
+    {
+        ESP_LOGE(TAG, "[gcp_ota_mqtt_chunk_received] chunk at %u is not base64 or larger than %d bytes", (uint32_t)offset->valuedouble, GCP_OTA_MQTT_CHUNK_SIZE);
+        goto end;
+    }
+    rx_chunk->offset = offset->valuedouble;
+    rx_chunk->total = total->valuedouble;
+    if (xMessageBufferSend(chunks, rx_chunk, CHUNK_HEADER_SIZE + length, 0) == 0)
+    {
+        /* the server sent past the window, the chunk is requested again after the timeout */
+        ESP_LOGW(TAG, "[gcp_ota_mqtt_chunk_received] window is full, chunk at %u dropped", rx_chunk->offset);
+    }
+end:
+    cJSON_Delete(json);
+    xSemaphoreGive(rx_lock);
+}
+
+/* every request acknowledges what is before offset, retry asks the server to send again from there */
+static esp_err_t send_request(gcp_ota_session_t *session, uint32_t window, bool retry)
+{
+    char request[96];
+    snprintf(request, sizeof(request), "{\"offset\":%u,\"chunk\":%u,\"window\":%u,\"retry\":%s}", session->offset, GCP_OTA_MQTT_CHUNK_SIZE, window, retry ? "true" : "false");
+    return gcp_send_telemetry(session->request->mqtt_client, GCP_OTA_MQTT_TOPIC, request);
+}
+
+static esp_err_t create_chunk_buffers(uint32_t window)
+{
+    /* what a failed attempt allocated is kept for the next one */
+    if (rx_lock == NULL)
+    {
+        rx_lock = xSemaphoreCreateMutexStatic(&rx_lock_buffer);
+    }
+    if (chunks == NULL)
+    {
+        chunks = xMessageBufferCreate(CHUNK_BUFFER_SIZE(window));
+    }
+    if (rx_chunk == NULL)
+    {
+        rx_chunk = gcp_mem_malloc(GCP_MEM_OTA, sizeof(gcp_ota_chunk_t));
+    }
+    if (ota_chunk == NULL)
+    {
+        ota_chunk = gcp_mem_malloc(GCP_MEM_OTA, sizeof(gcp_ota_chunk_t));
+    }
+    if (chunks == NULL || rx_chunk == NULL || ota_chunk == NULL)
+    {
+        ESP_LOGE(TAG, "[create_chunk_buffers] no memory for a window of %u chunks", window);
+        return ESP_ERR_NO_MEM;
+    }
+    chunks_window = window;
+    return ESP_OK;
+}
+
+esp_err_t gcp_ota_mqtt_download(gcp_ota_session_t *session)
+{
+    if (session->request->mqtt_client == NULL)
+    {
+        session->fatal = true;
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (chunks_window == 0 && create_chunk_buffers(session->transfer.mqtt_window) != ESP_OK)
+    {
+        session->fatal = true;
+        return ESP_ERR_NO_MEM;
+    }
+    /* the buffer keeps the size of the first update */
+    uint32_t window = session->transfer.mqtt_window < chunks_window ? session->transfer.mqtt_window : chunks_window;
+    set_receiving(true);
+    esp_err_t err = send_request(session, window, true);
+    if (err == ESP_OK)
+    {
+        gcp_ota_set_phase(GCP_OTA_PHASE_DOWNLOADING, ESP_OK);
+    }
+    while (err == ESP_OK && (session->download_size == 0 || session->offset < session->download_size))
+    {
+        int64_t wait_start_us = esp_timer_get_time();
+        size_t received = xMessageBufferReceive(chunks, ota_chunk, sizeof(gcp_ota_chunk_t), session->transfer.timeout_ms / portTICK_PERIOD_MS);
+        session->net_us += esp_timer_get_time() - wait_start_us;
+        if (received == 0)
+        {
+            ESP_LOGW(TAG, "[gcp_ota_mqtt_download] no chunk in %u ms", session->transfer.timeout_ms);
+            err = ESP_ERR_TIMEOUT;
+            break;
+        }
+        if (received < CHUNK_HEADER_SIZE || ota_chunk->offset != session->offset)
+        {
+            /* duplicates of a resent window */
+            ESP_LOGD(TAG, "[gcp_ota_mqtt_download] skipping chunk at %u, expecting %u", ota_chunk->offset, session->offset);
+            continue;
+        }
+        size_t length = received - CHUNK_HEADER_SIZE;
+        session->download_size = ota_chunk->total;
+        session->transferred += length;
+        err = session->sink(session, (const char *)ota_chunk->data, length);
+        if (err != ESP_OK)
+        {
+            break;
+        }
+        session->offset += length;
+        gcp_ota_update_progress(session);
+        err = send_request(session, window, false);
+    }
+    set_receiving(false);
+    return err;
+}
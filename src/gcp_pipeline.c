@@ -0,0 +1,215 @@
+#include "gcp_app.h"
+#include "gcp_app_internal.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include <string.h>
+
+#define TAG "GCP_PIPELINE"
+
+#define GCP_PIPELINE_DEFAULT_QUEUE_LENGTH 8
+#define GCP_PIPELINE_DEFAULT_SLOT_SIZE 512
+#define GCP_PIPELINE_NET_TASK_STACK_SIZE 4096
+#define GCP_PIPELINE_STOP_WARN_MS 1000
+
+typedef enum
+{
+    GCP_PIPELINE_MSG_STATE = 0,
+    GCP_PIPELINE_MSG_TELEMETRY,
+} gcp_pipeline_msg_kind_t;
+
+/* topic and payload are stored back to back after the header, both null terminated */
+typedef struct
+{
+    uint8_t kind;
+    uint16_t topic_size;
+    char data[];
+} gcp_pipeline_msg_t;
+
+static void gcp_net_task(void *pvParameter)
+{
+    ESP_LOGI(TAG, "[gcp_net_task] started on core %d", xPortGetCoreID());
+    gcp_app_handle_t app = (gcp_app_handle_t)pvParameter;
+    while (!app->net_task_stop)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        gcp_pipeline_msg_t *msg;
+        while ((msg = gcp_queue_peek(&app->pipeline_queue)) != NULL)
+        {
+            esp_err_t err;
+            if (msg->kind == GCP_PIPELINE_MSG_STATE)
+            {
+                err = gcp_send_state(app->gcp_client, msg->data);
+                /* the app task compares new states with the last queued one, a failed publish makes it queue the state again */
+                app->state_resend = err != ESP_OK;
+                if (err == ESP_OK)
+                {
+                    gcp_ota_health_check_passed(GCP_OTA_CHECK_STATE);
+                }
+            }
+            else
+            {
+                err = gcp_send_telemetry(app->gcp_client, msg->data, msg->data + msg->topic_size);
+            }
+            if (err != ESP_OK)
+            {
+                app->pipeline_failed++;
+            }
+            gcp_queue_release(&app->pipeline_queue);
+        }
+    }
+    ESP_LOGI(TAG, "[gcp_net_task] ended");
+    xEventGroupSetBits(app->app_event_group, GCP_EVENT_NET_TASK_ENDED_BIT);
+    vTaskDelete(NULL);
+}
+
+esp_err_t gcp_pipeline_init(gcp_app_handle_t app)
+{
+    gcp_app_pipeline_config_t *pipeline = &app->app_config->pipeline;
+    if (pipeline->queue_length == 0)
+    {
+        pipeline->queue_length = GCP_PIPELINE_DEFAULT_QUEUE_LENGTH;
+    }
+    if (pipeline->slot_size == 0)
+    {
+        pipeline->slot_size = GCP_PIPELINE_DEFAULT_SLOT_SIZE;
+    }
+    if (pipeline->net_task.stack_size == 0)
+    {
+        pipeline->net_task.stack_size = GCP_PIPELINE_NET_TASK_STACK_SIZE;
+    }
+    if (pipeline->net_task.priority == 0)
+    {
+        pipeline->net_task.priority = GCP_APP_TASK_PRIORITY;
+    }
+    /* serialization stays on the app core, network I/O moves to the other one */
+    if (portNUM_PROCESSORS > 1)
+    {
+        if (!app->app_config->app_task.pin_to_core)
+        {
+            app->app_config->app_task.pin_to_core = true;
+            app->app_config->app_task.core_id = 1;
+        }
+        if (!pipeline->net_task.pin_to_core)
+        {
+            pipeline->net_task.pin_to_core = true;
+            pipeline->net_task.core_id = app->app_config->app_task.core_id ^ 1;
+        }
+    }
+    app->pipeline_lock = xSemaphoreCreateMutexStatic(&app->pipeline_lock_buffer);
+    if (!gcp_queue_init(&app->pipeline_queue, GCP_MEM_APP, pipeline->queue_length, sizeof(gcp_pipeline_msg_t) + pipeline->slot_size))
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t gcp_pipeline_start(gcp_app_handle_t app)
+{
+    gcp_task_config_t *task_config = &app->app_config->pipeline.net_task;
+    BaseType_t core_id = task_config->pin_to_core ? task_config->core_id : tskNO_AFFINITY;
+    app->net_task_stop = false;
+    xEventGroupClearBits(app->app_event_group, GCP_EVENT_NET_TASK_ENDED_BIT);
+    if (xTaskCreatePinnedToCore(&gcp_net_task, "gcp_net_task", task_config->stack_size, app, task_config->priority, &app->net_task, core_id) != pdPASS)
+    {
+        app->net_task = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void gcp_pipeline_stop(gcp_app_handle_t app)
+{
+    if (app->net_task != NULL)
+    {
+        app->net_task_stop = true;
+        xTaskNotifyGive(app->net_task);
+        /* the network task may be publishing straight from a slot with the client, neither can be freed before it ends */
+        while (!(xEventGroupWaitBits(app->app_event_group, GCP_EVENT_NET_TASK_ENDED_BIT, false, true, GCP_PIPELINE_STOP_WARN_MS / portTICK_PERIOD_MS) & GCP_EVENT_NET_TASK_ENDED_BIT))
+        {
+            ESP_LOGW(TAG, "[gcp_pipeline_stop] still waiting for the network task to end");
+        }
+        app->net_task = NULL;
+    }
+    gcp_queue_deinit(&app->pipeline_queue);
+    if (app->pipeline_lock != NULL)
+    {
+        vSemaphoreDelete(app->pipeline_lock);
+        app->pipeline_lock = NULL;
+    }
+}
+
+/* producers may be any task, the lock turns them into the single producer the queue expects */
+static gcp_pipeline_msg_t *acquire_msg(gcp_app_handle_t app)
+{
+    xSemaphoreTake(app->pipeline_lock, portMAX_DELAY);
+    gcp_pipeline_msg_t *msg = gcp_queue_acquire(&app->pipeline_queue);
+    if (msg == NULL)
+    {
+        app->pipeline_dropped++;
+        xSemaphoreGive(app->pipeline_lock);
+    }
+    return msg;
+}
+
+static void commit_msg(gcp_app_handle_t app)
+{
+    gcp_queue_commit(&app->pipeline_queue);
+    xSemaphoreGive(app->pipeline_lock);
+    if (app->net_task != NULL)
+    {
+        xTaskNotifyGive(app->net_task);
+    }
+}
+
+static void cancel_msg(gcp_app_handle_t app)
+{
+    app->pipeline_dropped++;
+    xSemaphoreGive(app->pipeline_lock);
+}
+
+esp_err_t gcp_pipeline_send_state(gcp_app_handle_t app, cJSON *state)
+{
+    gcp_pipeline_msg_t *msg = acquire_msg(app);
+    if (msg == NULL)
+    {
+        ESP_LOGW(TAG, "[gcp_pipeline_send_state] queue is full");
+        return ESP_ERR_NO_MEM;
+    }
+    msg->kind = GCP_PIPELINE_MSG_STATE;
+    msg->topic_size = 0;
+    /* state is encoded straight into the slot */
+    if (!cJSON_PrintPreallocated(state, msg->data, app->app_config->pipeline.slot_size, false))
+    {
+        ESP_LOGE(TAG, "[gcp_pipeline_send_state] state doesn't fit in %d bytes", app->app_config->pipeline.slot_size);
+        cancel_msg(app);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    ESP_LOGD(TAG, "[gcp_pipeline_send_state] queued:%s", msg->data);
+    commit_msg(app);
+    return ESP_OK;
+}
+
+esp_err_t gcp_pipeline_send_telemetry(gcp_app_handle_t app, const char *topic, const char *message)
+{
+    size_t topic_size = strlen(topic) + 1;
+    size_t message_size = strlen(message) + 1;
+    if (topic_size + message_size > app->app_config->pipeline.slot_size)
+    {
+        ESP_LOGE(TAG, "[gcp_pipeline_send_telemetry] message doesn't fit in %d bytes", app->app_config->pipeline.slot_size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    gcp_pipeline_msg_t *msg = acquire_msg(app);
+    if (msg == NULL)
+    {
+        ESP_LOGW(TAG, "[gcp_pipeline_send_telemetry] queue is full");
+        return ESP_ERR_NO_MEM;
+    }
+    msg->kind = GCP_PIPELINE_MSG_TELEMETRY;
+    msg->topic_size = topic_size;
+    memcpy(msg->data, topic, topic_size);
+    memcpy(msg->data + topic_size, message, message_size);
+    commit_msg(app);
+    return ESP_OK;
+}
@@ -0,0 +1,80 @@
+#include "gcp_queue.h"
+#include "esp_log.h"
+#include <string.h>
+
+#define TAG "GCP_QUEUE"
+
+static uint32_t round_up_power_of_two(uint32_t value)
+{
+    uint32_t result = 1;
+    while (result < value)
+    {
+        result <<= 1;
+    }
+    return result;
+}
+
+bool gcp_queue_init(gcp_queue_t *queue, gcp_mem_module_t module, uint32_t slot_count, size_t slot_size)
+{
+    memset(queue, 0, sizeof(*queue));
+    queue->slot_count = round_up_power_of_two(slot_count);
+    /* keep every slot word aligned */
+    queue->slot_size = (slot_size + 3) & ~3;
+    queue->slots = gcp_mem_malloc(module, queue->slot_count * queue->slot_size);
+    if (queue->slots == NULL)
+    {
+        ESP_LOGE(TAG, "[gcp_queue_init] failed to allocate %d slots of %d bytes", queue->slot_count, queue->slot_size);
+        return false;
+    }
+    return true;
+}
+
+void gcp_queue_deinit(gcp_queue_t *queue)
+{
+    gcp_mem_free(queue->slots);
+    queue->slots = NULL;
+}
+
+uint32_t gcp_queue_depth(gcp_queue_t *queue)
+{
+    return __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+}
+
+void *gcp_queue_acquire(gcp_queue_t *queue)
+{
+    uint32_t head = queue->head;
+    uint32_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= queue->slot_count)
+    {
+        return NULL;
+    }
+    return queue->slots + (head & (queue->slot_count - 1)) * queue->slot_size;
+}
+
+void gcp_queue_commit(gcp_queue_t *queue)
+{
+    /* release makes the slot contents visible before the new head */
+    uint32_t head = queue->head + 1;
+    __atomic_store_n(&queue->head, head, __ATOMIC_RELEASE);
+    uint32_t depth = head - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    if (depth > queue->high_water)
+    {
+        queue->high_water = depth;
+    }
+}
+
+void *gcp_queue_peek(gcp_queue_t *queue)
+{
+    uint32_t tail = queue->tail;
+    uint32_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    if (head == tail)
+    {
+        return NULL;
+    }
+    return queue->slots + (tail & (queue->slot_count - 1)) * queue->slot_size;
+}
+
+void gcp_queue_release(gcp_queue_t *queue)
+{
+    __atomic_store_n(&queue->tail, queue->tail + 1, __ATOMIC_RELEASE);
+}
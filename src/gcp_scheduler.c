@@ -0,0 +1,294 @@
+#include "gcp_app.h"
+#include "gcp_app_internal.h"
+#include <freertos/FreeRTOS.h>
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include <string.h>
+
+#define TAG "GCP_SCHEDULER"
+
+#define JOB_IDLE_US INT64_MAX
+
+static bool job_is_idle(gcp_job_t *job)
+{
+    return job->paused || job->period_ms == GCP_APP_JOB_IDLE;
+}
+
+static int64_t jitter_us(gcp_job_t *job)
+{
+    if (job->jitter_ms == 0)
+    {
+        return 0;
+    }
+    return (int64_t)(esp_random() % (job->jitter_ms + 1)) * 1000;
+}
+
+/* restarts the job a full period from now, like xTimerChangePeriod did for the state and pulse timers */
+static void restart_job(gcp_job_t *job, int64_t now_us)
+{
+    if (job_is_idle(job))
+    {
+        job->next_run_us = JOB_IDLE_US;
+        return;
+    }
+    job->base_us = now_us + (int64_t)job->period_ms * 1000;
+    job->next_run_us = job->base_us + jitter_us(job);
+}
+
+static void advance_job(gcp_job_t *job, int64_t now_us)
+{
+    job->base_us += (int64_t)job->period_ms * 1000;
+    if (job->base_us <= now_us)
+    {
+        /* missed runs are dropped instead of running back to back */
+        job->base_us = now_us + (int64_t)job->period_ms * 1000;
+    }
+    job->next_run_us = job->base_us + jitter_us(job);
+}
+
+static gcp_job_t *find_job(gcp_app_handle_t app, const char *name)
+{
+    for (int i = 0; i < GCP_APP_MAX_JOBS; i++)
+    {
+        if (app->jobs[i].callback != NULL && strcmp(app->jobs[i].name, name) == 0)
+        {
+            return &app->jobs[i];
+        }
+    }
+    return NULL;
+}
+
+/* earliest active job that has all the flags */
+static gcp_job_t *earliest_job(gcp_app_handle_t app, uint32_t flags)
+{
+    gcp_job_t *earliest = NULL;
+    for (int i = 0; i < GCP_APP_MAX_JOBS; i++)
+    {
+        gcp_job_t *job = &app->jobs[i];
+        if (job->callback != NULL && !job_is_idle(job) && (job->flags & flags) == flags && (earliest == NULL || job->next_run_us < earliest->next_run_us))
+        {
+            earliest = job;
+        }
+    }
+    return earliest;
+}
+
+void gcp_scheduler_init(gcp_app_handle_t app)
+{
+    memset(app->jobs, 0, sizeof(app->jobs));
+    app->jobs_lock = xSemaphoreCreateMutexStatic(&app->jobs_lock_buffer);
+}
+
+gcp_app_job_t gcp_scheduler_add(gcp_app_handle_t app, const char *name, uint32_t period_ms, uint32_t jitter_ms, uint32_t flags, gcp_app_job_callback_t callback, void *job_context)
+{
+    if (name == NULL || strlen(name) >= GCP_APP_JOB_NAME_SIZE || period_ms == 0 || callback == NULL)
+    {
+        ESP_LOGE(TAG, "[gcp_scheduler_add] invalid job");
+        return -1;
+    }
+    gcp_app_job_t id = -1;
+    xSemaphoreTake(app->jobs_lock, portMAX_DELAY);
+    if (find_job(app, name) != NULL)
+    {
+        ESP_LOGE(TAG, "[gcp_scheduler_add] %s is already scheduled", name);
+        goto end;
+    }
+    for (int i = 0; i < GCP_APP_MAX_JOBS; i++)
+    {
+        gcp_job_t *job = &app->jobs[i];
+        if (job->callback != NULL)
+        {
+            continue;
+        }
+        strcpy(job->name, name);
+        job->callback = callback;
+        job->job_context = job_context;
+        job->period_ms = period_ms;
+        job->jitter_ms = jitter_ms;
+        job->flags = flags;
+        /* there is no connection yet, connected jobs start with the connected callback */
+        job->paused = (flags & GCP_APP_JOB_WHEN_CONNECTED) != 0;
+        restart_job(job, esp_timer_get_time());
+        id = i;
+        break;
+    }
+    if (id < 0)
+    {
+        ESP_LOGE(TAG, "[gcp_scheduler_add] no free slot for %s, GCP_APP_MAX_JOBS is %d", name, GCP_APP_MAX_JOBS);
+    }
+end:
+    xSemaphoreGive(app->jobs_lock);
+    return id;
+}
+
+esp_err_t gcp_scheduler_remove(gcp_app_handle_t app, gcp_app_job_t job)
+{
+    if (job < 0 || job >= GCP_APP_MAX_JOBS)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = ESP_OK;
+    xSemaphoreTake(app->jobs_lock, portMAX_DELAY);
+    if (app->jobs[job].flags & GCP_JOB_INTERNAL)
+    {
+        err = ESP_ERR_INVALID_ARG;
+    }
+    else
+    {
+        memset(&app->jobs[job], 0, sizeof(gcp_job_t));
+    }
+    xSemaphoreGive(app->jobs_lock);
+    return err;
+}
+
+esp_err_t gcp_scheduler_set_period(gcp_app_handle_t app, const char *name, uint32_t period_ms)
+{
+    if (period_ms == 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = ESP_OK;
+    xSemaphoreTake(app->jobs_lock, portMAX_DELAY);
+    gcp_job_t *job = find_job(app, name);
+    if (job == NULL)
+    {
+        err = ESP_ERR_NOT_FOUND;
+    }
+    else if (job->period_ms != period_ms)
+    {
+        ESP_LOGI(TAG, "[gcp_scheduler_set_period] %s period changed to:%d", name, period_ms);
+        job->period_ms = period_ms;
+        restart_job(job, esp_timer_get_time());
+    }
+    xSemaphoreGive(app->jobs_lock);
+    return err;
+}
+
+void gcp_scheduler_set_connected(gcp_app_handle_t app, bool connected)
+{
+    int64_t now_us = esp_timer_get_time();
+    xSemaphoreTake(app->jobs_lock, portMAX_DELAY);
+    for (int i = 0; i < GCP_APP_MAX_JOBS; i++)
+    {
+        gcp_job_t *job = &app->jobs[i];
+        if (job->callback != NULL && (job->flags & GCP_APP_JOB_WHEN_CONNECTED))
+        {
+            job->paused = !connected;
+            restart_job(job, now_us);
+        }
+    }
+    xSemaphoreGive(app->jobs_lock);
+}
+
+/*
+ * Runs the jobs that are due and returns how long the app task can block until the next one.
+ * Once a publishing job runs, the other publishing jobs due within tx_align_slack_ms run in the same pass so the radio wakes once.
+ * A pass runs at most GCP_APP_MAX_JOBS callbacks so a job slower than its period can't starve the end event.
+ */
+TickType_t gcp_scheduler_run(gcp_app_handle_t app)
+{
+    int64_t next_run_us = JOB_IDLE_US;
+    int64_t tx_window_end_us = 0;
+    for (int runs = 0; runs < GCP_APP_MAX_JOBS; runs++)
+    {
+        int64_t now_us = esp_timer_get_time();
+        gcp_app_job_callback_t callback = NULL;
+        void *job_context = NULL;
+        xSemaphoreTake(app->jobs_lock, portMAX_DELAY);
+        gcp_job_t *job = earliest_job(app, 0);
+        bool due = job != NULL && job->next_run_us <= now_us;
+        if (!due && tx_window_end_us > now_us)
+        {
+            gcp_job_t *tx_job = earliest_job(app, GCP_APP_JOB_TX);
+            if (tx_job != NULL && tx_job->next_run_us <= tx_window_end_us)
+            {
+                ESP_LOGD(TAG, "[gcp_scheduler_run] %s aligned %lld us early", tx_job->name, tx_job->next_run_us - now_us);
+                app->tx_aligned++;
+                job = tx_job;
+                due = true;
+            }
+        }
+        if (due)
+        {
+            ESP_LOGD(TAG, "[gcp_scheduler_run] %s", job->name);
+            callback = job->callback;
+            job_context = job->job_context;
+            advance_job(job, now_us);
+            if ((job->flags & GCP_APP_JOB_TX) && tx_window_end_us == 0)
+            {
+                tx_window_end_us = now_us + (int64_t)app->app_config->tx_align_slack_ms * 1000;
+            }
+        }
+        else
+        {
+            next_run_us = job != NULL ? job->next_run_us : JOB_IDLE_US;
+        }
+        xSemaphoreGive(app->jobs_lock);
+        if (callback == NULL)
+        {
+            break;
+        }
+        callback(app, job_context);
+        next_run_us = esp_timer_get_time();
+    }
+    if (next_run_us == JOB_IDLE_US)
+    {
+        return portMAX_DELAY;
+    }
+    int64_t wait_us = next_run_us - esp_timer_get_time();
+    if (wait_us <= 0)
+    {
+        return 0;
+    }
+    /* rounded up so the task doesn't wake a tick early and spin */
+    int64_t wait_ms = (wait_us + 999) / 1000;
+    return (wait_ms + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;
+}
+
+/* runs every active job once, application jobs first so state and pulse report what they did */
+void gcp_scheduler_run_all(gcp_app_handle_t app)
+{
+    uint32_t passes[] = {0, GCP_JOB_INTERNAL};
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int i = 0; i < GCP_APP_MAX_JOBS; i++)
+        {
+            xSemaphoreTake(app->jobs_lock, portMAX_DELAY);
+            gcp_job_t *job = &app->jobs[i];
+            bool run = job->callback != NULL && !job_is_idle(job) && (job->flags & GCP_JOB_INTERNAL) == passes[pass];
+            gcp_app_job_callback_t callback = job->callback;
+            void *job_context = job->job_context;
+            xSemaphoreGive(app->jobs_lock);
+            if (run)
+            {
+                ESP_LOGD(TAG, "[gcp_scheduler_run_all] %s", job->name);
+                callback(app, job_context);
+            }
+        }
+    }
+}
+
+/* "name":period_ms of the application jobs, NULL when there are none */
+cJSON *gcp_scheduler_get_periods(gcp_app_handle_t app)
+{
+    cJSON *json_jobs = NULL;
+    xSemaphoreTake(app->jobs_lock, portMAX_DELAY);
+    for (int i = 0; i < GCP_APP_MAX_JOBS; i++)
+    {
+        gcp_job_t *job = &app->jobs[i];
+        if (job->callback == NULL || (job->flags & GCP_JOB_INTERNAL))
+        {
+            continue;
+        }
+        if (json_jobs == NULL)
+        {
+            json_jobs = cJSON_CreateObject();
+        }
+        /* idle is reported as the -1 device_config uses for it */
+        cJSON_AddNumberToObject(json_jobs, job->name, job->period_ms == GCP_APP_JOB_IDLE ? -1 : job->period_ms);
+    }
+    xSemaphoreGive(app->jobs_lock);
+    return json_jobs;
+}
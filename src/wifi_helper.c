@@ -6,20 +6,82 @@
 #include "freertos/timers.h"
 #include "lwip/err.h"
 #include "lwip/sys.h"
-#include "lwip/apps/sntp.h"
+#include "esp_sntp.h"
 #include "esp_wifi.h"
 #include "esp_log.h"
 #include "esp_err.h"
 #include "esp_tls.h"
 #include "esp_event.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_attr.h"
+#include "device_data.h"
 
+#include <stdio.h>
 #include <string.h>
 
 #define TAG "WIFI_HELPER"
 
-#define SNTP_INIT_BIT BIT1
+#define TIME_SYNCED_BIT BIT1
 #define GOT_IP_BIT BIT0
 
+#define SNTP_TIMEOUT_MS 100000
+#define VALID_EPOCH 946685089 /* 1.1.2000 */
+
+/* posted by the reconnect timer so the attempt runs on the event loop task like the other Wi-Fi events */
+static ESP_EVENT_DEFINE_BASE(WIFI_HELPER_EVENT);
+enum
+{
+    WIFI_HELPER_EVENT_RECONNECT,
+};
+
+#define WIFI_CACHE_KEY "wifi_cache"
+#define WIFI_CACHE_VERSION 1
+
+/* last good association and lease, RTC memory survives deep sleep and NVS a power cycle */
+typedef struct
+{
+    bool valid;
+    char ssid[33];
+    uint8_t bssid[6];
+    uint8_t channel;
+    esp_netif_ip_info_t ip_info;
+    esp_ip4_addr_t dns;
+} wifi_cache_t;
+
+#define WIFI_BACKOFF_MAX_SHIFT 16
+#define WIFI_RECONNECT_POST_RETRY_MS 100
+#define WIFI_RSSI_UNKNOWN -127
+
+/* kept through deep sleep, so the ranking survives wakes */
+typedef struct
+{
+    char ssid[33];
+    int8_t rssi; /* at the last connection */
+    uint16_t successes;
+    uint16_t failures; /* consecutive */
+} wifi_ap_rank_t;
+
+static wifi_credentials_t aps[WIFI_HELPER_MAX_APS];
+static size_t ap_count;
+static size_t current_ap;
+static uint32_t attempts_on_ap;
+static RTC_DATA_ATTR wifi_ap_rank_t ranks[WIFI_HELPER_MAX_APS];
+static wifi_backoff_config_t backoff;
+static esp_timer_handle_t reconnect_timer;
+static wifi_helper_stats_t stats;
+static int64_t offline_since_us;
+static wifi_time_source_t time_source = WIFI_TIME_SOURCE_SNTP;
+static esp_timer_handle_t sntp_timeout_timer;
+static RTC_DATA_ATTR wifi_cache_t cache;
+static wifi_ip_config_t ip_config;
+static wifi_config_t sta_config;
+static esp_netif_t *sta_netif;
+static bool directed; /* the attempt skips the scan, using the cached BSSID and channel */
+static wifi_helper_timings_t timings;
+static int64_t attempt_start_us;
+static int64_t connected_us;
+
 EventGroupHandle_t get_wifi_event_group()
 {
     static EventGroupHandle_t g_wifi_event_group;
@@ -31,46 +93,324 @@ EventGroupHandle_t get_wifi_event_group()
 }
 void wifi_wait_connection()
 {
-    xEventGroupWaitBits(get_wifi_event_group(), SNTP_INIT_BIT, false, true, portMAX_DELAY);
+    xEventGroupWaitBits(get_wifi_event_group(), GOT_IP_BIT | TIME_SYNCED_BIT, false, true, portMAX_DELAY);
+}
+
+void wifi_helper_set_time_source(wifi_time_source_t source)
+{
+    time_source = source;
+}
+
+static void log_time(const char *source)
+{
+    time_t now;
+    time(&now);
+    struct tm timeinfo;
+    localtime_r(&now, &timeinfo);
+    char strftime_buf[64];
+    strftime(strftime_buf, sizeof(strftime_buf), "%c", &timeinfo);
+    ESP_LOGI(TAG, "[log_time] %s time, epoch:%d, date/time:%s", source, (uint32_t)now, strftime_buf);
+}
+
+static void set_time_synced(const char *source)
+{
+    if (sntp_timeout_timer != NULL)
+    {
+        esp_timer_stop(sntp_timeout_timer);
+    }
+    xEventGroupSetBits(get_wifi_event_group(), TIME_SYNCED_BIT);
+    log_time(source);
+}
+
+/* runs on the lwip task, later syncs keep adjusting the clock */
+static void time_sync_notification(struct timeval *tv)
+{
+    set_time_synced("SNTP");
+}
+
+static void sntp_timeout(void *arg)
+{
+    ESP_LOGE(TAG, "[sntp_timeout] no SNTP sync in %d ms", SNTP_TIMEOUT_MS);
+    esp_restart();
+}
+
+/* lwIP stores the servers of the lease before IP_EVENT_STA_GOT_IP, setting names afterwards would replace them */
+static bool dhcp_ntp_server(void)
+{
+#if CONFIG_LWIP_DHCP_GET_NTP_SRV
+    const ip_addr_t *server = sntp_getserver(0);
+    return time_source == WIFI_TIME_SOURCE_DHCP && server != NULL && !ip_addr_isany(server);
+#else
+    return false;
+#endif
 }
 
-void initialize_time(void)
+/* called from the IP event handler, so it only starts SNTP and never waits for it */
+static void start_sntp(void)
 {
     if (sntp_enabled())
     {
-        ESP_LOGI(TAG, "[initialize_time] restarting SNTP");
+        ESP_LOGI(TAG, "[start_sntp] restarting SNTP");
         sntp_restart();
         return;
     }
-    ESP_LOGI(TAG, "[initialize_time] initializing SNTP");
+    ESP_LOGI(TAG, "[start_sntp] initializing SNTP");
     sntp_setoperatingmode(SNTP_OPMODE_POLL);
-    sntp_setservername(0, "time1.google.com");
-    sntp_setservername(1, "pool.ntp.org");
+    if (dhcp_ntp_server())
+    {
+        ESP_LOGI(TAG, "[start_sntp] using the NTP servers of the DHCP lease");
+    }
+    else
+    {
+        sntp_setservername(0, "time1.google.com");
+        sntp_setservername(1, "pool.ntp.org");
+    }
+    sntp_set_time_sync_notification_cb(&time_sync_notification);
     sntp_init();
-
-    time_t now;
-    uint16_t retry_count = 0;
-    do
-    {
-        ESP_LOGD(TAG, "Waiting for sntp retry_count: %d", retry_count);
-        vTaskDelay(1000 / portTICK_RATE_MS);
-        time(&now);
-        retry_count += 1;
-        if (retry_count == 100)
+    if ((xEventGroupGetBits(get_wifi_event_group()) & TIME_SYNCED_BIT) == 0)
+    {
+        esp_timer_create_args_t timer_args = {
+            .callback = &sntp_timeout,
+            .name = "sntp_timeout"};
+        if (sntp_timeout_timer == NULL && esp_timer_create(&timer_args, &sntp_timeout_timer) != ESP_OK)
         {
-            ESP_LOGE(TAG, "SNTP max retry reached");
-            esp_restart();
+            ESP_LOGE(TAG, "[start_sntp] no timeout timer");
+            return;
         }
-    } while (now < 946685089 /* 1.1.2000 */);
-    xEventGroupSetBits(get_wifi_event_group(), SNTP_INIT_BIT);
-    ESP_LOGI(TAG, "The current epoch time is: %d", (uint32_t)now);
+        esp_timer_start_once(sntp_timeout_timer, (uint64_t)SNTP_TIMEOUT_MS * 1000);
+    }
+}
+
+static void initialize_time(void)
+{
     setenv("TZ", "CST6CDT", 1);
     tzset();
-    struct tm timeinfo;
-    localtime_r(&now, &timeinfo);
-    char strftime_buf[64];
-    strftime(strftime_buf, sizeof(strftime_buf), "%c", &timeinfo);
-    ESP_LOGI(TAG, "The current date/time is: %s", strftime_buf);
+    if (time_source == WIFI_TIME_SOURCE_DHCP)
+    {
+#if CONFIG_LWIP_DHCP_GET_NTP_SRV
+        /* has to be set before the DHCP request */
+        sntp_servermode_dhcp(1);
+#else
+        ESP_LOGW(TAG, "[initialize_time] CONFIG_LWIP_DHCP_GET_NTP_SRV is disabled, using the default servers");
+#endif
+    }
+    time_t now;
+    time(&now);
+    if (time_source == WIFI_TIME_SOURCE_RTC && now > VALID_EPOCH)
+    {
+        /* the RTC kept counting through deep sleep or a software reset, SNTP corrects it once connected */
+        set_time_synced("RTC");
+    }
+}
+
+void wifi_helper_set_ip_config(const wifi_ip_config_t *config)
+{
+    ip_config = *config;
+}
+
+void wifi_helper_set_backoff(const wifi_backoff_config_t *config)
+{
+    backoff = *config;
+}
+
+void wifi_helper_get_timings(wifi_helper_timings_t *out)
+{
+    *out = timings;
+}
+
+void wifi_helper_get_stats(wifi_helper_stats_t *out)
+{
+    *out = stats;
+    out->ssid = ap_count > 0 ? aps[current_ap].ssid : NULL;
+}
+
+static void load_cache(void)
+{
+    if (!cache.valid && gcp_nvs_get_blob(WIFI_CACHE_KEY, WIFI_CACHE_VERSION, &cache, sizeof(cache)) != ESP_OK)
+    {
+        memset(&cache, 0, sizeof(cache));
+    }
+}
+
+/* NVS is only written when the AP or the lease changed */
+static void save_cache(const wifi_cache_t *new_cache)
+{
+    if (memcmp(new_cache, &cache, sizeof(cache)) == 0)
+    {
+        return;
+    }
+    cache = *new_cache;
+    gcp_nvs_set_blob(WIFI_CACHE_KEY, WIFI_CACHE_VERSION, &cache, sizeof(cache));
+}
+
+/* ranks follow their ssid, a changed list starts the new ones unknown */
+static void load_ranks(void)
+{
+    for (size_t i = 0; i < ap_count; i++)
+    {
+        if (strcmp(ranks[i].ssid, aps[i].ssid) != 0)
+        {
+            memset(&ranks[i], 0, sizeof(ranks[i]));
+            strcpy(ranks[i].ssid, aps[i].ssid);
+            ranks[i].rssi = WIFI_RSSI_UNKNOWN;
+        }
+    }
+}
+
+/* fewer consecutive failures first, then the stronger last RSSI, then more successes */
+static bool ranks_higher(const wifi_ap_rank_t *a, const wifi_ap_rank_t *b)
+{
+    if (a->failures != b->failures)
+    {
+        return a->failures < b->failures;
+    }
+    if (a->rssi != b->rssi)
+    {
+        return a->rssi > b->rssi;
+    }
+    return a->successes > b->successes;
+}
+
+static size_t best_ap(size_t excluded)
+{
+    size_t best = excluded;
+    for (size_t i = 0; i < ap_count; i++)
+    {
+        if (i != excluded && (best == excluded || ranks_higher(&ranks[i], &ranks[best])))
+        {
+            best = i;
+        }
+    }
+    return best;
+}
+
+/* the cached BSSID and channel are used when they belong to the AP */
+static void use_ap(size_t index)
+{
+    current_ap = index;
+    attempts_on_ap = 0;
+    memset(&sta_config, 0, sizeof(sta_config));
+    strncpy((char *)sta_config.sta.ssid, aps[index].ssid, sizeof(sta_config.sta.ssid));
+    strncpy((char *)sta_config.sta.password, aps[index].passphrase, sizeof(sta_config.sta.password));
+    directed = cache.valid && strcmp(cache.ssid, aps[index].ssid) == 0;
+    if (directed)
+    {
+        /* association without a scan */
+        sta_config.sta.bssid_set = true;
+        memcpy(sta_config.sta.bssid, cache.bssid, sizeof(cache.bssid));
+        sta_config.sta.channel = cache.channel;
+    }
+    ESP_LOGI(TAG, "[use_ap] ssid:%s, rssi:%d, failures:%d, directed:%d", aps[index].ssid, ranks[index].rssi, ranks[index].failures, directed);
+}
+
+static void set_static_ip(const esp_netif_ip_info_t *ip_info, esp_ip4_addr_t dns)
+{
+    esp_netif_dhcpc_stop(sta_netif);
+    esp_netif_set_ip_info(sta_netif, ip_info);
+    esp_netif_dns_info_t dns_info = {0};
+    dns_info.ip.u_addr.ip4 = dns;
+    esp_netif_set_dns_info(sta_netif, ESP_NETIF_DNS_MAIN, &dns_info);
+}
+
+static void apply_ip_config(void)
+{
+    if (ip_config.mode == WIFI_IP_STATIC)
+    {
+        set_static_ip(&ip_config.ip_info, ip_config.dns);
+    }
+    else if (ip_config.mode == WIFI_IP_CACHED_LEASE && directed && cache.ip_info.ip.addr != 0)
+    {
+        ESP_LOGI(TAG, "[apply_ip_config] reusing lease " IPSTR, IP2STR(&cache.ip_info.ip));
+        set_static_ip(&cache.ip_info, cache.dns);
+        timings.static_ip = true;
+    }
+}
+
+/* the cached AP didn't answer, forget it and scan with DHCP */
+static void fall_back_to_scan(void)
+{
+    ESP_LOGW(TAG, "[fall_back_to_scan] directed connect failed");
+    directed = false;
+    cache.valid = false;
+    sta_config.sta.bssid_set = false;
+    sta_config.sta.channel = 0;
+    if (ip_config.mode == WIFI_IP_CACHED_LEASE && timings.static_ip)
+    {
+        timings.static_ip = false;
+        esp_netif_dhcpc_start(sta_netif);
+    }
+}
+
+/* full jitter like the MQTT reconnects, the window doubles with every failed attempt up to max_delay_ms */
+static uint32_t next_backoff_delay_ms(void)
+{
+    uint32_t initial_delay_ms = backoff.initial_delay_ms > 0 ? backoff.initial_delay_ms : WIFI_BACKOFF_DEFAULT_INITIAL_DELAY_MS;
+    uint32_t max_delay_ms = backoff.max_delay_ms > 0 ? backoff.max_delay_ms : WIFI_BACKOFF_DEFAULT_MAX_DELAY_MS;
+    uint32_t shift = stats.failed_attempts < WIFI_BACKOFF_MAX_SHIFT ? stats.failed_attempts : WIFI_BACKOFF_MAX_SHIFT;
+    uint64_t window = (uint64_t)initial_delay_ms << shift;
+    if (window > max_delay_ms)
+    {
+        window = max_delay_ms;
+    }
+    return esp_random() % (window + 1);
+}
+
+/* sta_config and the attempt state belong to the event loop task, the timer only hands the attempt over to it */
+static void reconnect_timer_callback(void *arg)
+{
+    if (esp_event_post(WIFI_HELPER_EVENT, WIFI_HELPER_EVENT_RECONNECT, NULL, 0, 0) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "[reconnect_timer_callback] event loop is full, retrying");
+        esp_timer_start_once(reconnect_timer, (uint64_t)WIFI_RECONNECT_POST_RETRY_MS * 1000);
+    }
+}
+
+static void reconnect_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    attempt_start_us = esp_timer_get_time();
+    esp_wifi_set_config(ESP_IF_WIFI_STA, &sta_config);
+    if (esp_wifi_connect() != ESP_OK)
+    {
+        ESP_LOGE(TAG, "[reconnect_event_handler] esp_wifi_connect failed");
+    }
+}
+
+static void schedule_reconnect(void)
+{
+    stats.next_retry_ms = next_backoff_delay_ms();
+    ESP_LOGI(TAG, "[schedule_reconnect] next attempt in %u ms, failed attempts:%u", stats.next_retry_ms, stats.failed_attempts);
+    esp_timer_stop(reconnect_timer);
+    esp_timer_start_once(reconnect_timer, (uint64_t)stats.next_retry_ms * 1000 + 1);
+}
+
+static void wifi_disconnected(const wifi_event_sta_disconnected_t *event)
+{
+    bool was_connected = (xEventGroupClearBits(get_wifi_event_group(), GOT_IP_BIT) & GOT_IP_BIT) != 0;
+    stats.disconnects++;
+    stats.last_reason = event->reason;
+    if (was_connected)
+    {
+        /* the AP was fine a moment ago, retry it without waiting for the window to grow */
+        offline_since_us = esp_timer_get_time();
+        stats.failed_attempts = 0;
+    }
+    else
+    {
+        stats.failed_attempts++;
+        ranks[current_ap].failures++;
+        attempts_on_ap++;
+        uint32_t attempts_per_ap = backoff.attempts_per_ap > 0 ? backoff.attempts_per_ap : WIFI_BACKOFF_DEFAULT_ATTEMPTS_PER_AP;
+        if (directed)
+        {
+            fall_back_to_scan();
+        }
+        else if (attempts_on_ap >= attempts_per_ap && ap_count > 1)
+        {
+            stats.ap_switches++;
+            use_ap(best_ap(current_ap));
+        }
+    }
+    schedule_reconnect();
 }
 
 static void wifi_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
@@ -79,13 +419,35 @@ static void wifi_event_handler(void *handler_args, esp_event_base_t base, int32_
     {
     case WIFI_EVENT_STA_START:
         ESP_LOGI(TAG, "WIFI_EVENT_STA_START");
+        attempt_start_us = esp_timer_get_time();
         esp_wifi_connect();
         break;
+    case WIFI_EVENT_STA_CONNECTED:
+    {
+        wifi_event_sta_connected_t *event = (wifi_event_sta_connected_t *)event_data;
+        connected_us = esp_timer_get_time();
+        timings.connect_ms = (connected_us - attempt_start_us) / 1000;
+        timings.directed = directed;
+        ESP_LOGI(TAG, "WIFI_EVENT_STA_CONNECTED channel:%d, directed:%d, %u ms", event->channel, directed, timings.connect_ms);
+        wifi_cache_t new_cache = cache;
+        if (strcmp(new_cache.ssid, aps[current_ap].ssid) != 0)
+        {
+            /* the lease belongs to the previous AP, the next IP event stores the one of this AP */
+            memset(&new_cache, 0, sizeof(new_cache));
+            strcpy(new_cache.ssid, aps[current_ap].ssid);
+        }
+        memcpy(new_cache.bssid, event->bssid, sizeof(new_cache.bssid));
+        new_cache.channel = event->channel;
+        save_cache(&new_cache);
+        break;
+    }
     case WIFI_EVENT_STA_DISCONNECTED:
-        ESP_LOGI(TAG, "SYSTEM_EVENT_STA_DISCONNECTED");
-        xEventGroupClearBits(get_wifi_event_group(), GOT_IP_BIT);
-        esp_wifi_connect();
+    {
+        wifi_event_sta_disconnected_t *event = (wifi_event_sta_disconnected_t *)event_data;
+        ESP_LOGI(TAG, "SYSTEM_EVENT_STA_DISCONNECTED reason:%d", event->reason);
+        wifi_disconnected(event);
         break;
+    }
     default:
         break;
     }
@@ -94,9 +456,42 @@ static void got_ip_event_handler(void *arg, esp_event_base_t event_base,
                                  int32_t event_id, void *event_data)
 {
     ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
-    ESP_LOGI(TAG, "got ip: " IPSTR, IP2STR(&event->ip_info.ip));
+    int64_t now = esp_timer_get_time();
+    timings.ip_ms = (now - connected_us) / 1000;
+    timings.connections++;
+    if (offline_since_us != 0)
+    {
+        stats.reconnects++;
+        stats.last_offline_ms = (now - offline_since_us) / 1000;
+        offline_since_us = 0;
+    }
+    stats.failed_attempts = 0;
+    stats.next_retry_ms = 0;
+    wifi_ap_record_t ap_info;
+    if (esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK)
+    {
+        ranks[current_ap].rssi = ap_info.rssi;
+    }
+    ranks[current_ap].failures = 0;
+    ranks[current_ap].successes++;
+    ESP_LOGI(TAG, "got ip: " IPSTR ", %u ms after connecting", IP2STR(&event->ip_info.ip), timings.ip_ms);
+    wifi_cache_t new_cache = cache;
+    new_cache.valid = true;
+    strcpy(new_cache.ssid, aps[current_ap].ssid);
+    new_cache.ip_info = event->ip_info;
+    esp_netif_dns_info_t dns_info;
+    if (esp_netif_get_dns_info(sta_netif, ESP_NETIF_DNS_MAIN, &dns_info) == ESP_OK)
+    {
+        new_cache.dns = dns_info.ip.u_addr.ip4;
+    }
+    save_cache(&new_cache);
+    /* later reconnects try the same AP first */
+    directed = true;
+    sta_config.sta.bssid_set = true;
+    memcpy(sta_config.sta.bssid, cache.bssid, sizeof(cache.bssid));
+    sta_config.sta.channel = cache.channel;
     xEventGroupSetBits(get_wifi_event_group(), GOT_IP_BIT);
-    initialize_time();
+    start_sntp();
 }
 static void lost_ip_event_handler(void *arg, esp_event_base_t event_base,
                                   int32_t event_id, void *event_data)
@@ -107,27 +502,84 @@ static void lost_ip_event_handler(void *arg, esp_event_base_t event_base,
 
 void wifi_helper_set_global_ca_store(const unsigned char *pem_key, size_t pem_key_size)
 {
+    uint32_t free_heap = esp_get_free_heap_size();
+    int64_t start = esp_timer_get_time();
     ESP_ERROR_CHECK(esp_tls_init_global_ca_store());
     ESP_ERROR_CHECK(esp_tls_set_global_ca_store(pem_key, pem_key_size));
+    stats.ca_store_ms = (esp_timer_get_time() - start) / 1000;
+    stats.ca_store_heap = free_heap - esp_get_free_heap_size();
+    ESP_LOGI(TAG, "[wifi_helper_set_global_ca_store] pem bundle loaded in %u ms, heap used:%u", stats.ca_store_ms, stats.ca_store_heap);
+}
+
+/* DER certificates are parsed straight into the store, skipping the base64 decoding and the copy of the PEM bundle */
+void wifi_helper_set_global_ca_store_der(const wifi_helper_der_cert_t *certs, size_t cert_count)
+{
+    uint32_t free_heap = esp_get_free_heap_size();
+    int64_t start = esp_timer_get_time();
+    ESP_ERROR_CHECK(esp_tls_init_global_ca_store());
+    mbedtls_x509_crt *ca_store = esp_tls_get_global_ca_store();
+    for (size_t i = 0; i < cert_count; i++)
+    {
+        int ret = mbedtls_x509_crt_parse_der(ca_store, certs[i].der, certs[i].size);
+        if (ret != 0)
+        {
+            ESP_LOGE(TAG, "[wifi_helper_set_global_ca_store_der] failed to parse certificate %d: -0x%x", i, -ret);
+            ESP_ERROR_CHECK(ESP_FAIL);
+        }
+    }
+    stats.ca_store_ms = (esp_timer_get_time() - start) / 1000;
+    stats.ca_store_heap = free_heap - esp_get_free_heap_size();
+    ESP_LOGI(TAG, "[wifi_helper_set_global_ca_store_der] %d certificates loaded in %u ms, heap used:%u", cert_count, stats.ca_store_ms, stats.ca_store_heap);
 }
 
 void wifi_helper_start(wifi_credentials_t *wifi_credentials)
 {
-    ESP_LOGI(TAG, "[wifi_helper_start] ssid:%s, pass:%s", wifi_credentials->ssid, wifi_credentials->passphrase);
+    wifi_helper_start_list(wifi_credentials, 1);
+}
+
+void wifi_helper_start_list(const wifi_credentials_t *credentials, size_t count)
+{
+    if (count == 0)
+    {
+        ESP_LOGE(TAG, "[wifi_helper_start_list] no credentials");
+        return;
+    }
+    ap_count = count < WIFI_HELPER_MAX_APS ? count : WIFI_HELPER_MAX_APS;
+    memcpy(aps, credentials, ap_count * sizeof(wifi_credentials_t));
+    for (size_t i = 0; i < ap_count; i++)
+    {
+        ESP_LOGI(TAG, "[wifi_helper_start_list] ssid:%s", aps[i].ssid);
+    }
+    initialize_time();
     esp_netif_init();
     ESP_ERROR_CHECK(esp_event_loop_create_default());
-    esp_netif_create_default_wifi_sta();
+    sta_netif = esp_netif_create_default_wifi_sta();
 
     ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, NULL));
     ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &got_ip_event_handler, NULL));
     ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_LOST_IP, &lost_ip_event_handler, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_HELPER_EVENT, WIFI_HELPER_EVENT_RECONNECT, &reconnect_event_handler, NULL));
+    esp_timer_create_args_t timer_args = {
+        .callback = &reconnect_timer_callback,
+        .name = "wifi_reconnect"};
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &reconnect_timer));
 
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
 
-    wifi_config_t sta_config = {};
-    strcpy((char *)sta_config.sta.ssid, wifi_credentials->ssid);
-    strcpy((char *)sta_config.sta.password, wifi_credentials->passphrase);
+    load_cache();
+    load_ranks();
+    /* the AP of the last connection first, else the best ranked one */
+    size_t first = best_ap(WIFI_HELPER_MAX_APS);
+    for (size_t i = 0; i < ap_count; i++)
+    {
+        if (cache.valid && strcmp(cache.ssid, aps[i].ssid) == 0)
+        {
+            first = i;
+        }
+    }
+    use_ap(first);
+    apply_ip_config();
 
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
     ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &sta_config));
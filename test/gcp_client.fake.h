@@ -4,10 +4,19 @@
 #include "fff.h"
 #include "gcp_client.h"
 
+/* the opaque client is completed here so every test hands the framework the same handle of the right type */
+struct gcp_client_t
+{
+    int id;
+};
+static struct gcp_client_t fake_gcp_client;
+
 FAKE_VALUE_FUNC(gcp_client_handle_t, gcp_client_init, gcp_client_config_t *);
+FAKE_VALUE_FUNC(gcp_client_handle_t, gcp_client_init_static, gcp_client_config_t *, gcp_client_static_storage_t *);
 FAKE_VALUE_FUNC(esp_err_t, gcp_client_start, gcp_client_handle_t);
 FAKE_VALUE_FUNC(esp_err_t, gcp_send_state, gcp_client_handle_t, const char *);
 FAKE_VALUE_FUNC(esp_err_t, gcp_send_telemetry, gcp_client_handle_t,  const char *, const char *);
 FAKE_VALUE_FUNC(esp_err_t, gcp_client_destroy, gcp_client_handle_t);
+FAKE_VALUE_FUNC(esp_err_t, gcp_client_get_stats, gcp_client_handle_t, gcp_client_stats_t *);
 
 #endif
\ No newline at end of file
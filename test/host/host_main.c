@@ -0,0 +1,27 @@
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "unity.h"
+
+/* main task stack of ESP-IDF */
+#define APP_MAIN_STACK_SIZE 3584
+
+void app_main(void);
+
+void tearDown(void)
+{
+}
+
+/* app_main of the tests runs on a task like it does on the ESP32, the process exits with the Unity result */
+static void app_main_task(void *arg)
+{
+    app_main();
+    exit(Unity.TestFailures > 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+int main(void)
+{
+    xTaskCreate(&app_main_task, "main", APP_MAIN_STACK_SIZE, NULL, 1, NULL);
+    vTaskStartScheduler();
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,55 @@
+#ifndef HOST_MINIZ__H
+#define HOST_MINIZ__H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zlib.h>
+
+/* the tinfl API of the ROM miniz served by zlib, which keeps its own window so the ring passed in only receives the output */
+
+typedef uint8_t mz_uint8;
+typedef uint32_t mz_uint32;
+
+#define TINFL_LZ_DICT_SIZE 32768
+/* inflate state and its 32 KB window, freeing the decompressor frees them since there is no call to end it */
+#define TINFL_HOST_ARENA_SIZE (48 * 1024)
+
+enum
+{
+    TINFL_FLAG_PARSE_ZLIB_HEADER = 1,
+    TINFL_FLAG_HAS_MORE_INPUT = 2,
+    TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF = 4,
+    TINFL_FLAG_COMPUTE_ADLER32 = 8
+};
+
+typedef enum
+{
+    TINFL_STATUS_FAILED_CANNOT_MAKE_PROGRESS = -4,
+    TINFL_STATUS_BAD_PARAM = -3,
+    TINFL_STATUS_ADLER32_MISMATCH = -2,
+    TINFL_STATUS_FAILED = -1,
+    TINFL_STATUS_DONE = 0,
+    TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+    TINFL_STATUS_HAS_MORE_OUTPUT = 2
+} tinfl_status;
+
+typedef struct
+{
+    int started;
+    int done;
+    z_stream stream;
+    size_t arena_used;
+    mz_uint8 arena[TINFL_HOST_ARENA_SIZE] __attribute__((aligned(16)));
+} tinfl_decompressor;
+
+#define tinfl_init(r)       \
+    do                      \
+    {                       \
+        (r)->started = 0;   \
+        (r)->done = 0;      \
+    } while (0)
+
+tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_next, size_t *pIn_buf_size, mz_uint8 *pOut_buf_start, mz_uint8 *pOut_buf_next, size_t *pOut_buf_size,
+                              const mz_uint32 decomp_flags);
+
+#endif
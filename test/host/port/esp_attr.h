@@ -0,0 +1,10 @@
+#ifndef HOST_ESP_ATTR__H
+#define HOST_ESP_ATTR__H
+
+/* a host process has no RTC memory, it lives as long as the process like a deep sleep that never ends */
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+#endif
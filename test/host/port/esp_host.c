@@ -0,0 +1,242 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/timers.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_sleep.h"
+#include "esp_wifi.h"
+#include "esp_ota_ops.h"
+
+#define TAG "ESP_HOST"
+
+#define MAX_SHUTDOWN_HANDLERS 4
+
+struct esp_timer
+{
+    TimerHandle_t timer;
+    esp_timer_cb_t callback;
+    void *arg;
+    bool periodic;
+    volatile bool armed;
+};
+
+static shutdown_handler_t shutdown_handlers[MAX_SHUTDOWN_HANDLERS];
+
+static const esp_app_desc_t app_desc = {
+    .magic_word = ESP_APP_DESC_MAGIC_WORD,
+    .version = "host",
+    .project_name = "gcp_app_host",
+    .app_elf_sha256 = {0x68, 0x6f, 0x73, 0x74}};
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code)
+    {
+    case ESP_OK:
+        return "ESP_OK";
+    case ESP_FAIL:
+        return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:
+        return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+        return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:
+        return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:
+        return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:
+        return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED:
+        return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT:
+        return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_RESPONSE:
+        return "ESP_ERR_INVALID_RESPONSE";
+    case ESP_ERR_INVALID_VERSION:
+        return "ESP_ERR_INVALID_VERSION";
+    case ESP_ERR_NVS_NOT_INITIALIZED:
+        return "ESP_ERR_NVS_NOT_INITIALIZED";
+    case ESP_ERR_NVS_NOT_FOUND:
+        return "ESP_ERR_NVS_NOT_FOUND";
+    case ESP_ERR_NVS_TYPE_MISMATCH:
+        return "ESP_ERR_NVS_TYPE_MISMATCH";
+    case ESP_ERR_NVS_INVALID_HANDLE:
+        return "ESP_ERR_NVS_INVALID_HANDLE";
+    case ESP_ERR_NVS_KEY_TOO_LONG:
+        return "ESP_ERR_NVS_KEY_TOO_LONG";
+    case ESP_ERR_NVS_INVALID_LENGTH:
+        return "ESP_ERR_NVS_INVALID_LENGTH";
+    case ESP_ERR_WIFI_NOT_CONNECT:
+        return "ESP_ERR_WIFI_NOT_CONNECT";
+    default:
+        return "UNKNOWN ERROR";
+    }
+}
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/* esp_timer callbacks run on the esp_timer task, here on the FreeRTOS timer task */
+static void timer_callback(TimerHandle_t timer)
+{
+    esp_timer_handle_t handle = pvTimerGetTimerID(timer);
+    if (!handle->periodic)
+    {
+        handle->armed = false;
+    }
+    handle->callback(handle->arg);
+}
+
+static TickType_t us_to_ticks(uint64_t us)
+{
+    TickType_t ticks = pdMS_TO_TICKS(us / 1000);
+    return ticks > 0 ? ticks : 1;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+    if (create_args == NULL || create_args->callback == NULL || out_handle == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_timer_handle_t handle = calloc(1, sizeof(struct esp_timer));
+    if (handle == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    handle->callback = create_args->callback;
+    handle->arg = create_args->arg;
+    handle->timer = xTimerCreate(create_args->name != NULL ? create_args->name : "esp_timer", 1, pdFALSE, handle, &timer_callback);
+    if (handle->timer == NULL)
+    {
+        free(handle);
+        return ESP_ERR_NO_MEM;
+    }
+    *out_handle = handle;
+    return ESP_OK;
+}
+
+static esp_err_t start_timer(esp_timer_handle_t timer, uint64_t timeout_us, bool periodic)
+{
+    if (timer->armed)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->periodic = periodic;
+    timer->armed = true;
+    vTimerSetReloadMode(timer->timer, periodic ? pdTRUE : pdFALSE);
+    if (xTimerChangePeriod(timer->timer, us_to_ticks(timeout_us), portMAX_DELAY) != pdPASS)
+    {
+        timer->armed = false;
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return start_timer(timer, timeout_us, false);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+    return start_timer(timer, period, true);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if (!timer->armed)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->armed = false;
+    xTimerStop(timer->timer, portMAX_DELAY);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    if (timer->armed)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xTimerDelete(timer->timer, portMAX_DELAY);
+    free(timer);
+    return ESP_OK;
+}
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handle)
+{
+    for (int i = 0; i < MAX_SHUTDOWN_HANDLERS; i++)
+    {
+        if (shutdown_handlers[i] == handle)
+        {
+            return ESP_ERR_INVALID_STATE;
+        }
+        if (shutdown_handlers[i] == NULL)
+        {
+            shutdown_handlers[i] = handle;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+/* nothing boots again, a run that reaches a restart or a deep sleep ends before Unity reports and fails */
+static void __attribute__((noreturn)) shutdown(const char *reason)
+{
+    for (int i = MAX_SHUTDOWN_HANDLERS - 1; i >= 0; i--)
+    {
+        if (shutdown_handlers[i] != NULL)
+        {
+            shutdown_handlers[i]();
+        }
+    }
+    ESP_LOGE(TAG, "[shutdown] %s ends the host run", reason);
+    exit(EXIT_FAILURE);
+}
+
+void esp_restart(void)
+{
+    shutdown("esp_restart");
+}
+
+esp_reset_reason_t esp_reset_reason(void)
+{
+    return ESP_RST_POWERON;
+}
+
+uint32_t esp_random(void)
+{
+    return ((uint32_t)random() << 16) ^ (uint32_t)random();
+}
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_in_us)
+{
+    return ESP_OK;
+}
+
+void esp_deep_sleep_start(void)
+{
+    shutdown("esp_deep_sleep_start");
+}
+
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap_info)
+{
+    memset(ap_info, 0, sizeof(wifi_ap_record_t));
+    return ESP_ERR_WIFI_NOT_CONNECT;
+}
+
+const esp_app_desc_t *esp_ota_get_app_description(void)
+{
+    return &app_desc;
+}
@@ -0,0 +1,26 @@
+#ifndef HOST_ESP_LOG__H
+#define HOST_ESP_LOG__H
+
+#include <stdio.h>
+
+/* GCP_HOST_LOG_LEVEL 1 error to 4 debug, warnings and errors by default to keep the benchmarks quiet */
+#ifndef GCP_HOST_LOG_LEVEL
+#define GCP_HOST_LOG_LEVEL 2
+#endif
+
+#define HOST_LOG(level, letter, tag, format, ...)                                 \
+    do                                                                            \
+    {                                                                             \
+        if (GCP_HOST_LOG_LEVEL >= (level))                                        \
+        {                                                                         \
+            printf(letter " (%s) " format "\n", tag, ##__VA_ARGS__);              \
+        }                                                                         \
+    } while (0)
+
+#define ESP_LOGE(tag, format, ...) HOST_LOG(1, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) HOST_LOG(2, "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) HOST_LOG(3, "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) HOST_LOG(4, "D", tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) HOST_LOG(5, "V", tag, format, ##__VA_ARGS__)
+
+#endif
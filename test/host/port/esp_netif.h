@@ -0,0 +1,18 @@
+#ifndef HOST_ESP_NETIF__H
+#define HOST_ESP_NETIF__H
+
+#include <stdint.h>
+
+typedef struct
+{
+    uint32_t addr;
+} esp_ip4_addr_t;
+
+typedef struct
+{
+    esp_ip4_addr_t ip;
+    esp_ip4_addr_t netmask;
+    esp_ip4_addr_t gw;
+} esp_netif_ip_info_t;
+
+#endif
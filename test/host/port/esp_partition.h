@@ -0,0 +1,19 @@
+#ifndef HOST_ESP_PARTITION__H
+#define HOST_ESP_PARTITION__H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/* the two OTA slots are RAM buffers */
+typedef struct
+{
+    uint32_t address;
+    uint32_t size;
+    char label[17];
+    uint8_t *data;
+} esp_partition_t;
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size);
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef HOST_ESP_SLEEP__H
+#define HOST_ESP_SLEEP__H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_in_us);
+/* like esp_restart, a host process doesn't wake up */
+void esp_deep_sleep_start(void) __attribute__((noreturn));
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef HOST_ESP_WIFI__H
+#define HOST_ESP_WIFI__H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#define ESP_ERR_WIFI_BASE 0x3000
+#define ESP_ERR_WIFI_NOT_CONNECT (ESP_ERR_WIFI_BASE + 15)
+
+typedef struct
+{
+    uint8_t bssid[6];
+    uint8_t ssid[33];
+    uint8_t primary;
+    int8_t rssi;
+    uint32_t phy_11b : 1;
+    uint32_t phy_11g : 1;
+    uint32_t phy_11n : 1;
+    uint32_t phy_lr : 1;
+} wifi_ap_record_t;
+
+/* the host is never associated */
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap_info);
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef HOST_FREERTOS__H
+#define HOST_FREERTOS__H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+
+/*
+ * The part of the ESP-IDF FreeRTOS API the framework uses, on POSIX threads. Tasks run concurrently like on the two
+ * cores of an ESP32, priorities are ignored and a tick is a millisecond. Static objects are built in their buffers.
+ */
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint8_t StackType_t; /* stacks are counted in bytes like on ESP-IDF */
+
+#define pdFALSE ((BaseType_t)0)
+#define pdTRUE ((BaseType_t)1)
+#define pdFAIL pdFALSE
+#define pdPASS pdTRUE
+
+#define configTICK_RATE_HZ 1000
+#define configMAX_PRIORITIES 25
+#define configASSERT(x) assert(x)
+
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS ((TickType_t)1000 / configTICK_RATE_HZ)
+#define portTICK_RATE_MS portTICK_PERIOD_MS
+#define pdMS_TO_TICKS(ms) ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000))
+#define portNUM_PROCESSORS 2
+
+/* critical sections share one recursive lock, the spinlock argument only keeps the call sites of ESP-IDF */
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+void vPortEnterCritical(void);
+void vPortExitCritical(void);
+#define portENTER_CRITICAL(mux) ((void)(mux), vPortEnterCritical())
+#define portEXIT_CRITICAL(mux) ((void)(mux), vPortExitCritical())
+
+BaseType_t xPortGetCoreID(void);
+
+#define BIT31 0x80000000
+#define BIT30 0x40000000
+#define BIT29 0x20000000
+#define BIT28 0x10000000
+#define BIT27 0x08000000
+#define BIT26 0x04000000
+#define BIT25 0x02000000
+#define BIT24 0x01000000
+#define BIT23 0x00800000
+#define BIT22 0x00400000
+#define BIT21 0x00200000
+#define BIT20 0x00100000
+#define BIT19 0x00080000
+#define BIT18 0x00040000
+#define BIT17 0x00020000
+#define BIT16 0x00010000
+#define BIT15 0x00008000
+#define BIT14 0x00004000
+#define BIT13 0x00002000
+#define BIT12 0x00001000
+#define BIT11 0x00000800
+#define BIT10 0x00000400
+#define BIT9 0x00000200
+#define BIT8 0x00000100
+#define BIT7 0x00000080
+#define BIT6 0x00000040
+#define BIT5 0x00000020
+#define BIT4 0x00000010
+#define BIT3 0x00000008
+#define BIT2 0x00000004
+#define BIT1 0x00000002
+#define BIT0 0x00000001
+
+/* room for the objects of freertos_host.c, checked there */
+typedef struct
+{
+    uint64_t opaque[32];
+} StaticTask_t;
+
+typedef struct
+{
+    uint64_t opaque[24];
+} StaticTimer_t;
+
+typedef struct
+{
+    uint64_t opaque[24];
+} StaticEventGroup_t;
+
+typedef struct
+{
+    uint64_t opaque[24];
+} StaticSemaphore_t;
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef HOST_FREERTOS_MESSAGE_BUFFER__H
+#define HOST_FREERTOS_MESSAGE_BUFFER__H
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+typedef struct host_message_buffer *MessageBufferHandle_t;
+
+/* each message takes its length, a size_t, and its bytes out of buffer_size */
+MessageBufferHandle_t xMessageBufferCreate(size_t buffer_size);
+size_t xMessageBufferSend(MessageBufferHandle_t buffer, const void *data, size_t length, TickType_t ticks_to_wait);
+size_t xMessageBufferReceive(MessageBufferHandle_t buffer, void *data, size_t buffer_length, TickType_t ticks_to_wait);
+BaseType_t xMessageBufferReset(MessageBufferHandle_t buffer);
+void vMessageBufferDelete(MessageBufferHandle_t buffer);
+
+#endif
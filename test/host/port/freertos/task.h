@@ -0,0 +1,31 @@
+#ifndef HOST_FREERTOS_TASK__H
+#define HOST_FREERTOS_TASK__H
+
+#include "freertos/FreeRTOS.h"
+
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+typedef struct host_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+/* stack_depth is only reported back by uxTaskGetStackHighWaterMark, the threads get the default stack */
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stack_depth, void *parameters, UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id);
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t task, const char *name, uint32_t stack_depth, void *parameters, UBaseType_t priority, StackType_t *stack, StaticTask_t *task_buffer, BaseType_t core_id);
+#define xTaskCreate(task, name, stack_depth, parameters, priority, created_task) \
+    xTaskCreatePinnedToCore(task, name, stack_depth, parameters, priority, created_task, tskNO_AFFINITY)
+#define xTaskCreateStatic(task, name, stack_depth, parameters, priority, stack, task_buffer) \
+    xTaskCreateStaticPinnedToCore(task, name, stack_depth, parameters, priority, stack, task_buffer, tskNO_AFFINITY)
+
+/* only the calling task can be deleted */
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear_count_on_exit, TickType_t ticks_to_wait);
+
+/* blocks the thread of main, tasks keep running until one of them exits the process */
+void vTaskStartScheduler(void);
+
+#endif
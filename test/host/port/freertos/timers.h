@@ -0,0 +1,24 @@
+#ifndef HOST_FREERTOS_TIMERS__H
+#define HOST_FREERTOS_TIMERS__H
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+typedef struct host_timer *TimerHandle_t;
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t timer);
+
+/* callbacks run one at a time on the timer service thread, commands take effect before they return */
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t auto_reload, void *timer_id, TimerCallbackFunction_t callback);
+TimerHandle_t xTimerCreateStatic(const char *name, TickType_t period, UBaseType_t auto_reload, void *timer_id, TimerCallbackFunction_t callback, StaticTimer_t *timer_buffer);
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticks_to_wait);
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticks_to_wait);
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t ticks_to_wait);
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t new_period, TickType_t ticks_to_wait);
+BaseType_t xTimerDelete(TimerHandle_t timer, TickType_t ticks_to_wait);
+BaseType_t xTimerIsTimerActive(TimerHandle_t timer);
+void *pvTimerGetTimerID(TimerHandle_t timer);
+const char *pcTimerGetName(TimerHandle_t timer);
+TickType_t xTimerGetPeriod(TimerHandle_t timer);
+void vTimerSetReloadMode(TimerHandle_t timer, UBaseType_t auto_reload);
+
+#endif
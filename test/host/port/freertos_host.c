@@ -0,0 +1,745 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "freertos/timers.h"
+#include "freertos/message_buffer.h"
+
+/*
+ * The FreeRTOS calls the framework makes, on POSIX threads. Tasks run in parallel whatever their priority or core,
+ * stack sizes are only recorded, critical sections share one recursive mutex
+ * that doesn't stop the other tasks, and there are no ISR calls.
+ */
+
+#define HOST_TASK_NAME_SIZE 16
+
+struct host_task
+{
+    TaskFunction_t function;
+    void *parameters;
+    char name[HOST_TASK_NAME_SIZE];
+    uint32_t stack_depth;
+    BaseType_t core_id;
+    bool is_static;
+    pthread_mutex_t lock;
+    pthread_cond_t notified;
+    uint32_t notify_count;
+};
+
+struct host_semaphore
+{
+    pthread_mutex_t lock;
+    pthread_cond_t given;
+    UBaseType_t count;
+    UBaseType_t max_count;
+    bool is_static;
+};
+
+struct host_event_group
+{
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    EventBits_t bits;
+    bool is_static;
+};
+
+struct host_timer
+{
+    const char *name;
+    TickType_t period;
+    UBaseType_t auto_reload;
+    void *timer_id;
+    TimerCallbackFunction_t callback;
+    uint64_t expiry_ms;
+    bool active;
+    bool is_static;
+    bool delete_pending; /* deleted while its callback runs, freed when it returns */
+    struct host_timer *next;
+};
+
+struct host_message_buffer
+{
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    uint8_t *data;
+    size_t size;
+    size_t head; /* next byte read */
+    size_t used;
+};
+
+_Static_assert(sizeof(struct host_task) <= sizeof(StaticTask_t), "StaticTask_t is too small");
+_Static_assert(sizeof(struct host_semaphore) <= sizeof(StaticSemaphore_t), "StaticSemaphore_t is too small");
+_Static_assert(sizeof(struct host_event_group) <= sizeof(StaticEventGroup_t), "StaticEventGroup_t is too small");
+_Static_assert(sizeof(struct host_timer) <= sizeof(StaticTimer_t), "StaticTimer_t is too small");
+
+static pthread_mutex_t critical_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static __thread struct host_task *current_task;
+
+/* timer service, the timers are kept in a list and the thread sleeps until the earliest active one expires */
+static pthread_once_t timer_service_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t timer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timer_changed;
+static struct host_timer *timers;
+static struct host_timer *running_timer;
+
+static uint64_t now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/* ticks count from the start of the process like from boot */
+static uint64_t start_ms;
+
+__attribute__((constructor)) static void record_start(void)
+{
+    start_ms = now_ms();
+}
+
+static void init_cond(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static struct timespec deadline_after(TickType_t ticks)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    uint64_t ns = (uint64_t)ticks * (1000000000ULL / configTICK_RATE_HZ) + deadline.tv_nsec;
+    deadline.tv_sec += ns / 1000000000ULL;
+    deadline.tv_nsec = ns % 1000000000ULL;
+    return deadline;
+}
+
+/* waits on cond with lock held, false once the deadline passed. ticks 0 never waits */
+static bool wait(pthread_cond_t *cond, pthread_mutex_t *lock, TickType_t ticks, const struct timespec *deadline)
+{
+    if (ticks == 0)
+    {
+        return false;
+    }
+    if (ticks == portMAX_DELAY)
+    {
+        pthread_cond_wait(cond, lock);
+        return true;
+    }
+    return pthread_cond_timedwait(cond, lock, deadline) != ETIMEDOUT;
+}
+
+void vPortEnterCritical(void)
+{
+    pthread_mutex_lock(&critical_lock);
+}
+
+void vPortExitCritical(void)
+{
+    pthread_mutex_unlock(&critical_lock);
+}
+
+static void init_task(struct host_task *task, TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameters, BaseType_t core_id)
+{
+    memset(task, 0, sizeof(struct host_task));
+    task->function = function;
+    task->parameters = parameters;
+    strncpy(task->name, name != NULL ? name : "", HOST_TASK_NAME_SIZE - 1);
+    task->stack_depth = stack_depth;
+    task->core_id = core_id;
+    pthread_mutex_init(&task->lock, NULL);
+    init_cond(&task->notified);
+}
+
+static void *task_thread(void *arg)
+{
+    current_task = arg;
+    current_task->function(current_task->parameters);
+    /* a FreeRTOS task must not return, ending it like vTaskDelete(NULL) keeps a broken test from hanging */
+    vTaskDelete(NULL);
+    return NULL;
+}
+
+static bool start_thread(struct host_task *task)
+{
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int err = pthread_create(&thread, &attr, &task_thread, task);
+    pthread_attr_destroy(&attr);
+    return err == 0;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stack_depth, void *parameters, UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id)
+{
+    struct host_task *handle = malloc(sizeof(struct host_task));
+    if (handle == NULL)
+    {
+        return pdFAIL;
+    }
+    init_task(handle, task, name, stack_depth, parameters, core_id);
+    if (created_task != NULL)
+    {
+        *created_task = handle;
+    }
+    if (!start_thread(handle))
+    {
+        free(handle);
+        return pdFAIL;
+    }
+    return pdPASS;
+}
+
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t task, const char *name, uint32_t stack_depth, void *parameters, UBaseType_t priority, StackType_t *stack, StaticTask_t *task_buffer, BaseType_t core_id)
+{
+    struct host_task *handle = (struct host_task *)task_buffer;
+    init_task(handle, task, name, stack_depth, parameters, core_id);
+    handle->is_static = true;
+    return start_thread(handle) ? handle : NULL;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    configASSERT(task == NULL || task == current_task);
+    struct host_task *self = current_task;
+    if (self != NULL && !self->is_static)
+    {
+        free(self);
+    }
+    current_task = NULL;
+    pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec delay = {
+        .tv_sec = ticks / configTICK_RATE_HZ,
+        .tv_nsec = (long)(ticks % configTICK_RATE_HZ) * (1000000000L / configTICK_RATE_HZ)};
+    while (nanosleep(&delay, &delay) != 0 && errno == EINTR)
+    {
+    }
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)((now_ms() - start_ms) * configTICK_RATE_HZ / 1000);
+}
+
+/* threads not started by xTaskCreate, like the timer service, get a handle when they first need one */
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    if (current_task == NULL)
+    {
+        current_task = malloc(sizeof(struct host_task));
+        configASSERT(current_task != NULL);
+        init_task(current_task, NULL, "thread", 0, NULL, tskNO_AFFINITY);
+    }
+    return current_task;
+}
+
+BaseType_t xPortGetCoreID(void)
+{
+    return current_task == NULL || current_task->core_id == tskNO_AFFINITY ? 0 : current_task->core_id;
+}
+
+/* thread stacks aren't measured, the whole stack is reported free */
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    task = task != NULL ? task : xTaskGetCurrentTaskHandle();
+    return task->stack_depth;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->lock);
+    task->notify_count++;
+    pthread_cond_signal(&task->notified);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_count_on_exit, TickType_t ticks_to_wait)
+{
+    struct host_task *task = xTaskGetCurrentTaskHandle();
+    struct timespec deadline = deadline_after(ticks_to_wait);
+    pthread_mutex_lock(&task->lock);
+    while (task->notify_count == 0 && wait(&task->notified, &task->lock, ticks_to_wait, &deadline))
+    {
+    }
+    uint32_t count = task->notify_count;
+    if (count > 0)
+    {
+        task->notify_count = clear_count_on_exit ? 0 : count - 1;
+    }
+    pthread_mutex_unlock(&task->lock);
+    return count;
+}
+
+void vTaskStartScheduler(void)
+{
+    for (;;)
+    {
+        pause();
+    }
+}
+
+static void init_semaphore(struct host_semaphore *semaphore, UBaseType_t count, UBaseType_t max_count)
+{
+    memset(semaphore, 0, sizeof(struct host_semaphore));
+    pthread_mutex_init(&semaphore->lock, NULL);
+    init_cond(&semaphore->given);
+    semaphore->count = count;
+    semaphore->max_count = max_count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    struct host_semaphore *semaphore = malloc(sizeof(struct host_semaphore));
+    if (semaphore != NULL)
+    {
+        init_semaphore(semaphore, 1, 1);
+    }
+    return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *semaphore_buffer)
+{
+    struct host_semaphore *semaphore = (struct host_semaphore *)semaphore_buffer;
+    init_semaphore(semaphore, 1, 1);
+    semaphore->is_static = true;
+    return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    struct host_semaphore *semaphore = malloc(sizeof(struct host_semaphore));
+    if (semaphore != NULL)
+    {
+        init_semaphore(semaphore, 0, 1);
+    }
+    return semaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait)
+{
+    struct timespec deadline = deadline_after(ticks_to_wait);
+    pthread_mutex_lock(&semaphore->lock);
+    while (semaphore->count == 0 && wait(&semaphore->given, &semaphore->lock, ticks_to_wait, &deadline))
+    {
+    }
+    BaseType_t taken = semaphore->count > 0 ? pdTRUE : pdFALSE;
+    if (taken)
+    {
+        semaphore->count--;
+    }
+    pthread_mutex_unlock(&semaphore->lock);
+    return taken;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    pthread_mutex_lock(&semaphore->lock);
+    BaseType_t given = semaphore->count < semaphore->max_count ? pdTRUE : pdFALSE;
+    if (given)
+    {
+        semaphore->count++;
+        pthread_cond_signal(&semaphore->given);
+    }
+    pthread_mutex_unlock(&semaphore->lock);
+    return given;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+    pthread_cond_destroy(&semaphore->given);
+    pthread_mutex_destroy(&semaphore->lock);
+    if (!semaphore->is_static)
+    {
+        free(semaphore);
+    }
+}
+
+static void init_event_group(struct host_event_group *event_group)
+{
+    memset(event_group, 0, sizeof(struct host_event_group));
+    pthread_mutex_init(&event_group->lock, NULL);
+    init_cond(&event_group->changed);
+}
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    struct host_event_group *event_group = malloc(sizeof(struct host_event_group));
+    if (event_group != NULL)
+    {
+        init_event_group(event_group);
+    }
+    return event_group;
+}
+
+EventGroupHandle_t xEventGroupCreateStatic(StaticEventGroup_t *event_group_buffer)
+{
+    struct host_event_group *event_group = (struct host_event_group *)event_group_buffer;
+    init_event_group(event_group);
+    event_group->is_static = true;
+    return event_group;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t event_group, EventBits_t bits)
+{
+    pthread_mutex_lock(&event_group->lock);
+    event_group->bits |= bits;
+    EventBits_t result = event_group->bits;
+    pthread_cond_broadcast(&event_group->changed);
+    pthread_mutex_unlock(&event_group->lock);
+    return result;
+}
+
+/* returns the bits before they were cleared, like FreeRTOS */
+EventBits_t xEventGroupClearBits(EventGroupHandle_t event_group, EventBits_t bits)
+{
+    pthread_mutex_lock(&event_group->lock);
+    EventBits_t result = event_group->bits;
+    event_group->bits &= ~bits;
+    pthread_mutex_unlock(&event_group->lock);
+    return result;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t event_group)
+{
+    pthread_mutex_lock(&event_group->lock);
+    EventBits_t result = event_group->bits;
+    pthread_mutex_unlock(&event_group->lock);
+    return result;
+}
+
+static bool bits_match(EventBits_t current, EventBits_t bits, BaseType_t wait_for_all)
+{
+    return wait_for_all ? (current & bits) == bits : (current & bits) != 0;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t event_group, EventBits_t bits, BaseType_t clear_on_exit, BaseType_t wait_for_all, TickType_t ticks_to_wait)
+{
+    struct timespec deadline = deadline_after(ticks_to_wait);
+    pthread_mutex_lock(&event_group->lock);
+    while (!bits_match(event_group->bits, bits, wait_for_all) && wait(&event_group->changed, &event_group->lock, ticks_to_wait, &deadline))
+    {
+    }
+    EventBits_t result = event_group->bits;
+    if (clear_on_exit && bits_match(result, bits, wait_for_all))
+    {
+        event_group->bits &= ~bits;
+    }
+    pthread_mutex_unlock(&event_group->lock);
+    return result;
+}
+
+void vEventGroupDelete(EventGroupHandle_t event_group)
+{
+    pthread_cond_destroy(&event_group->changed);
+    pthread_mutex_destroy(&event_group->lock);
+    if (!event_group->is_static)
+    {
+        free(event_group);
+    }
+}
+
+static struct host_timer *earliest_timer(void)
+{
+    struct host_timer *earliest = NULL;
+    for (struct host_timer *timer = timers; timer != NULL; timer = timer->next)
+    {
+        if (timer->active && (earliest == NULL || timer->expiry_ms < earliest->expiry_ms))
+        {
+            earliest = timer;
+        }
+    }
+    return earliest;
+}
+
+static void unlink_timer(struct host_timer *timer)
+{
+    for (struct host_timer **link = &timers; *link != NULL; link = &(*link)->next)
+    {
+        if (*link == timer)
+        {
+            *link = timer->next;
+            return;
+        }
+    }
+}
+
+static void *timer_service(void *arg)
+{
+    pthread_mutex_lock(&timer_lock);
+    for (;;)
+    {
+        struct host_timer *timer = earliest_timer();
+        if (timer == NULL)
+        {
+            pthread_cond_wait(&timer_changed, &timer_lock);
+            continue;
+        }
+        uint64_t now = now_ms();
+        if (timer->expiry_ms > now)
+        {
+            struct timespec deadline = deadline_after(pdMS_TO_TICKS(timer->expiry_ms - now));
+            pthread_cond_timedwait(&timer_changed, &timer_lock, &deadline);
+            continue;
+        }
+        if (timer->auto_reload)
+        {
+            timer->expiry_ms += timer->period;
+            if (timer->expiry_ms <= now)
+            {
+                timer->expiry_ms = now + timer->period;
+            }
+        }
+        else
+        {
+            timer->active = false;
+        }
+        running_timer = timer;
+        pthread_mutex_unlock(&timer_lock);
+        timer->callback(timer);
+        pthread_mutex_lock(&timer_lock);
+        running_timer = NULL;
+        if (timer->delete_pending && !timer->is_static)
+        {
+            free(timer);
+        }
+    }
+    return NULL;
+}
+
+static void start_timer_service(void)
+{
+    init_cond(&timer_changed);
+    pthread_t thread;
+    pthread_create(&thread, NULL, &timer_service, NULL);
+    pthread_detach(thread);
+}
+
+static struct host_timer *init_timer(struct host_timer *timer, const char *name, TickType_t period, UBaseType_t auto_reload, void *timer_id, TimerCallbackFunction_t callback)
+{
+    pthread_once(&timer_service_once, &start_timer_service);
+    memset(timer, 0, sizeof(struct host_timer));
+    timer->name = name;
+    timer->period = period;
+    timer->auto_reload = auto_reload;
+    timer->timer_id = timer_id;
+    timer->callback = callback;
+    pthread_mutex_lock(&timer_lock);
+    timer->next = timers;
+    timers = timer;
+    pthread_mutex_unlock(&timer_lock);
+    return timer;
+}
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t auto_reload, void *timer_id, TimerCallbackFunction_t callback)
+{
+    struct host_timer *timer = malloc(sizeof(struct host_timer));
+    return timer != NULL ? init_timer(timer, name, period, auto_reload, timer_id, callback) : NULL;
+}
+
+TimerHandle_t xTimerCreateStatic(const char *name, TickType_t period, UBaseType_t auto_reload, void *timer_id, TimerCallbackFunction_t callback, StaticTimer_t *timer_buffer)
+{
+    struct host_timer *timer = init_timer((struct host_timer *)timer_buffer, name, period, auto_reload, timer_id, callback);
+    timer->is_static = true;
+    return timer;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticks_to_wait)
+{
+    pthread_mutex_lock(&timer_lock);
+    timer->active = true;
+    timer->expiry_ms = now_ms() + timer->period;
+    pthread_cond_signal(&timer_changed);
+    pthread_mutex_unlock(&timer_lock);
+    return pdPASS;
+}
+
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t ticks_to_wait)
+{
+    return xTimerStart(timer, ticks_to_wait);
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t new_period, TickType_t ticks_to_wait)
+{
+    pthread_mutex_lock(&timer_lock);
+    timer->period = new_period;
+    pthread_mutex_unlock(&timer_lock);
+    return xTimerStart(timer, ticks_to_wait);
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticks_to_wait)
+{
+    pthread_mutex_lock(&timer_lock);
+    timer->active = false;
+    pthread_cond_signal(&timer_changed);
+    pthread_mutex_unlock(&timer_lock);
+    return pdPASS;
+}
+
+BaseType_t xTimerDelete(TimerHandle_t timer, TickType_t ticks_to_wait)
+{
+    pthread_mutex_lock(&timer_lock);
+    unlink_timer(timer);
+    timer->active = false;
+    if (timer == running_timer)
+    {
+        timer->delete_pending = true;
+    }
+    else if (!timer->is_static)
+    {
+        free(timer);
+    }
+    pthread_cond_signal(&timer_changed);
+    pthread_mutex_unlock(&timer_lock);
+    return pdPASS;
+}
+
+BaseType_t xTimerIsTimerActive(TimerHandle_t timer)
+{
+    pthread_mutex_lock(&timer_lock);
+    BaseType_t active = timer->active ? pdTRUE : pdFALSE;
+    pthread_mutex_unlock(&timer_lock);
+    return active;
+}
+
+void *pvTimerGetTimerID(TimerHandle_t timer)
+{
+    return timer->timer_id;
+}
+
+const char *pcTimerGetName(TimerHandle_t timer)
+{
+    return timer->name;
+}
+
+TickType_t xTimerGetPeriod(TimerHandle_t timer)
+{
+    return timer->period;
+}
+
+void vTimerSetReloadMode(TimerHandle_t timer, UBaseType_t auto_reload)
+{
+    pthread_mutex_lock(&timer_lock);
+    timer->auto_reload = auto_reload;
+    pthread_mutex_unlock(&timer_lock);
+}
+
+MessageBufferHandle_t xMessageBufferCreate(size_t buffer_size)
+{
+    struct host_message_buffer *buffer = calloc(1, sizeof(struct host_message_buffer));
+    if (buffer == NULL)
+    {
+        return NULL;
+    }
+    buffer->data = malloc(buffer_size);
+    if (buffer->data == NULL)
+    {
+        free(buffer);
+        return NULL;
+    }
+    buffer->size = buffer_size;
+    pthread_mutex_init(&buffer->lock, NULL);
+    init_cond(&buffer->changed);
+    return buffer;
+}
+
+static void ring_write(struct host_message_buffer *buffer, const void *data, size_t length)
+{
+    const uint8_t *in = data;
+    for (size_t i = 0; i < length; i++)
+    {
+        buffer->data[(buffer->head + buffer->used + i) % buffer->size] = in[i];
+    }
+    buffer->used += length;
+}
+
+static void ring_peek(struct host_message_buffer *buffer, void *data, size_t offset, size_t length)
+{
+    uint8_t *out = data;
+    for (size_t i = 0; i < length; i++)
+    {
+        out[i] = buffer->data[(buffer->head + offset + i) % buffer->size];
+    }
+}
+
+size_t xMessageBufferSend(MessageBufferHandle_t buffer, const void *data, size_t length, TickType_t ticks_to_wait)
+{
+    size_t needed = sizeof(size_t) + length;
+    if (needed > buffer->size)
+    {
+        return 0;
+    }
+    struct timespec deadline = deadline_after(ticks_to_wait);
+    pthread_mutex_lock(&buffer->lock);
+    while (buffer->size - buffer->used < needed && wait(&buffer->changed, &buffer->lock, ticks_to_wait, &deadline))
+    {
+    }
+    size_t sent = 0;
+    if (buffer->size - buffer->used >= needed)
+    {
+        ring_write(buffer, &length, sizeof(size_t));
+        ring_write(buffer, data, length);
+        sent = length;
+        pthread_cond_broadcast(&buffer->changed);
+    }
+    pthread_mutex_unlock(&buffer->lock);
+    return sent;
+}
+
+/* like FreeRTOS a message longer than buffer_length stays in the buffer and 0 is returned */
+size_t xMessageBufferReceive(MessageBufferHandle_t buffer, void *data, size_t buffer_length, TickType_t ticks_to_wait)
+{
+    struct timespec deadline = deadline_after(ticks_to_wait);
+    pthread_mutex_lock(&buffer->lock);
+    while (buffer->used == 0 && wait(&buffer->changed, &buffer->lock, ticks_to_wait, &deadline))
+    {
+    }
+    size_t received = 0;
+    if (buffer->used > 0)
+    {
+        size_t length;
+        ring_peek(buffer, &length, 0, sizeof(size_t));
+        if (length <= buffer_length)
+        {
+            ring_peek(buffer, data, sizeof(size_t), length);
+            buffer->head = (buffer->head + sizeof(size_t) + length) % buffer->size;
+            buffer->used -= sizeof(size_t) + length;
+            received = length;
+            pthread_cond_broadcast(&buffer->changed);
+        }
+    }
+    pthread_mutex_unlock(&buffer->lock);
+    return received;
+}
+
+BaseType_t xMessageBufferReset(MessageBufferHandle_t buffer)
+{
+    pthread_mutex_lock(&buffer->lock);
+    buffer->head = 0;
+    buffer->used = 0;
+    pthread_cond_broadcast(&buffer->changed);
+    pthread_mutex_unlock(&buffer->lock);
+    return pdPASS;
+}
+
+void vMessageBufferDelete(MessageBufferHandle_t buffer)
+{
+    pthread_cond_destroy(&buffer->changed);
+    pthread_mutex_destroy(&buffer->lock);
+    free(buffer->data);
+    free(buffer);
+}
@@ -0,0 +1,113 @@
+#include <string.h>
+#include "esp_log.h"
+#include "gcp_ota.h"
+
+#define TAG "GCP_OTA_HOST"
+
+/* the host has no partitions to flash, updates are refused and the running firmware never needs verifying */
+
+void gcp_ota_get_running_app_version(char *version)
+{
+    strcpy(version, "host");
+}
+
+esp_err_t gcp_ota_update_firmware(const gcp_ota_request_t *request)
+{
+    ESP_LOGW(TAG, "[gcp_ota_update_firmware] no OTA on the host");
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t gcp_ota_start(const gcp_ota_request_t *request, const gcp_task_config_t *task_config)
+{
+    return gcp_ota_update_firmware(request);
+}
+
+void gcp_ota_mqtt_chunk_received(const char *chunk)
+{
+    ESP_LOGW(TAG, "[gcp_ota_mqtt_chunk_received] no update running");
+}
+
+void gcp_ota_get_progress(gcp_ota_progress_t *progress)
+{
+    memset(progress, 0, sizeof(gcp_ota_progress_t));
+}
+
+const char *gcp_ota_phase_name(gcp_ota_phase_t phase)
+{
+    switch (phase)
+    {
+    case GCP_OTA_PHASE_IDLE:
+        return "idle";
+    case GCP_OTA_PHASE_CONNECTING:
+        return "connecting";
+    case GCP_OTA_PHASE_DOWNLOADING:
+        return "downloading";
+    case GCP_OTA_PHASE_VERIFYING:
+        return "verifying";
+    case GCP_OTA_PHASE_REBOOTING:
+        return "rebooting";
+    case GCP_OTA_PHASE_FAILED:
+        return "failed";
+    }
+    return "unknown";
+}
+
+const char *gcp_ota_compression_name(gcp_ota_compression_t compression)
+{
+    switch (compression)
+    {
+    case GCP_OTA_COMPRESSION_NONE:
+        return "none";
+    case GCP_OTA_COMPRESSION_GZIP:
+        return "gzip";
+    case GCP_OTA_COMPRESSION_ZLIB:
+        return "zlib";
+    }
+    return "unknown";
+}
+
+gcp_ota_compression_t gcp_ota_compression_from_name(const char *name)
+{
+    if (name != NULL && strcmp(name, "gzip") == 0)
+    {
+        return GCP_OTA_COMPRESSION_GZIP;
+    }
+    if (name != NULL && strcmp(name, "zlib") == 0)
+    {
+        return GCP_OTA_COMPRESSION_ZLIB;
+    }
+    return GCP_OTA_COMPRESSION_NONE;
+}
+
+void gcp_ota_health_begin(uint32_t timeout_ms)
+{
+}
+
+void gcp_ota_health_check_passed(uint32_t check)
+{
+}
+
+void gcp_ota_get_health(gcp_ota_health_t *health)
+{
+    memset(health, 0, sizeof(gcp_ota_health_t));
+}
+
+const char *gcp_ota_health_name(gcp_ota_health_state_t state)
+{
+    switch (state)
+    {
+    case GCP_OTA_HEALTH_PENDING:
+        return "pending";
+    case GCP_OTA_HEALTH_VALID:
+        return "valid";
+    case GCP_OTA_HEALTH_ROLLED_BACK:
+        return "rolled_back";
+    default:
+        return "none";
+    }
+}
+
+esp_err_t gcp_ota_get_last_update(gcp_ota_result_t *result)
+{
+    return ESP_ERR_NOT_FOUND;
+}
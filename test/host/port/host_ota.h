@@ -0,0 +1,20 @@
+#ifndef HOST_OTA__H
+#define HOST_OTA__H
+
+#include <stddef.h>
+
+/* controls of the OTA shims for the tests */
+
+#define HOST_PARTITION_SIZE (256 * 1024)
+
+/* copied into the running slot, the rest of it reads 0xff like erased flash */
+void host_ota_set_running_image(const void *image, size_t size);
+/* bytes esp_ota_write put into the update slot since esp_ota_begin */
+size_t host_ota_written(void);
+/* data is kept by reference until host_http_reset, NULL stops serving url */
+void host_http_serve(const char *url, const void *data, size_t size);
+void host_http_reset(void);
+/* connections opened to url since host_http_reset */
+int host_http_requests(const char *url);
+
+#endif
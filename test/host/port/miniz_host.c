@@ -0,0 +1,69 @@
+#include <string.h>
+#include "esp32/rom/miniz.h"
+
+static voidpf arena_alloc(voidpf opaque, uInt items, uInt size)
+{
+    tinfl_decompressor *r = opaque;
+    size_t bytes = ((size_t)items * size + 15) & ~(size_t)15;
+    if (r->arena_used + bytes > sizeof(r->arena))
+    {
+        return Z_NULL;
+    }
+    voidpf ptr = r->arena + r->arena_used;
+    r->arena_used += bytes;
+    return ptr;
+}
+
+static void arena_free(voidpf opaque, voidpf ptr)
+{
+}
+
+tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_next, size_t *pIn_buf_size, mz_uint8 *pOut_buf_start, mz_uint8 *pOut_buf_next, size_t *pOut_buf_size,
+                              const mz_uint32 decomp_flags)
+{
+    if (!r->started)
+    {
+        memset(&r->stream, 0, sizeof(r->stream));
+        r->stream.zalloc = &arena_alloc;
+        r->stream.zfree = &arena_free;
+        r->stream.opaque = r;
+        r->arena_used = 0;
+        if (inflateInit2(&r->stream, decomp_flags & TINFL_FLAG_PARSE_ZLIB_HEADER ? MAX_WBITS : -MAX_WBITS) != Z_OK)
+        {
+            *pIn_buf_size = 0;
+            *pOut_buf_size = 0;
+            return TINFL_STATUS_BAD_PARAM;
+        }
+        r->started = 1;
+    }
+    if (r->done)
+    {
+        *pIn_buf_size = 0;
+        *pOut_buf_size = 0;
+        return TINFL_STATUS_DONE;
+    }
+    r->stream.next_in = (Bytef *)pIn_buf_next;
+    r->stream.avail_in = *pIn_buf_size;
+    r->stream.next_out = pOut_buf_next;
+    r->stream.avail_out = *pOut_buf_size;
+    int ret = inflate(&r->stream, Z_NO_FLUSH);
+    *pIn_buf_size -= r->stream.avail_in;
+    *pOut_buf_size -= r->stream.avail_out;
+    switch (ret)
+    {
+    case Z_STREAM_END:
+        r->done = 1;
+        return TINFL_STATUS_DONE;
+    case Z_OK:
+    case Z_BUF_ERROR:
+        if (r->stream.avail_out == 0)
+        {
+            return TINFL_STATUS_HAS_MORE_OUTPUT;
+        }
+        return decomp_flags & TINFL_FLAG_HAS_MORE_INPUT ? TINFL_STATUS_NEEDS_MORE_INPUT : TINFL_STATUS_FAILED_CANNOT_MAKE_PROGRESS;
+    case Z_DATA_ERROR:
+        return r->stream.msg != NULL && strcmp(r->stream.msg, "incorrect data check") == 0 ? TINFL_STATUS_ADLER32_MISMATCH : TINFL_STATUS_FAILED;
+    default:
+        return TINFL_STATUS_FAILED;
+    }
+}
@@ -0,0 +1,9 @@
+#ifndef HOST_NVS_FLASH__H
+#define HOST_NVS_FLASH__H
+
+#include "nvs.h"
+
+esp_err_t nvs_flash_init(void);
+esp_err_t nvs_flash_erase(void);
+
+#endif
@@ -0,0 +1,216 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "nvs_flash.h"
+
+#define NVS_HOST_MAX_NAMESPACES 8
+#define NVS_HOST_MAX_ENTRIES 64
+
+typedef struct
+{
+    uint32_t ns;
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    void *data;
+    size_t size;
+} nvs_entry_t;
+
+/* handles are namespace index + 1, commits have nothing to do since every set lands in RAM right away */
+static char namespaces[NVS_HOST_MAX_NAMESPACES][NVS_KEY_NAME_MAX_SIZE];
+static nvs_entry_t entries[NVS_HOST_MAX_ENTRIES];
+static bool initialized;
+static SemaphoreHandle_t lock;
+
+static void take(void)
+{
+    if (lock == NULL)
+    {
+        lock = xSemaphoreCreateMutex();
+    }
+    xSemaphoreTake(lock, portMAX_DELAY);
+}
+
+static void give(void)
+{
+    xSemaphoreGive(lock);
+}
+
+static nvs_entry_t *find(nvs_handle_t handle, const char *key)
+{
+    for (int i = 0; i < NVS_HOST_MAX_ENTRIES; i++)
+    {
+        if (entries[i].data != NULL && entries[i].ns == handle && strcmp(entries[i].key, key) == 0)
+        {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+static esp_err_t check(nvs_handle_t handle, const char *key)
+{
+    if (!initialized)
+    {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    if (handle == 0 || handle > NVS_HOST_MAX_NAMESPACES)
+    {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (key != NULL && strlen(key) >= NVS_KEY_NAME_MAX_SIZE)
+    {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    initialized = true;
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    take();
+    for (int i = 0; i < NVS_HOST_MAX_ENTRIES; i++)
+    {
+        free(entries[i].data);
+    }
+    memset(entries, 0, sizeof(entries));
+    memset(namespaces, 0, sizeof(namespaces));
+    give();
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    if (!initialized)
+    {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    if (strlen(name) >= NVS_KEY_NAME_MAX_SIZE)
+    {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+    esp_err_t err = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    take();
+    for (int i = 0; i < NVS_HOST_MAX_NAMESPACES; i++)
+    {
+        if (namespaces[i][0] == '\0')
+        {
+            strcpy(namespaces[i], name);
+        }
+        if (strcmp(namespaces[i], name) == 0)
+        {
+            *out_handle = i + 1;
+            err = ESP_OK;
+            break;
+        }
+    }
+    give();
+    return err;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    esp_err_t err = check(handle, key);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    take();
+    nvs_entry_t *entry = find(handle, key);
+    if (entry == NULL)
+    {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    }
+    else if (out_value == NULL)
+    {
+        *length = entry->size;
+    }
+    else if (*length < entry->size)
+    {
+        *length = entry->size;
+        err = ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    else
+    {
+        memcpy(out_value, entry->data, entry->size);
+        *length = entry->size;
+    }
+    give();
+    return err;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    esp_err_t err = check(handle, key);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    /* a zero length blob is stored with one byte so data stays non NULL */
+    void *data = malloc(length > 0 ? length : 1);
+    if (data == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(data, value, length);
+    take();
+    nvs_entry_t *entry = find(handle, key);
+    for (int i = 0; entry == NULL && i < NVS_HOST_MAX_ENTRIES; i++)
+    {
+        if (entries[i].data == NULL)
+        {
+            entry = &entries[i];
+            entry->ns = handle;
+            strcpy(entry->key, key);
+        }
+    }
+    if (entry == NULL)
+    {
+        free(data);
+        err = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+    else
+    {
+        free(entry->data);
+        entry->data = data;
+        entry->size = length;
+    }
+    give();
+    return err;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    esp_err_t err = check(handle, key);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    take();
+    nvs_entry_t *entry = find(handle, key);
+    if (entry == NULL)
+    {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    }
+    else
+    {
+        free(entry->data);
+        memset(entry, 0, sizeof(nvs_entry_t));
+    }
+    give();
+    return err;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return check(handle, NULL);
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
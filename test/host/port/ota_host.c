@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_http_client.h"
+#include "gcp_ota_internal.h"
+#include "host_ota.h"
+
+#define TAG "OTA_HOST"
+
+#define MAX_SERVED_FILES 4
+#define OTA_HANDLE 1
+
+typedef struct
+{
+    const char *url;
+    const uint8_t *data;
+    size_t size;
+    int requests;
+} served_file_t;
+
+struct esp_http_client
+{
+    esp_http_client_config_t config;
+    served_file_t *file;
+    size_t range_start;
+    size_t position;
+    int status;
+};
+
+static uint8_t running_data[HOST_PARTITION_SIZE];
+static uint8_t update_data[HOST_PARTITION_SIZE];
+static const esp_partition_t running_partition = {.address = 0x10000, .size = HOST_PARTITION_SIZE, .label = "ota_0", .data = running_data};
+static const esp_partition_t update_partition = {.address = 0x110000, .size = HOST_PARTITION_SIZE, .label = "ota_1", .data = update_data};
+static size_t update_written;
+static bool update_open;
+static served_file_t served_files[MAX_SERVED_FILES];
+
+void host_ota_set_running_image(const void *image, size_t size)
+{
+    memset(running_data, 0xff, sizeof(running_data));
+    memcpy(running_data, image, size);
+}
+
+size_t host_ota_written(void)
+{
+    return update_written;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+    if (src_offset > partition->size || size > partition->size - src_offset)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dst, partition->data + src_offset, size);
+    return ESP_OK;
+}
+
+const esp_partition_t *esp_ota_get_running_partition(void)
+{
+    return &running_partition;
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from)
+{
+    return &update_partition;
+}
+
+esp_err_t esp_ota_get_partition_description(const esp_partition_t *partition, esp_app_desc_t *app_desc)
+{
+    memcpy(app_desc, partition->data + sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t), sizeof(esp_app_desc_t));
+    return app_desc->magic_word == ESP_APP_DESC_MAGIC_WORD ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t esp_ota_begin(const esp_partition_t *partition, size_t image_size, esp_ota_handle_t *out_handle)
+{
+    if (partition != &update_partition)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(update_data, 0xff, sizeof(update_data));
+    update_written = 0;
+    update_open = true;
+    *out_handle = OTA_HANDLE;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size)
+{
+    if (handle != OTA_HANDLE || !update_open)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (size > sizeof(update_data) - update_written)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(update_data + update_written, data, size);
+    update_written += size;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_end(esp_ota_handle_t handle)
+{
+    if (handle != OTA_HANDLE || !update_open)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    update_open = false;
+    return update_data[0] == ESP_IMAGE_HEADER_MAGIC ? ESP_OK : ESP_ERR_OTA_VALIDATE_FAILED;
+}
+
+esp_err_t esp_ota_abort(esp_ota_handle_t handle)
+{
+    update_open = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition)
+{
+    ESP_LOGW(TAG, "[esp_ota_set_boot_partition] the host can't boot %s", partition->label);
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+/* the MQTT transport needs gcp_client, the fakes of the app tests don't deliver chunks */
+esp_err_t gcp_ota_mqtt_download(gcp_ota_session_t *session)
+{
+    session->fatal = true;
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void host_http_serve(const char *url, const void *data, size_t size)
+{
+    served_file_t *free_slot = NULL;
+    for (int i = 0; i < MAX_SERVED_FILES; i++)
+    {
+        if (served_files[i].url != NULL && strcmp(served_files[i].url, url) == 0)
+        {
+            free_slot = &served_files[i];
+            break;
+        }
+        if (served_files[i].url == NULL && free_slot == NULL)
+        {
+            free_slot = &served_files[i];
+        }
+    }
+    if (free_slot == NULL)
+    {
+        ESP_LOGE(TAG, "[host_http_serve] more than %d files", MAX_SERVED_FILES);
+        abort();
+    }
+    *free_slot = (served_file_t){.url = data != NULL ? url : NULL, .data = data, .size = size};
+}
+
+void host_http_reset(void)
+{
+    memset(served_files, 0, sizeof(served_files));
+}
+
+int host_http_requests(const char *url)
+{
+    for (int i = 0; i < MAX_SERVED_FILES; i++)
+    {
+        if (served_files[i].url != NULL && strcmp(served_files[i].url, url) == 0)
+        {
+            return served_files[i].requests;
+        }
+    }
+    return 0;
+}
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config)
+{
+    esp_http_client_handle_t client = calloc(1, sizeof(struct esp_http_client));
+    if (client != NULL)
+    {
+        client->config = *config;
+    }
+    return client;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value)
+{
+    unsigned int start;
+    if (strcasecmp(key, "Range") == 0 && sscanf(value, "bytes=%u-", &start) == 1)
+    {
+        client->range_start = start;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len)
+{
+    for (int i = 0; i < MAX_SERVED_FILES; i++)
+    {
+        if (served_files[i].url != NULL && strcmp(served_files[i].url, client->config.url) == 0)
+        {
+            client->file = &served_files[i];
+            client->file->requests++;
+            return ESP_OK;
+        }
+    }
+    client->status = 404;
+    return ESP_OK;
+}
+
+int esp_http_client_fetch_headers(esp_http_client_handle_t client)
+{
+    if (client->file == NULL)
+    {
+        return 0;
+    }
+    if (client->range_start == 0)
+    {
+        client->status = 200;
+        return client->file->size;
+    }
+    if (client->range_start >= client->file->size)
+    {
+        client->status = 416;
+        return 0;
+    }
+    client->status = 206;
+    client->position = client->range_start;
+    char value[48];
+    snprintf(value, sizeof(value), "bytes %u-%u/%u", (unsigned)client->range_start, (unsigned)client->file->size - 1, (unsigned)client->file->size);
+    esp_http_client_event_t event = {
+        .event_id = HTTP_EVENT_ON_HEADER,
+        .client = client,
+        .user_data = client->config.user_data,
+        .header_key = "Content-Range",
+        .header_value = value};
+    if (client->config.event_handler != NULL)
+    {
+        client->config.event_handler(&event);
+    }
+    return client->file->size - client->range_start;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client)
+{
+    return client->status;
+}
+
+int esp_http_client_read(esp_http_client_handle_t client, char *buffer, int len)
+{
+    if (client->file == NULL)
+    {
+        return -1;
+    }
+    size_t left = client->file->size - client->position;
+    size_t read = left < (size_t)len ? left : (size_t)len;
+    memcpy(buffer, client->file->data + client->position, read);
+    client->position += read;
+    return read;
+}
+
+bool esp_http_client_is_complete_data_received(esp_http_client_handle_t client)
+{
+    return client->file != NULL && client->position == client->file->size;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+    free(client);
+    return ESP_OK;
+}
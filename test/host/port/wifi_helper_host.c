@@ -0,0 +1,26 @@
+#include <string.h>
+#include "esp_log.h"
+#include "wifi_helper.h"
+
+#define TAG "WIFI_HELPER_HOST"
+
+/* the host network is always up, the helper only reports that it never had to connect */
+
+void wifi_helper_start(wifi_credentials_t *wifi_credentials)
+{
+    ESP_LOGI(TAG, "[wifi_helper_start] using the host network");
+}
+
+void wifi_wait_connection()
+{
+}
+
+void wifi_helper_get_timings(wifi_helper_timings_t *timings)
+{
+    memset(timings, 0, sizeof(wifi_helper_timings_t));
+}
+
+void wifi_helper_get_stats(wifi_helper_stats_t *stats)
+{
+    memset(stats, 0, sizeof(wifi_helper_stats_t));
+}
@@ -0,0 +1,11 @@
+#ifndef TEST_DATA__H
+#define TEST_DATA__H
+
+/* identifiers of the host build, the fakes never reach a bridge */
+#define PROJECT_ID "host-project"
+#define REGION "us-central1"
+#define REGISTERY "host-registry"
+#define DEVICE_ID "host-device"
+#define GCP_DEVICE_ID DEVICE_ID
+
+#endif
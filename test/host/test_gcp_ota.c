@@ -0,0 +1,403 @@
+#include "unity.h"
+#include <string.h>
+#include <zlib.h>
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "gcp_ota.h"
+#include "gcp_ota_internal.h"
+#include "gcp_mem.h"
+#include "host_ota.h"
+
+#define TAG "TEST_OTA"
+
+/* larger than the 32 KB window so the inflate ring wraps */
+#define IMAGE_SIZE (48 * 1024)
+#define IMAGE_VERSION "2.0.0"
+#define GZIP_EXTRA_SIZE 300 /* XLEN has a high byte */
+#define GZIP_NAME "image.bin"
+#define GZIP_COMMENT "petit_gcp"
+#define GZIP_MAX_SIZE (IMAGE_SIZE + 1024)
+#define BASE_VERSION "1.0.0"
+#define PATCH_MAX_SIZE 2048
+#define PATCH_INSERT_OFFSET 20000
+#define PATCH_INSERT_SIZE 100
+#define PATCH_TAIL_SIZE 50
+#define FULL_URL "https://ota.example.com/image.bin"
+#define PATCH_URL "https://ota.example.com/image.patch"
+
+static uint8_t image[IMAGE_SIZE];
+static uint8_t base[IMAGE_SIZE];
+static uint8_t gzip[GZIP_MAX_SIZE];
+static uint8_t patch[PATCH_MAX_SIZE];
+static uint8_t flashed[IMAGE_SIZE];
+
+void setUp(void)
+{
+    host_http_reset();
+}
+
+/* an application image header then runs of a slowly changing pattern, compressible but not trivially */
+static void make_image(uint8_t *data, size_t size, const char *version, uint32_t seed)
+{
+    memset(data, 0, sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t));
+    data[0] = ESP_IMAGE_HEADER_MAGIC;
+    esp_app_desc_t desc = {.magic_word = ESP_APP_DESC_MAGIC_WORD};
+    strncpy(desc.version, version, sizeof(desc.version) - 1);
+    memcpy(data + sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t), &desc, sizeof(desc));
+    uint32_t state = seed;
+    for (size_t i = GCP_OTA_IMAGE_HEADER_SIZE; i < size; i++)
+    {
+        if (i % 64 == 0)
+        {
+            state = state * 1103515245 + 12345;
+        }
+        data[i] = (state >> 16) + i % 7;
+    }
+}
+
+static size_t put_bytes(uint8_t *out, const void *data, size_t size)
+{
+    memcpy(out, data, size);
+    return size;
+}
+
+/* a gzip member with every optional header field, header_size gets the bytes before the deflate stream */
+static size_t make_gzip(const uint8_t *data, size_t size, size_t *header_size)
+{
+    size_t length = 0;
+    const uint8_t fixed[] = {0x1f, 0x8b, 8, (1 << 1) | (1 << 2) | (1 << 3) | (1 << 4), 0, 0, 0, 0, 0, 3};
+    length += put_bytes(gzip + length, fixed, sizeof(fixed));
+    gzip[length++] = GZIP_EXTRA_SIZE & 0xff;
+    gzip[length++] = GZIP_EXTRA_SIZE >> 8;
+    /* 0 in the extra field must not end it like it ends the name */
+    memset(gzip + length, 0, GZIP_EXTRA_SIZE);
+    length += GZIP_EXTRA_SIZE;
+    length += put_bytes(gzip + length, GZIP_NAME, sizeof(GZIP_NAME));
+    length += put_bytes(gzip + length, GZIP_COMMENT, sizeof(GZIP_COMMENT));
+    uint32_t header_crc = crc32(0, gzip, length);
+    gzip[length++] = header_crc & 0xff;
+    gzip[length++] = (header_crc >> 8) & 0xff;
+    *header_size = length;
+
+    z_stream stream = {0};
+    TEST_ASSERT_EQUAL(Z_OK, deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY));
+    stream.next_in = (Bytef *)data;
+    stream.avail_in = size;
+    stream.next_out = gzip + length;
+    stream.avail_out = GZIP_MAX_SIZE - length - 8;
+    TEST_ASSERT_EQUAL(Z_STREAM_END, deflate(&stream, Z_FINISH));
+    length += stream.total_out;
+    deflateEnd(&stream);
+
+    uint32_t trailer[2] = {crc32(0, data, size), size};
+    length += put_bytes(gzip + length, trailer, sizeof(trailer));
+    return length;
+}
+
+static void begin_session(gcp_ota_session_t *session, const gcp_ota_request_t *request)
+{
+    memset(session, 0, sizeof(gcp_ota_session_t));
+    session->request = request;
+    TEST_ASSERT_EQUAL(ESP_OK, esp_ota_begin(esp_ota_get_next_update_partition(NULL), OTA_WITH_SEQUENTIAL_WRITES, &session->ota_handle));
+}
+
+static void end_session(gcp_ota_session_t *session)
+{
+    gcp_mem_free(session->decoder);
+    esp_ota_abort(session->ota_handle);
+}
+
+static void assert_flashed(const uint8_t *expected, size_t size, const char *message)
+{
+    TEST_ASSERT_EQUAL_MESSAGE(size, host_ota_written(), message);
+    TEST_ASSERT_EQUAL(ESP_OK, esp_partition_read(esp_ota_get_next_update_partition(NULL), 0, flashed, size));
+    TEST_ASSERT_EQUAL_MEMORY_MESSAGE(expected, flashed, size, message);
+}
+
+/* the header parser keeps its state across writes, any split of it must give the same image */
+void test_ota_gzip_header_split(void)
+{
+    make_image(image, IMAGE_SIZE, IMAGE_VERSION, 1);
+    size_t header_size;
+    size_t gzip_size = make_gzip(image, IMAGE_SIZE, &header_size);
+    gcp_ota_request_t request = {.compression = GCP_OTA_COMPRESSION_GZIP};
+    gcp_ota_session_t session;
+    char message[48];
+
+    for (size_t split = 0; split <= header_size; split++)
+    {
+        snprintf(message, sizeof(message), "split at %u", (unsigned)split);
+        begin_session(&session, &request);
+        TEST_ASSERT_EQUAL(ESP_OK, gcp_ota_inflate_begin(&session));
+        TEST_ASSERT_EQUAL_MESSAGE(ESP_OK, gcp_ota_inflate_write(&session, (const char *)gzip, split), message);
+        TEST_ASSERT_FALSE_MESSAGE(session.decoder_done, message);
+        TEST_ASSERT_EQUAL_MESSAGE(ESP_OK, gcp_ota_inflate_write(&session, (const char *)gzip + split, gzip_size - split), message);
+        TEST_ASSERT_TRUE_MESSAGE(session.decoder_done, message);
+        assert_flashed(image, IMAGE_SIZE, message);
+        end_session(&session);
+    }
+
+    /* one byte per write through the whole header and into the stream */
+    begin_session(&session, &request);
+    TEST_ASSERT_EQUAL(ESP_OK, gcp_ota_inflate_begin(&session));
+    for (size_t i = 0; i < header_size + 16; i++)
+    {
+        TEST_ASSERT_EQUAL(ESP_OK, gcp_ota_inflate_write(&session, (const char *)gzip + i, 1));
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, gcp_ota_inflate_write(&session, (const char *)gzip + header_size + 16, gzip_size - header_size - 16));
+    TEST_ASSERT_TRUE(session.decoder_done);
+    assert_flashed(image, IMAGE_SIZE, "byte per write");
+    end_session(&session);
+}
+
+/* a bad magic or method is fatal wherever the header is split */
+void test_ota_gzip_not_deflate(void)
+{
+    make_image(image, IMAGE_SIZE, IMAGE_VERSION, 1);
+    size_t header_size;
+    size_t gzip_size = make_gzip(image, IMAGE_SIZE, &header_size);
+    gzip[2] = 9;
+    gcp_ota_request_t request = {.compression = GCP_OTA_COMPRESSION_GZIP};
+    gcp_ota_session_t session;
+
+    for (size_t split = 0; split <= 3; split++)
+    {
+        begin_session(&session, &request);
+        TEST_ASSERT_EQUAL(ESP_OK, gcp_ota_inflate_begin(&session));
+        esp_err_t err = gcp_ota_inflate_write(&session, (const char *)gzip, split);
+        if (err == ESP_OK)
+        {
+            err = gcp_ota_inflate_write(&session, (const char *)gzip + split, gzip_size - split);
+        }
+        TEST_ASSERT_EQUAL(ESP_ERR_INVALID_RESPONSE, err);
+        TEST_ASSERT_TRUE(session.fatal);
+        TEST_ASSERT_EQUAL(0, host_ota_written());
+        end_session(&session);
+    }
+}
+
+static size_t put_u32(uint8_t *out, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        out[i] = value >> (8 * i);
+    }
+    return 4;
+}
+
+static size_t put_copy(uint8_t *out, uint32_t offset, uint32_t length)
+{
+    out[0] = 0x01;
+    put_u32(out + 1, offset);
+    put_u32(out + 5, length);
+    return 9;
+}
+
+static size_t put_insert(uint8_t *out, const uint8_t *data, uint32_t length)
+{
+    out[0] = 0x02;
+    put_u32(out + 1, length);
+    return 5 + put_bytes(out + 5, data, length);
+}
+
+/*
+ * The new image is the base with another header, a changed block and a changed tail, rebuilt from copies and inserts.
+ * ops gets the offset of every op so the tests can cut the patch or corrupt one.
+ */
+static size_t make_patch(size_t *ops, size_t *op_count)
+{
+    make_image(base, IMAGE_SIZE, BASE_VERSION, 1);
+    make_image(image, IMAGE_SIZE, IMAGE_VERSION, 1);
+    for (size_t i = PATCH_INSERT_OFFSET; i < PATCH_INSERT_OFFSET + PATCH_INSERT_SIZE; i++)
+    {
+        image[i] ^= 0x5a;
+    }
+    for (size_t i = IMAGE_SIZE - PATCH_TAIL_SIZE; i < IMAGE_SIZE; i++)
+    {
+        image[i] = i;
+    }
+    host_ota_set_running_image(base, IMAGE_SIZE);
+
+    size_t length = put_bytes(patch, "GDP1", 4);
+    length += put_u32(patch + length, IMAGE_SIZE);
+    length += put_u32(patch + length, IMAGE_SIZE);
+    size_t count = 0;
+    ops[count++] = length;
+    length += put_insert(patch + length, image, GCP_OTA_IMAGE_HEADER_SIZE);
+    ops[count++] = length;
+    length += put_copy(patch + length, GCP_OTA_IMAGE_HEADER_SIZE, PATCH_INSERT_OFFSET - GCP_OTA_IMAGE_HEADER_SIZE);
+    ops[count++] = length;
+    length += put_insert(patch + length, image + PATCH_INSERT_OFFSET, PATCH_INSERT_SIZE);
+    ops[count++] = length;
+    length += put_copy(patch + length, PATCH_INSERT_OFFSET + PATCH_INSERT_SIZE, IMAGE_SIZE - PATCH_TAIL_SIZE - PATCH_INSERT_OFFSET - PATCH_INSERT_SIZE);
+    ops[count++] = length;
+    length += put_insert(patch + length, image + IMAGE_SIZE - PATCH_TAIL_SIZE, PATCH_TAIL_SIZE);
+    ops[count++] = length;
+    patch[length++] = 0x00;
+    *op_count = count;
+    return length;
+}
+
+/* writes the patch in two parts, returns the first error */
+static esp_err_t apply_patch(gcp_ota_session_t *session, const uint8_t *data, size_t size, size_t split)
+{
+    esp_err_t err = gcp_ota_delta_begin(session);
+    if (err == ESP_OK)
+    {
+        err = gcp_ota_delta_write(session, (const char *)data, split);
+    }
+    if (err == ESP_OK)
+    {
+        err = gcp_ota_delta_write(session, (const char *)data + split, size - split);
+    }
+    return err;
+}
+
+/* fields and inserts are collected across writes, any split of the patch must give the same image */
+void test_ota_delta_split(void)
+{
+    size_t ops[8];
+    size_t op_count;
+    size_t patch_size = make_patch(ops, &op_count);
+    gcp_ota_request_t request = {0};
+    gcp_ota_session_t session;
+    char message[48];
+
+    for (size_t split = 0; split <= patch_size; split++)
+    {
+        snprintf(message, sizeof(message), "split at %u", (unsigned)split);
+        begin_session(&session, &request);
+        TEST_ASSERT_EQUAL_MESSAGE(ESP_OK, apply_patch(&session, patch, patch_size, split), message);
+        TEST_ASSERT_TRUE_MESSAGE(session.decoder_done, message);
+        assert_flashed(image, IMAGE_SIZE, message);
+        end_session(&session);
+    }
+
+    begin_session(&session, &request);
+    TEST_ASSERT_EQUAL(ESP_OK, gcp_ota_delta_begin(&session));
+    for (size_t i = 0; i < patch_size; i++)
+    {
+        TEST_ASSERT_EQUAL(ESP_OK, gcp_ota_delta_write(&session, (const char *)patch + i, 1));
+    }
+    TEST_ASSERT_TRUE(session.decoder_done);
+    assert_flashed(image, IMAGE_SIZE, "byte per write");
+    end_session(&session);
+}
+
+/* a bad patch is fatal so the download isn't retried, the full image is tried instead */
+static void assert_patch_rejected(const uint8_t *data, size_t size, esp_err_t expected, const char *message)
+{
+    gcp_ota_request_t request = {0};
+    gcp_ota_session_t session;
+    for (size_t split = 0; split <= size; split += 7)
+    {
+        begin_session(&session, &request);
+        TEST_ASSERT_EQUAL_MESSAGE(expected, apply_patch(&session, data, size, split), message);
+        TEST_ASSERT_TRUE_MESSAGE(session.fatal, message);
+        TEST_ASSERT_FALSE_MESSAGE(session.decoder_done, message);
+        end_session(&session);
+    }
+}
+
+void test_ota_delta_malformed(void)
+{
+    size_t ops[8];
+    size_t op_count;
+    size_t patch_size = make_patch(ops, &op_count);
+    static uint8_t bad[PATCH_MAX_SIZE];
+
+    memcpy(bad, patch, patch_size);
+    bad[3] = '2';
+    assert_patch_rejected(bad, patch_size, ESP_ERR_INVALID_RESPONSE, "magic");
+
+    memcpy(bad, patch, patch_size);
+    put_u32(bad + 8, HOST_PARTITION_SIZE + 1);
+    assert_patch_rejected(bad, patch_size, ESP_ERR_INVALID_RESPONSE, "base larger than the partition");
+
+    memcpy(bad, patch, patch_size);
+    bad[ops[1]] = 0x7f;
+    assert_patch_rejected(bad, patch_size, ESP_ERR_INVALID_RESPONSE, "unknown op");
+
+    memcpy(bad, patch, patch_size);
+    put_u32(bad + ops[3] + 1, IMAGE_SIZE - PATCH_TAIL_SIZE);
+    assert_patch_rejected(bad, patch_size, ESP_ERR_INVALID_RESPONSE, "copy past the base");
+
+    memcpy(bad, patch, patch_size);
+    put_u32(bad + ops[3] + 5, 0xfffffff0);
+    assert_patch_rejected(bad, patch_size, ESP_ERR_INVALID_RESPONSE, "copy length wraps the offset");
+
+    memcpy(bad, patch, patch_size);
+    put_u32(bad + 4, IMAGE_SIZE + 1);
+    assert_patch_rejected(bad, patch_size, ESP_ERR_INVALID_SIZE, "end before the target size");
+
+    /* a patch cut anywhere before its end op takes every byte without an error, install reports the truncation */
+    gcp_ota_request_t request = {0};
+    gcp_ota_session_t session;
+    char message[48];
+    for (size_t size = 0; size < patch_size; size++)
+    {
+        snprintf(message, sizeof(message), "cut at %u", (unsigned)size);
+        begin_session(&session, &request);
+        TEST_ASSERT_EQUAL_MESSAGE(ESP_OK, apply_patch(&session, patch, size, size / 2), message);
+        TEST_ASSERT_FALSE_MESSAGE(session.decoder_done, message);
+        TEST_ASSERT_FALSE_MESSAGE(session.fatal, message);
+        end_session(&session);
+    }
+}
+
+/* the host refuses the boot switch, so an update that got through the download and verification returns ESP_ERR_NOT_SUPPORTED */
+static void assert_update(const gcp_ota_request_t *request, int patch_requests, int full_requests, const char *message)
+{
+    TEST_ASSERT_EQUAL_MESSAGE(ESP_ERR_NOT_SUPPORTED, gcp_ota_update_firmware(request), message);
+    TEST_ASSERT_EQUAL_MESSAGE(patch_requests, host_http_requests(PATCH_URL), message);
+    TEST_ASSERT_EQUAL_MESSAGE(full_requests, host_http_requests(FULL_URL), message);
+    assert_flashed(image, IMAGE_SIZE, message);
+}
+
+void test_ota_delta_fallback(void)
+{
+    size_t ops[8];
+    size_t op_count;
+    size_t patch_size = make_patch(ops, &op_count);
+    static uint8_t bad[PATCH_MAX_SIZE];
+    gcp_ota_request_t request = {
+        .url = FULL_URL,
+        .patch_url = PATCH_URL,
+        .patch_base_version = BASE_VERSION,
+        .size = IMAGE_SIZE,
+        .transfer = {.read_size = 100}};
+
+    host_http_serve(FULL_URL, image, IMAGE_SIZE);
+    host_http_serve(PATCH_URL, patch, patch_size);
+    assert_update(&request, 1, 0, "patch applies");
+
+    host_http_reset();
+    host_http_serve(FULL_URL, image, IMAGE_SIZE);
+    memcpy(bad, patch, patch_size);
+    bad[ops[2]] = 0x7f;
+    host_http_serve(PATCH_URL, bad, patch_size);
+    assert_update(&request, 1, 1, "malformed patch");
+
+    host_http_reset();
+    host_http_serve(FULL_URL, image, IMAGE_SIZE);
+    host_http_serve(PATCH_URL, patch, ops[3]);
+    assert_update(&request, 1, 1, "truncated patch");
+
+    /* a patch for another base isn't downloaded */
+    host_http_reset();
+    host_http_serve(FULL_URL, image, IMAGE_SIZE);
+    host_http_serve(PATCH_URL, patch, patch_size);
+    request.patch_base_version = "0.9.0";
+    assert_update(&request, 0, 1, "other base");
+}
+
+void app_main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_ota_gzip_header_split);
+    RUN_TEST(test_ota_gzip_not_deflate);
+    RUN_TEST(test_ota_delta_split);
+    RUN_TEST(test_ota_delta_malformed);
+    RUN_TEST(test_ota_delta_fallback);
+    UNITY_END();
+}
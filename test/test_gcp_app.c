@@ -9,8 +9,10 @@
 #include "gcp_app_internal.h"
 #include "gcp_jwt.h"
 #include "device_data.h"
+#include "gcp_mem.h"
 #include "wifi_helper.h"
 #include "esp_wifi.h"
+#include "esp_timer.h"
 #include "test_data.h"
 
 #include "gcp_client.fake.h"
@@ -63,10 +65,14 @@ void setUp(void)
 {
     // Register resets
     RESET_FAKE(gcp_client_init);
+    RESET_FAKE(gcp_client_init_static);
     RESET_FAKE(gcp_client_start);
     RESET_FAKE(gcp_send_state);
     RESET_FAKE(gcp_send_telemetry);
     RESET_FAKE(gcp_client_destroy);
+    RESET_FAKE(gcp_client_get_stats);
+    gcp_client_init_fake.return_val = &fake_gcp_client;
+    gcp_client_init_static_fake.return_val = &fake_gcp_client;
 
     RESET_FAKE(app_connected_callback);
     RESET_FAKE(app_disconnected_callback);
@@ -91,6 +97,8 @@ void test_gcp_app_init_and_destroy()
     TEST_ASSERT_EQUAL_STRING_MESSAGE(TOPIC_LOG, gcp_app_handle->app_config->topic_path_log, TOPIC_LOG);
     TEST_ASSERT_EQUAL_STRING_MESSAGE(TOPIC_PULSE, gcp_app_handle->app_config->topic_path_pulse, TOPIC_PULSE);
     TEST_ASSERT_EQUAL_MESSAGE(TIMER_PERIOD_MS, gcp_app_handle->app_config->pulse_update_period_ms, "pulse_update_period_ms");
+    TEST_ASSERT_EQUAL_MESSAGE(GCP_APP_TASK_STACK_SIZE, gcp_app_handle->app_config->app_task.stack_size, "app_task.stack_size");
+    TEST_ASSERT_EQUAL_MESSAGE(GCP_APP_TASK_PRIORITY, gcp_app_handle->app_config->app_task.priority, "app_task.priority");
     TEST_ASSERT_EQUAL_MESSAGE(1, gcp_client_init_fake.call_count, "gcp_client_init_fake.call_count");
     TEST_ASSERT_EQUAL_MESSAGE(app_jwt_callback, gcp_client_init_fake.arg0_val->jwt_callback, "gcp_client_init_fake.arg0_val->jwt_callback");
 
@@ -98,6 +106,25 @@ void test_gcp_app_init_and_destroy()
     TEST_ASSERT_EQUAL_MESSAGE(gcp_client_destroy_fake.call_count, 1, "gcp_client_destroy_fake.call_count");
 }
 
+void test_gcp_app_init_static_and_destroy()
+{
+    static gcp_app_static_storage_t storage;
+    gcp_app_config_t static_config = gcp_app_config;
+    static_config.pipeline.enabled = true;
+    gcp_app_handle_t gcp_app_handle = gcp_app_init_static(&static_config, &storage);
+    TEST_ASSERT_EQUAL_MESSAGE((void *)&storage, (void *)gcp_app_handle, "handle placed in storage");
+    TEST_ASSERT_FALSE_MESSAGE(gcp_app_handle->app_config->pipeline.enabled, "pipeline would allocate");
+    TEST_ASSERT_EQUAL_MESSAGE(&app_command_callback, gcp_app_handle->app_config->cmd_callback, "app_command_callback");
+    TEST_ASSERT_EQUAL_MESSAGE(TIMER_PERIOD_MS, gcp_app_handle->app_config->state_update_period_ms, "state_update_period_ms");
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(DEVICE_ID, gcp_app_handle->app_config->device_identifiers->device_id, "device_id");
+    TEST_ASSERT_EQUAL_MESSAGE(0, gcp_client_init_fake.call_count, "gcp_client_init_fake.call_count");
+    TEST_ASSERT_EQUAL_MESSAGE(1, gcp_client_init_static_fake.call_count, "gcp_client_init_static_fake.call_count");
+    TEST_ASSERT_EQUAL_MESSAGE(app_jwt_callback, gcp_client_init_static_fake.arg0_val->jwt_callback, "gcp_client_init_static_fake.arg0_val->jwt_callback");
+
+    gcp_app_destroy(gcp_app_handle);
+    TEST_ASSERT_EQUAL_MESSAGE(1, gcp_client_destroy_fake.call_count, "gcp_client_destroy_fake.call_count");
+}
+
 void mock_app_get_state_callback(gcp_app_handle_t client, gcp_app_state_handle_t state, void *user_context)
 {
     cJSON_AddStringToObject(state, "desire", "objet petit");
@@ -112,11 +139,7 @@ void mock_app_config_callback(gcp_app_handle_t client, gcp_app_config_handle_t c
 
 void test_gcp_app()
 {
-    struct gcp_client_t
-    {
-    } mock_client;
-    gcp_client_handle_t mock_gcp_client_handle = &mock_client;
-    gcp_client_init_fake.return_val = mock_gcp_client_handle;
+    gcp_client_handle_t mock_gcp_client_handle = &fake_gcp_client;
     /* test start */
     gcp_app_handle_t gcp_app_handle = gcp_app_init(&gcp_app_config);
     gcp_app_start(gcp_app_handle);
@@ -131,6 +154,7 @@ void test_gcp_app()
     TEST_ASSERT_EQUAL_MESSAGE(1, app_get_state_callback_fake.call_count, "application state callback called");
     TEST_ASSERT_EQUAL_MESSAGE(1, gcp_send_state_fake.call_count, "state sent");
     TEST_ASSERT_EQUAL_MESSAGE(1, gcp_send_telemetry_fake.call_count, "pulse telemetry sent");
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("pulse", gcp_send_telemetry_fake.arg2_val, "pulse payload without pulse_metrics");
 
     /* test config received */
     app_config_callback_fake.custom_fake = mock_app_config_callback;
@@ -157,7 +181,258 @@ void test_gcp_app()
     TEST_ASSERT_GREATER_THAN_MESSAGE(1, app_get_state_callback_fake.call_count, "application state callback called after reconnect");
     TEST_ASSERT_EQUAL_MESSAGE(1, gcp_send_state_fake.call_count, "state sent after reconnect");
     TEST_ASSERT_GREATER_THAN_MESSAGE(1, gcp_send_telemetry_fake.call_count, "pulse telemetry sent after reconnect");
-    
+    gcp_app_destroy(gcp_app_handle);
+}
+
+static void mock_retry_state_callback(gcp_app_handle_t client, gcp_app_state_handle_t state, void *user_context)
+{
+    cJSON_AddStringToObject(state, "retry", "state");
+}
+
+/* a state that failed to send is not remembered as sent */
+void test_state_retry()
+{
+    gcp_app_handle_t gcp_app_handle = gcp_app_init(&gcp_app_config);
+    gcp_app_start(gcp_app_handle);
+    app_get_state_callback_fake.custom_fake = mock_retry_state_callback;
+    gcp_send_state_fake.return_val = ESP_FAIL;
+    gcp_app_connected_callback(&fake_gcp_client, gcp_app_handle);
+    vTaskDelay(TIMER_PERIOD_MS * 1.5 / portTICK_PERIOD_MS);
+    TEST_ASSERT_EQUAL_MESSAGE(1, gcp_send_state_fake.call_count, "state send failed");
+
+    gcp_send_state_fake.return_val = ESP_OK;
+    vTaskDelay(TIMER_PERIOD_MS / portTICK_PERIOD_MS);
+    TEST_ASSERT_EQUAL_MESSAGE(2, gcp_send_state_fake.call_count, "same state retried");
+    vTaskDelay(TIMER_PERIOD_MS / portTICK_PERIOD_MS);
+    TEST_ASSERT_EQUAL_MESSAGE(2, gcp_send_state_fake.call_count, "sent state not repeated");
+    gcp_app_destroy(gcp_app_handle);
+}
+
+/* with the pipeline the network task reports a failed publish back, the state is queued again */
+void test_pipeline_state_retry()
+{
+    gcp_app_config_t pipeline_config = gcp_app_config;
+    pipeline_config.pipeline.enabled = true;
+    gcp_app_handle_t gcp_app_handle = gcp_app_init(&pipeline_config);
+    gcp_app_start(gcp_app_handle);
+    app_get_state_callback_fake.custom_fake = mock_retry_state_callback;
+    gcp_send_state_fake.return_val = ESP_FAIL;
+    gcp_app_connected_callback(&fake_gcp_client, gcp_app_handle);
+    vTaskDelay(TIMER_PERIOD_MS * 1.5 / portTICK_PERIOD_MS);
+    TEST_ASSERT_EQUAL_MESSAGE(1, gcp_send_state_fake.call_count, "state publish failed");
+    TEST_ASSERT_TRUE_MESSAGE(gcp_app_handle->state_resend, "failure reported to the app task");
+    TEST_ASSERT_EQUAL_MESSAGE(1, gcp_app_handle->pipeline_failed, "failure counted");
+
+    gcp_send_state_fake.return_val = ESP_OK;
+    vTaskDelay(TIMER_PERIOD_MS / portTICK_PERIOD_MS);
+    TEST_ASSERT_EQUAL_MESSAGE(2, gcp_send_state_fake.call_count, "state queued again");
+    TEST_ASSERT_FALSE_MESSAGE(gcp_app_handle->state_resend, "publish succeeded");
+    vTaskDelay(TIMER_PERIOD_MS / portTICK_PERIOD_MS);
+    TEST_ASSERT_EQUAL_MESSAGE(2, gcp_send_state_fake.call_count, "sent state not repeated");
+    gcp_app_destroy(gcp_app_handle);
+}
+
+#define JOB_PERIOD_MS 50
+#define JOB_UPDATED_PERIOD_MS 200
+#define JOB_CONFIG_UPDATE "{\"device_config\":{\"jobs\":{\"tjob\":" STR(JOB_UPDATED_PERIOD_MS) "}}}"
+
+static int job_runs;
+static int connected_job_runs;
+
+static void test_job(gcp_app_handle_t client, void *job_context)
+{
+    (*(int *)job_context)++;
+}
+
+void test_gcp_app_schedule()
+{
+    gcp_app_handle_t gcp_app_handle = gcp_app_init(&gcp_app_config);
+    job_runs = 0;
+    connected_job_runs = 0;
+    gcp_app_job_t job = gcp_app_schedule(gcp_app_handle, "tjob", JOB_PERIOD_MS, 0, 0, &test_job, &job_runs);
+    TEST_ASSERT_GREATER_OR_EQUAL_MESSAGE(0, job, "job scheduled");
+    TEST_ASSERT_LESS_THAN_MESSAGE(0, gcp_app_schedule(gcp_app_handle, "tjob", JOB_PERIOD_MS, 0, 0, &test_job, &job_runs), "duplicate name refused");
+    gcp_app_schedule(gcp_app_handle, "tconnected", JOB_PERIOD_MS, 0, GCP_APP_JOB_WHEN_CONNECTED, &test_job, &connected_job_runs);
+    gcp_app_start(gcp_app_handle);
+
+    vTaskDelay(JOB_PERIOD_MS * 3.5 / portTICK_PERIOD_MS);
+    TEST_ASSERT_EQUAL_MESSAGE(3, job_runs, "job runs every period");
+    TEST_ASSERT_EQUAL_MESSAGE(0, connected_job_runs, "connected job waits for the connection");
+    TEST_ASSERT_EQUAL_MESSAGE(0, gcp_send_state_fake.call_count, "state waits for the connection");
+
+    /* cloud period override */
+    gcp_app_config_callback(&fake_gcp_client, JOB_CONFIG_UPDATE, gcp_app_handle);
+    job_runs = 0;
+    vTaskDelay(JOB_UPDATED_PERIOD_MS * 1.5 / portTICK_PERIOD_MS);
+    TEST_ASSERT_EQUAL_MESSAGE(1, job_runs, "job runs with the period from device_config");
+
+    gcp_app_set_job_period(gcp_app_handle, "tjob", GCP_APP_JOB_IDLE);
+    job_runs = 0;
+    vTaskDelay(JOB_UPDATED_PERIOD_MS * 1.5 / portTICK_PERIOD_MS);
+    TEST_ASSERT_EQUAL_MESSAGE(0, job_runs, "idle job doesn't run");
+    gcp_app_set_job_period(gcp_app_handle, "tjob", JOB_UPDATED_PERIOD_MS);
+
+    gcp_app_unschedule(gcp_app_handle, job);
+    job_runs = 0;
+    vTaskDelay(JOB_UPDATED_PERIOD_MS * 1.5 / portTICK_PERIOD_MS);
+    TEST_ASSERT_EQUAL_MESSAGE(0, job_runs, "job doesn't run after unschedule");
+    gcp_app_destroy(gcp_app_handle);
+}
+
+#define TX_JOB_PERIOD_MS 100
+#define TX_JOB_LATE_PERIOD_MS 120
+#define TX_ALIGN_SLACK_MS 30
+
+static int tx_job_runs;
+static int tx_late_job_runs;
+
+static void tx_job(gcp_app_handle_t client, void *job_context)
+{
+    (*(int *)job_context)++;
+    gcp_app_send_telemetry(client, "tx", "1");
+}
+
+void test_tx_alignment()
+{
+    gcp_app_config_t aligned_config = gcp_app_config;
+    aligned_config.tx_align_slack_ms = TX_ALIGN_SLACK_MS;
+    gcp_app_handle_t gcp_app_handle = gcp_app_init(&aligned_config);
+    tx_job_runs = 0;
+    tx_late_job_runs = 0;
+    gcp_app_schedule(gcp_app_handle, "tx", TX_JOB_PERIOD_MS, 0, GCP_APP_JOB_TX, &tx_job, &tx_job_runs);
+    gcp_app_schedule(gcp_app_handle, "tx_late", TX_JOB_LATE_PERIOD_MS, 0, GCP_APP_JOB_TX, &tx_job, &tx_late_job_runs);
+    gcp_app_start(gcp_app_handle);
+
+    /* tx_late is due 20 ms after tx, inside the slack, so it is pulled into the same window */
+    vTaskDelay((TX_JOB_PERIOD_MS + TX_JOB_LATE_PERIOD_MS) / 2 / portTICK_PERIOD_MS);
+    TEST_ASSERT_EQUAL_MESSAGE(1, tx_job_runs, "tx job ran");
+    TEST_ASSERT_EQUAL_MESSAGE(1, tx_late_job_runs, "late tx job ran early");
+    TEST_ASSERT_EQUAL_MESSAGE(2, gcp_send_telemetry_fake.call_count, "both jobs published");
+    TEST_ASSERT_EQUAL_MESSAGE(1, gcp_app_handle->radio_wakes, "radio woke once");
+    TEST_ASSERT_EQUAL_MESSAGE(1, gcp_app_handle->tx_aligned, "one job aligned");
+    gcp_app_destroy(gcp_app_handle);
+}
+
+/* device_config is kept in RTC memory and applied before connecting on the next wake */
+void test_duty_cycle_config_cache()
+{
+    gcp_app_config_t duty_cycle_config = gcp_app_config;
+    duty_cycle_config.duty_cycle.enabled = true;
+    gcp_app_handle_t gcp_app_handle = gcp_app_init(&duty_cycle_config);
+    TEST_ASSERT_TRUE_MESSAGE(gcp_client_init_fake.arg0_val->jwt_rtc_cache, "JWT kept in RTC memory");
+    gcp_app_config_callback(&fake_gcp_client, CONFIG_UPDATE, gcp_app_handle);
+    gcp_app_destroy(gcp_app_handle);
+
+    gcp_app_handle_t woken_app_handle = gcp_app_init(&duty_cycle_config);
+    TEST_ASSERT_EQUAL_MESSAGE(TIMER_UPDATED_PERIOD_MS, woken_app_handle->app_config->state_update_period_ms, "cached state period");
+    TEST_ASSERT_EQUAL_MESSAGE(TIMER_UPDATED_PERIOD_MS, woken_app_handle->app_config->pulse_update_period_ms, "cached pulse period");
+    gcp_app_destroy(woken_app_handle);
+}
+
+/* firmware chunks go to the OTA module, other commands to the application */
+void test_ota_command_routing()
+{
+    gcp_app_handle_t gcp_app_handle = gcp_app_init(&gcp_app_config);
+    gcp_app_command_callback(&fake_gcp_client, "/devices/" DEVICE_ID "/commands/" GCP_OTA_MQTT_TOPIC, "{\"offset\":0,\"total\":3,\"data\":\"AAAA\"}", gcp_app_handle);
+    TEST_ASSERT_EQUAL_MESSAGE(0, app_command_callback_fake.call_count, "ota chunk kept from the application");
+    gcp_app_command_callback(&fake_gcp_client, "/devices/" DEVICE_ID "/commands/led", "on", gcp_app_handle);
+    TEST_ASSERT_EQUAL_MESSAGE(1, app_command_callback_fake.call_count, "application command");
+    gcp_app_destroy(gcp_app_handle);
+}
+
+#define BENCHMARK_MESSAGES 100
+#define BENCHMARK_PUBLISH_LATENCY_US 2000
+#define BENCHMARK_DRAIN_TIMEOUT_MS 2000
+
+/* simulates the time esp_mqtt_client_publish spends writing to the TLS socket */
+esp_err_t slow_gcp_send_telemetry(gcp_client_handle_t client, const char *topic, const char *msg)
+{
+    int64_t start = esp_timer_get_time();
+    while (esp_timer_get_time() - start < BENCHMARK_PUBLISH_LATENCY_US)
+    {
+    }
+    return ESP_OK;
+}
+
+static void run_telemetry_benchmark(gcp_app_handle_t gcp_app_handle, char *name)
+{
+    int64_t worst_us = 0;
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < BENCHMARK_MESSAGES; i++)
+    {
+        int64_t send_start = esp_timer_get_time();
+        while (gcp_app_send_telemetry(gcp_app_handle, "bench", "1") == ESP_ERR_NO_MEM)
+        {
+            vTaskDelay(1);
+        }
+        int64_t send_us = esp_timer_get_time() - send_start;
+        worst_us = send_us > worst_us ? send_us : worst_us;
+    }
+    int64_t producer_us = esp_timer_get_time() - start;
+    for (int i = 0; i < BENCHMARK_DRAIN_TIMEOUT_MS && gcp_send_telemetry_fake.call_count < BENCHMARK_MESSAGES; i++)
+    {
+        vTaskDelay(1 / portTICK_PERIOD_MS + 1);
+    }
+    int64_t total_us = esp_timer_get_time() - start;
+    ESP_LOGI(TAG, "[%s] %d messages, app task blocked %lld us (worst single send %lld us), published in %lld us, %lld msg/s",
+             name, BENCHMARK_MESSAGES, producer_us, worst_us, total_us, BENCHMARK_MESSAGES * 1000000LL / total_us);
+    TEST_ASSERT_EQUAL_MESSAGE(BENCHMARK_MESSAGES, gcp_send_telemetry_fake.call_count, "all messages published");
+}
+
+/* noise inside the deadbands leaves the reported link, and so device_state, unchanged */
+void test_link_deadband()
+{
+    gcp_app_link_config_t config = {
+        .rssi_deadband = 5,
+        .rtt_deadband_ms = 100};
+    gcp_link_sample_t reported = {.associated = true, .rssi = -60, .channel = 6, .phy = "11n", .rtt_ms = 80};
+    gcp_link_sample_t sample = reported;
+    sample.rssi = -63;
+    sample.rtt_ms = 150;
+    TEST_ASSERT_FALSE_MESSAGE(gcp_link_apply_deadband(&reported, &sample, &config), "inside deadbands");
+    TEST_ASSERT_EQUAL_MESSAGE(-60, reported.rssi, "rssi kept");
+    sample.rssi = -66;
+    TEST_ASSERT_TRUE_MESSAGE(gcp_link_apply_deadband(&reported, &sample, &config), "rssi past deadband");
+    TEST_ASSERT_EQUAL_MESSAGE(-66, reported.rssi, "rssi reported");
+    sample.channel = 11;
+    TEST_ASSERT_TRUE_MESSAGE(gcp_link_apply_deadband(&reported, &sample, &config), "channel change");
+}
+
+void test_pipeline_benchmark()
+{
+    gcp_send_telemetry_fake.custom_fake = slow_gcp_send_telemetry;
+    gcp_app_handle_t direct_app = gcp_app_init(&gcp_app_config);
+    run_telemetry_benchmark(direct_app, "direct");
+    gcp_app_destroy(direct_app);
+
+    setUp();
+    gcp_send_telemetry_fake.custom_fake = slow_gcp_send_telemetry;
+    gcp_app_config_t pipeline_config = gcp_app_config;
+    pipeline_config.pipeline.enabled = true;
+    pipeline_config.pipeline.queue_length = 32;
+    gcp_app_handle_t pipeline_app = gcp_app_init(&pipeline_config);
+    gcp_app_start(pipeline_app);
+    run_telemetry_benchmark(pipeline_app, "pipeline");
+    TEST_ASSERT_EQUAL_MESSAGE(32, pipeline_app->pipeline_queue.slot_count, "pipeline queue length");
+    gcp_app_destroy(pipeline_app);
+}
+
+void test_gcp_mem_accounting()
+{
+    gcp_mem_stats_t before, stats;
+    gcp_mem_get_stats(GCP_MEM_OTA, &before);
+    void *first = gcp_mem_malloc(GCP_MEM_OTA, 100);
+    void *second = gcp_mem_calloc(GCP_MEM_OTA, 10, 30);
+    gcp_mem_get_stats(GCP_MEM_OTA, &stats);
+    TEST_ASSERT_EQUAL_MESSAGE(before.current_bytes + 400, stats.current_bytes, "current_bytes");
+    TEST_ASSERT_EQUAL_MESSAGE(before.live_allocs + 2, stats.live_allocs, "live_allocs");
+    gcp_mem_free(second);
+    gcp_mem_free(first);
+    gcp_mem_get_stats(GCP_MEM_OTA, &stats);
+    TEST_ASSERT_EQUAL_MESSAGE(before.current_bytes, stats.current_bytes, "current_bytes after free");
+    TEST_ASSERT_EQUAL_MESSAGE(before.live_allocs, stats.live_allocs, "live_allocs after free");
+    TEST_ASSERT_EQUAL_MESSAGE(before.total_allocs + 2, stats.total_allocs, "total_allocs");
+    TEST_ASSERT_GREATER_THAN_MESSAGE(before.current_bytes + 399, stats.peak_bytes, "peak_bytes");
 }
 
 void test_device_data()
@@ -181,6 +456,106 @@ void test_device_data()
     gcp_nvs_delete_data(key, sizeof(test_struct));
     gcp_nvs_get_data(key, &test_struct, sizeof(test_struct));
     TEST_ASSERT_EQUAL_STRING("test3", test_struct.name);
+
+    /* sets are coalesced in RAM until the flush */
+    gcp_nvs_stats_t before, after;
+    gcp_nvs_flush();
+    gcp_nvs_get_stats(&before);
+    strcpy(test_struct.name, "test4");
+    gcp_nvs_set_data(key, &test_struct, sizeof(test_struct));
+    strcpy(test_struct.name, "test5");
+    gcp_nvs_set_data(key, &test_struct, sizeof(test_struct));
+    gcp_nvs_get_stats(&after);
+    TEST_ASSERT_EQUAL_MESSAGE(before.commits, after.commits, "no commit before the flush");
+    TEST_ASSERT_EQUAL_MESSAGE(1, after.dirty_keys, "dirty_keys");
+    gcp_nvs_flush();
+    gcp_nvs_get_stats(&after);
+    TEST_ASSERT_EQUAL_MESSAGE(before.commits + 1, after.commits, "one commit for both sets");
+    TEST_ASSERT_EQUAL_MESSAGE(0, after.dirty_keys, "dirty_keys after flush");
+
+    /* a get with another size doesn't replace a pending set with flash or the default */
+    strcpy(test_struct.name, "test6");
+    gcp_nvs_set_data(key, &test_struct, sizeof(test_struct));
+    char short_name[4] = "abc";
+    gcp_nvs_get_data(key, short_name, sizeof(short_name));
+    TEST_ASSERT_EQUAL_STRING("abc", short_name);
+    strcpy(test_struct.name, "empty");
+    gcp_nvs_get_data(key, &test_struct, sizeof(test_struct));
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("test6", test_struct.name, "pending set kept");
+    gcp_nvs_flush();
+
+    /* the timer wakes the flush task, which commits without a gcp_nvs_flush call */
+    gcp_nvs_set_flush_delay(20);
+    gcp_nvs_get_stats(&before);
+    strcpy(test_struct.name, "test7");
+    gcp_nvs_set_data(key, &test_struct, sizeof(test_struct));
+    vTaskDelay(pdMS_TO_TICKS(200));
+    gcp_nvs_get_stats(&after);
+    TEST_ASSERT_EQUAL_MESSAGE(before.commits + 1, after.commits, "committed by the flush task");
+    TEST_ASSERT_EQUAL_MESSAGE(0, after.dirty_keys, "dirty_keys after the timer");
+    gcp_nvs_set_flush_delay(GCP_NVS_DEFAULT_FLUSH_DELAY_MS);
+
+    /* typed values keep the default on a miss or another type */
+    int32_t number = 7;
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, gcp_nvs_get_i32("number", &number));
+    TEST_ASSERT_EQUAL(7, number);
+    gcp_nvs_set_i32("number", 42);
+    TEST_ASSERT_EQUAL(ESP_OK, gcp_nvs_get_i32("number", &number));
+    TEST_ASSERT_EQUAL(42, number);
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_TYPE_MISMATCH, gcp_nvs_get_i32(key, &number));
+    gcp_nvs_set_blob(key, 2, &test_struct, sizeof(test_struct));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_VERSION, gcp_nvs_get_blob(key, 3, &test_struct, sizeof(test_struct)));
+}
+
+typedef struct
+{
+    int32_t count;
+    int32_t limit;
+} counter_v1_t;
+
+static int migrations;
+
+/* version 0 was a bare int32_t count */
+static esp_err_t migrate_counter(uint8_t from_version, const void *old_data, size_t old_size, void *new_data, size_t new_size)
+{
+    migrations++;
+    if (from_version != 0 || old_size != sizeof(int32_t))
+    {
+        return ESP_FAIL;
+    }
+    counter_v1_t *counter = new_data;
+    memcpy(&counter->count, old_data, old_size);
+    counter->limit = 100;
+    return ESP_OK;
+}
+
+void test_device_data_migration()
+{
+    static const gcp_nvs_schema_t schemas[] = {
+        {.name = "counter", .version = 1, .size = sizeof(counter_v1_t), .migrate = migrate_counter},
+        {.name = "clash", .version = 1, .size = sizeof(counter_v1_t), .migrate = migrate_counter},
+    };
+    int32_t legacy = 5;
+    gcp_nvs_set_data("counter", &legacy, sizeof(legacy));
+    /* a plain blob starting like the typed header of a version 1 blob */
+    uint8_t clash[4] = {0x56, 0x44, 0x03, 0x01};
+    gcp_nvs_set_data("clash", clash, sizeof(clash));
+    migrations = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, gcp_nvs_init(schemas, 2));
+    TEST_ASSERT_EQUAL_MESSAGE(2, migrations, "both keys migrated");
+
+    counter_v1_t counter = {0};
+    TEST_ASSERT_EQUAL(ESP_OK, gcp_nvs_get_blob("counter", 1, &counter, sizeof(counter)));
+    TEST_ASSERT_EQUAL(5, counter.count);
+    TEST_ASSERT_EQUAL(100, counter.limit);
+    TEST_ASSERT_EQUAL_MESSAGE(ESP_OK, gcp_nvs_get_blob("clash", 1, &counter, sizeof(counter)), "plain blob migrated from version 0");
+    TEST_ASSERT_EQUAL_MEMORY(clash, &counter.count, sizeof(clash));
+
+    /* the same firmware doesn't look at the keys again */
+    gcp_nvs_set_data("counter", &legacy, sizeof(legacy));
+    TEST_ASSERT_EQUAL(ESP_OK, gcp_nvs_init(schemas, 2));
+    TEST_ASSERT_EQUAL_MESSAGE(2, migrations, "migrations run once per firmware");
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_TYPE_MISMATCH, gcp_nvs_get_blob("counter", 1, &counter, sizeof(counter)));
 }
 
 void app_main()
@@ -197,7 +572,18 @@ void app_main()
     gcp_app_start(gcp_app_handle);
     */
     RUN_TEST(test_gcp_app_init_and_destroy);
+    RUN_TEST(test_gcp_app_init_static_and_destroy);
     RUN_TEST(test_gcp_app);
-    //RUN_TEST(test_device_data);
+    RUN_TEST(test_state_retry);
+    RUN_TEST(test_pipeline_state_retry);
+    RUN_TEST(test_gcp_app_schedule);
+    RUN_TEST(test_tx_alignment);
+    RUN_TEST(test_duty_cycle_config_cache);
+    RUN_TEST(test_ota_command_routing);
+    RUN_TEST(test_link_deadband);
+    RUN_TEST(test_gcp_mem_accounting);
+    RUN_TEST(test_pipeline_benchmark);
+    RUN_TEST(test_device_data);
+    RUN_TEST(test_device_data_migration);
     UNITY_END();
 }
\ No newline at end of file
@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+"""Makes a GDP1 patch that rebuilds new.bin from old.bin, the firmware running on the devices.
+
+usage: gcp_ota_patch.py old.bin new.bin firmware.patch
+"""
+import struct
+import sys
+
+BLOCK = 16   # shortest copy worth its 9 bytes op
+STRIDE = 4   # base offsets indexed
+
+
+def matching_length(base, base_offset, target, target_offset):
+    length = 0
+    limit = min(len(base) - base_offset, len(target) - target_offset)
+    while length < limit:
+        step = min(256, limit - length)
+        if base[base_offset + length:base_offset + length + step] == target[target_offset + length:target_offset + length + step]:
+            length += step
+            continue
+        while length < limit and base[base_offset + length] == target[target_offset + length]:
+            length += 1
+        break
+    return length
+
+
+def make_patch(base, target):
+    index = {}
+    for offset in range(0, len(base) - BLOCK + 1, STRIDE):
+        index.setdefault(base[offset:offset + BLOCK], offset)
+    ops = [b"GDP1" + struct.pack("<II", len(target), len(base))]
+    insert = bytearray()
+    position = 0
+    while position < len(target):
+        base_offset = index.get(target[position:position + BLOCK])
+        if base_offset is None:
+            insert.append(target[position])
+            position += 1
+            continue
+        if insert:
+            ops.append(struct.pack("<BI", 2, len(insert)) + insert)
+            insert = bytearray()
+        length = matching_length(base, base_offset, target, position)
+        ops.append(struct.pack("<BII", 1, base_offset, length))
+        position += length
+    if insert:
+        ops.append(struct.pack("<BI", 2, len(insert)) + insert)
+    ops.append(b"\x00")
+    return b"".join(ops)
+
+
+def main():
+    if len(sys.argv) != 4:
+        sys.exit(__doc__)
+    with open(sys.argv[1], "rb") as f:
+        base = f.read()
+    with open(sys.argv[2], "rb") as f:
+        target = f.read()
+    patch = make_patch(base, target)
+    with open(sys.argv[3], "wb") as f:
+        f.write(patch)
+    print("%s: %d bytes, %.1f%% of %d" % (sys.argv[3], len(patch), 100.0 * len(patch) / len(target), len(target)))
+
+
+if __name__ == "__main__":
+    main()